@@ -0,0 +1,584 @@
+// End-to-end benchmark: builds a synthetic repository with the zengit binary it is given,
+// then times whole commands (one process each, no server) over several runs and reports
+// the distribution as JSON.
+//
+//   cc -O2 -o zengit-bench bench/bench.c
+//   ./zengit-bench [options] ./zengit > baseline.json
+//
+// With --allocations each command also reports its heap allocations, read from the trace
+// of a zengit built with -DZENGIT_COUNT_ALLOCATIONS.
+//
+// The generator is seeded, so the same options produce the same repository and the same
+// sequence of edits on every machine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#define NULL_DEVICE "NUL"
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <unistd.h>
+#include <sys/wait.h>
+#define NULL_DEVICE "/dev/null"
+#define makeDirectory(path) mkdir(path, 0777)
+#endif
+
+#define MAX_PATH_LENGTH 1024
+#define MAX_ARGS 16
+#define MAX_RUNS 1000
+#define MAX_OPERATIONS 32
+#define LINE_WIDTH 64
+#define NEEDLE_PER_LINES 100
+#define NEEDLE "needle"
+#define BENCH_USER "bench"
+
+typedef struct {
+    const char* zengit;
+    const char* dir;
+    int files;
+    int minSize;
+    int maxSize;
+    int depth;
+    int fanout;
+    int commits;
+    int changeRate;            // percent of files rewritten per commit
+    int runs;
+    unsigned long long seed;
+    const char* out;
+    bool keep;
+    const char* tracePath;     // set when allocations are counted
+} BenchOptions;
+
+typedef struct {
+    const char* name;
+    char command[MAX_PATH_LENGTH];
+    double samples[MAX_RUNS]; // milliseconds
+    int count;
+    int failures;
+    uint64_t allocations;     // summed over allocationRuns
+    int allocationRuns;
+} Operation;
+
+typedef struct {
+    Operation operations[MAX_OPERATIONS];
+    int count;
+} Results;
+
+static unsigned long long rngState;
+
+uint64_t nextRandom(void) {
+    // xorshift64*
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545F4914F6CDD1DULL;
+}
+
+int randomBelow(int limit) {
+    return limit > 0 ? (int)(nextRandom() % (uint64_t)limit) : 0;
+}
+
+double clockMilliseconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+#endif
+}
+
+// Runs zengit with argv (argv[0] is replaced by the binary) and output discarded. Returns
+// the exit code, or -1 when the process could not be started.
+int runZengit(const BenchOptions* options, char* argv[]) {
+    argv[0] = (char*)options->zengit;
+    fflush(stdout);
+    int savedOut = dup(1), savedErr = dup(2);
+    int nullFd = open(NULL_DEVICE, O_WRONLY);
+    if (savedOut < 0 || savedErr < 0 || nullFd < 0) {
+        return -1;
+    }
+    dup2(nullFd, 1);
+    dup2(nullFd, 2);
+    close(nullFd);
+
+#ifdef _WIN32
+    int exitCode = (int)_spawnv(_P_WAIT, options->zengit, (const char* const*)argv);
+#else
+    int exitCode = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(options->zengit, argv);
+        _exit(127);
+    }
+    int status;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)) {
+        exitCode = WEXITSTATUS(status);
+    }
+#endif
+
+    dup2(savedOut, 1);
+    dup2(savedErr, 2);
+    close(savedOut);
+    close(savedErr);
+    return exitCode;
+}
+
+// Splits a zengit command line on spaces after the program slot, which runZengit fills in.
+// Arguments never contain spaces here.
+int splitCommand(char* command, char* argv[]) {
+    int argc = 1;
+    for (char* token = strtok(command, " "); token && argc < MAX_ARGS - 1; token = strtok(NULL, " ")) {
+        argv[argc++] = token;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+bool runCommandLine(const BenchOptions* options, const char* commandLine) {
+    char command[MAX_PATH_LENGTH];
+    char* argv[MAX_ARGS];
+    snprintf(command, sizeof(command), "%s", commandLine);
+    splitCommand(command, argv);
+    return runZengit(options, argv) == 0;
+}
+
+Operation* findOperation(Results* results, const char* name, const char* shown) {
+    for (int i = 0; i < results->count; i++) {
+        if (strcmp(results->operations[i].name, name) == 0) return &results->operations[i];
+    }
+    if (results->count == MAX_OPERATIONS) {
+        return NULL;
+    }
+    Operation* operation = &results->operations[results->count++];
+    memset(operation, 0, sizeof(*operation));
+    operation->name = name;
+    snprintf(operation->command, sizeof(operation->command), "%s", shown);
+    return operation;
+}
+
+// Reads the process-wide heap allocation count from the counters at the end of a trace.
+bool readHeapAllocations(const char* tracePath, uint64_t* allocations) {
+    static const char counter[] = "\"heap allocations\":";
+    FILE* file = fopen(tracePath, "r");
+    if (!file) {
+        return false;
+    }
+    char line[4096];
+    bool found = false;
+    while (fgets(line, sizeof(line), file)) {
+        const char* value = strstr(line, "\"name\":\"counters\"") ? strstr(line, counter) : NULL;
+        if (value) {
+            *allocations = strtoull(value + strlen(counter), NULL, 10);
+            found = true;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+// shown is the command as reported, for command lines that name a particular commit.
+void timeCommand(const BenchOptions* options, Results* results, const char* name, const char* shown,
+                 const char* commandLine) {
+    Operation* operation = findOperation(results, name, shown ? shown : commandLine);
+    if (!operation || operation->count == MAX_RUNS) {
+        return;
+    }
+    char command[MAX_PATH_LENGTH];
+    char* argv[MAX_ARGS];
+    snprintf(command, sizeof(command), "%s", commandLine);
+    splitCommand(command, argv);
+
+    if (options->tracePath) remove(options->tracePath);
+    double start = clockMilliseconds();
+    int exitCode = runZengit(options, argv);
+    operation->samples[operation->count++] = clockMilliseconds() - start;
+    if (exitCode != 0) operation->failures++;
+
+    uint64_t allocations;
+    if (options->tracePath && readHeapAllocations(options->tracePath, &allocations)) {
+        operation->allocations += allocations;
+        operation->allocationRuns++;
+    }
+}
+
+// Sizes are spread evenly over powers of two between minSize and maxSize, so small files
+// dominate the count while large ones still dominate the bytes.
+int pickFileSize(const BenchOptions* options) {
+    int doublings = 0;
+    while (((long long)options->minSize << (doublings + 1)) <= options->maxSize) doublings++;
+    long long size = (long long)options->minSize << randomBelow(doublings + 1);
+    size += randomBelow((int)size);
+    return size > options->maxSize ? options->maxSize : (int)size;
+}
+
+void filePath(const BenchOptions* options, int file, char* path, size_t size) {
+    // The directory is a function of the file number alone, so rewrites hit the same path.
+    unsigned long long saved = rngState;
+    rngState = options->seed * 0x9E3779B97F4A7C15ULL + (unsigned long long)file + 1;
+    int levels = randomBelow(options->depth + 1);
+    size_t length = 0;
+    for (int level = 0; level < levels && length < size; level++) {
+        length += snprintf(path + length, size - length, "d%d/", randomBelow(options->fanout));
+    }
+    if (length < size) snprintf(path + length, size - length, "f%d.txt", file);
+    rngState = saved;
+}
+
+bool ensureParentDirectories(char* path) {
+    for (char* p = path; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        bool ok = makeDirectory(path) == 0 || errno == EEXIST;
+        *p = '/';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+bool writeSyntheticFile(const BenchOptions* options, int file) {
+    static const char* words[] = {
+        "alpha", "bravo", "delta", "index", "commit", "branch", "merge", "status", "value", "return",
+        "static", "buffer", "length", "offset", "result", "config", "stream", "object", "signal", "vector"
+    };
+    char path[MAX_PATH_LENGTH];
+    filePath(options, file, path, sizeof(path));
+    if (!ensureParentDirectories(path)) {
+        fprintf(stderr, "Failed to create the directories for %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    int size = pickFileSize(options);
+    int written = 0;
+    while (written < size) {
+        char line[LINE_WIDTH + 16];
+        int length = 0;
+        if (randomBelow(NEEDLE_PER_LINES) == 0) {
+            length += snprintf(line, sizeof(line), "%s ", NEEDLE);
+        }
+        while (length < LINE_WIDTH - 8) {
+            length += snprintf(line + length, sizeof(line) - length, "%s ",
+                               words[randomBelow((int)(sizeof(words) / sizeof(words[0])))]);
+        }
+        line[length - 1] = '\n';
+        fwrite(line, 1, length, out);
+        written += length;
+    }
+    return fclose(out) == 0;
+}
+
+bool rewriteFiles(const BenchOptions* options) {
+    int changes = (int)((long long)options->files * options->changeRate / 100);
+    if (changes < 1) changes = 1;
+    for (int i = 0; i < changes; i++) {
+        if (!writeSyntheticFile(options, randomBelow(options->files))) return false;
+    }
+    return true;
+}
+
+// The last two commits on master, older one first. Returns false if there are fewer.
+bool readLastCommitIds(char ids[2][64]) {
+    FILE* file = fopen(".zengit/commits/master_HEAD", "r");
+    if (!file) {
+        return false;
+    }
+    int count = 0;
+    char line[64];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) continue;
+        memcpy(ids[0], ids[1], 64);
+        snprintf(ids[1], 64, "%s", line);
+        count++;
+    }
+    fclose(file);
+    return count >= 2;
+}
+
+bool removeTree(const char* path) {
+    struct stat pathStat;
+    if (lstat(path, &pathStat) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISDIR(pathStat.st_mode)) {
+        return remove(path) == 0;
+    }
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return false;
+    }
+    bool ok = true;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char child[MAX_PATH_LENGTH];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        ok = removeTree(child) && ok;
+    }
+    closedir(dir);
+    return rmdir(path) == 0 && ok;
+}
+
+int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+double percentile(const double* sorted, int count, double fraction) {
+    double position = fraction * (count - 1);
+    int lower = (int)position;
+    if (lower + 1 >= count) return sorted[count - 1];
+    return sorted[lower] + (sorted[lower + 1] - sorted[lower]) * (position - lower);
+}
+
+void writeReport(FILE* out, const BenchOptions* options, const Results* results, double generateMs, double historyMs) {
+    fprintf(out, "{\n  \"config\": {\"files\": %d, \"minSize\": %d, \"maxSize\": %d, \"depth\": %d, \"fanout\": %d, "
+            "\"commits\": %d, \"changeRate\": %d, \"runs\": %d, \"seed\": %llu},\n",
+            options->files, options->minSize, options->maxSize, options->depth, options->fanout,
+            options->commits, options->changeRate, options->runs, options->seed);
+    fprintf(out, "  \"setup\": {\"generateMs\": %.3f, \"historyMs\": %.3f},\n", generateMs, historyMs);
+    fprintf(out, "  \"operations\": [\n");
+    for (int i = 0; i < results->count; i++) {
+        const Operation* operation = &results->operations[i];
+        double sorted[MAX_RUNS];
+        double total = 0;
+        memcpy(sorted, operation->samples, operation->count * sizeof(double));
+        qsort(sorted, operation->count, sizeof(double), compareDoubles);
+        for (int j = 0; j < operation->count; j++) total += sorted[j];
+        int n = operation->count;
+        fprintf(out, "    {\"name\": \"%s\", \"command\": \"%s\", \"runs\": %d, \"failures\": %d, "
+                "\"minMs\": %.3f, \"medianMs\": %.3f, \"p90Ms\": %.3f, \"p99Ms\": %.3f, \"maxMs\": %.3f, \"meanMs\": %.3f",
+                operation->name, operation->command, n, operation->failures,
+                n ? sorted[0] : 0, n ? percentile(sorted, n, 0.5) : 0, n ? percentile(sorted, n, 0.9) : 0,
+                n ? percentile(sorted, n, 0.99) : 0, n ? sorted[n - 1] : 0, n ? total / n : 0);
+        if (operation->allocationRuns > 0) {
+            fprintf(out, ", \"meanAllocations\": %llu",
+                    (unsigned long long)(operation->allocations / operation->allocationRuns));
+        }
+        fprintf(out, "}%s\n", i + 1 < results->count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+void printUsage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options] <zengit binary>\n"
+            "  --dir <path>          repository to create; must not exist (zengit-bench-repo)\n"
+            "  --files <n>           files in the work tree (2000)\n"
+            "  --min-size <bytes>    smallest file (64)\n"
+            "  --max-size <bytes>    largest file (65536)\n"
+            "  --depth <n>           deepest directory level (3)\n"
+            "  --fanout <n>          subdirectories per directory (8)\n"
+            "  --commits <n>         history to generate before timing (20)\n"
+            "  --change-rate <pct>   files rewritten per commit, in percent (5)\n"
+            "  --runs <n>            timed runs per command (5)\n"
+            "  --seed <n>            generator seed (1)\n"
+            "  --out <file>          JSON report (stdout)\n"
+            "  --keep                keep the repository afterwards\n"
+            "  --allocations         report heap allocations per command; needs a zengit built with\n"
+            "                        -DZENGIT_COUNT_ALLOCATIONS, and timings include writing its trace\n",
+            program);
+}
+
+bool parseOptions(int argc, char* argv[], BenchOptions* options) {
+    *options = (BenchOptions){ NULL, "zengit-bench-repo", 2000, 64, 65536, 3, 8, 20, 5, 5, 1, NULL, false, NULL };
+    for (int i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        int* number = strcmp(option, "--files") == 0 ? &options->files :
+                      strcmp(option, "--min-size") == 0 ? &options->minSize :
+                      strcmp(option, "--max-size") == 0 ? &options->maxSize :
+                      strcmp(option, "--depth") == 0 ? &options->depth :
+                      strcmp(option, "--fanout") == 0 ? &options->fanout :
+                      strcmp(option, "--commits") == 0 ? &options->commits :
+                      strcmp(option, "--change-rate") == 0 ? &options->changeRate :
+                      strcmp(option, "--runs") == 0 ? &options->runs : NULL;
+        if (number && value) {
+            *number = atoi(value);
+            i++;
+        } else if (strcmp(option, "--seed") == 0 && value) {
+            options->seed = strtoull(value, NULL, 10);
+            i++;
+        } else if (strcmp(option, "--dir") == 0 && value) {
+            options->dir = value;
+            i++;
+        } else if (strcmp(option, "--out") == 0 && value) {
+            options->out = value;
+            i++;
+        } else if (strcmp(option, "--keep") == 0) {
+            options->keep = true;
+        } else if (strcmp(option, "--allocations") == 0) {
+            options->tracePath = "";
+        } else if (option[0] != '-' && !options->zengit) {
+            options->zengit = option;
+        } else {
+            return false;
+        }
+    }
+    return options->zengit && options->files > 0 && options->minSize > 0 && options->maxSize >= options->minSize &&
+           options->depth >= 0 && options->fanout > 0 && options->commits >= 2 && options->changeRate >= 0 &&
+           options->runs > 0 && options->runs <= MAX_RUNS;
+}
+
+// One run: edit, then status, add and commit the edit, read the history every way log
+// offers, grep a file in the work tree and in a commit, move to an older commit and back,
+// and revert to the previous commit.
+void runIteration(const BenchOptions* options, Results* results, const char* grepFile) {
+    if (!rewriteFiles(options)) {
+        return;
+    }
+    timeCommand(options, results, "status", NULL, "status");
+    timeCommand(options, results, "add", NULL, "add .");
+    timeCommand(options, results, "commit", NULL, "commit -m bench");
+
+    char ids[2][64];
+    if (!readLastCommitIds(ids)) {
+        fprintf(stderr, "Expected at least two commits on master.\n");
+        return;
+    }
+
+    char today[16], tomorrow[16];
+    time_t now = time(NULL);
+    strftime(today, sizeof(today), "%Y-%m-%d", localtime(&now));
+    now += 24 * 60 * 60;
+    strftime(tomorrow, sizeof(tomorrow), "%Y-%m-%d", localtime(&now));
+
+    char command[MAX_PATH_LENGTH];
+    timeCommand(options, results, "log", NULL, "log");
+    timeCommand(options, results, "log -n", NULL, "log -n 10");
+    timeCommand(options, results, "log -branch", NULL, "log -branch master");
+    timeCommand(options, results, "log -author", NULL, "log -author " BENCH_USER);
+    snprintf(command, sizeof(command), "log -since %s", today);
+    timeCommand(options, results, "log -since", NULL, command);
+    snprintf(command, sizeof(command), "log -before %s", tomorrow);
+    timeCommand(options, results, "log -before", NULL, command);
+    timeCommand(options, results, "log -search", NULL, "log -search bench");
+
+    snprintf(command, sizeof(command), "grep -f %s -p %s -n", grepFile, NEEDLE);
+    timeCommand(options, results, "grep", "grep -f <file> -p " NEEDLE " -n", command);
+    snprintf(command, sizeof(command), "grep -f %s -p %s -c %s", grepFile, NEEDLE, ids[1]);
+    timeCommand(options, results, "grep -c", "grep -f <file> -p " NEEDLE " -c <HEAD>", command);
+
+    snprintf(command, sizeof(command), "checkout %s", ids[0]);
+    timeCommand(options, results, "checkout commit", "checkout <HEAD-1>", command);
+    timeCommand(options, results, "checkout branch", NULL, "checkout master");
+
+    snprintf(command, sizeof(command), "revert -m bench %s", ids[0]);
+    timeCommand(options, results, "revert", "revert -m bench <HEAD-1>", command);
+
+    // Put this run's snapshot back on top so every run starts from a tree of the same size,
+    // whatever the revert left behind.
+    snprintf(command, sizeof(command), "checkout %s", ids[1]);
+    if (!runCommandLine(options, command) || !runCommandLine(options, "add .") ||
+        !runCommandLine(options, "commit -m restore")) {
+        fprintf(stderr, "Failed to restore commit %s after the revert.\n", ids[1]);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    char zengitPath[MAX_PATH_LENGTH];
+#ifdef _WIN32
+    bool resolved = _fullpath(zengitPath, options.zengit, sizeof(zengitPath)) != NULL;
+#else
+    bool resolved = realpath(options.zengit, zengitPath) != NULL;
+#endif
+    if (!resolved) {
+        fprintf(stderr, "Cannot find %s: %s\n", options.zengit, strerror(errno));
+        return 1;
+    }
+    options.zengit = zengitPath;
+
+    FILE* out = stdout;
+    if (options.out && !(out = fopen(options.out, "w"))) {
+        fprintf(stderr, "Failed to open %s: %s\n", options.out, strerror(errno));
+        return 1;
+    }
+
+    struct stat dirStat;
+    if (stat(options.dir, &dirStat) == 0) {
+        fprintf(stderr, "%s already exists; remove it or choose another --dir.\n", options.dir);
+        return 1;
+    }
+    char startDir[MAX_PATH_LENGTH];
+    if (!getcwd(startDir, sizeof(startDir)) || makeDirectory(options.dir) != 0 || chdir(options.dir) != 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", options.dir, strerror(errno));
+        return 1;
+    }
+    // Every command pays for its own start-up; a warm server would hide what changed.
+    putenv("ZENGIT_NO_SERVER=1");
+    static char traceSetting[MAX_PATH_LENGTH + 64], tracePath[MAX_PATH_LENGTH + 32];
+    if (options.tracePath) {
+        snprintf(tracePath, sizeof(tracePath), "%s/zengit-bench-trace.json", startDir);
+        snprintf(traceSetting, sizeof(traceSetting), "ZENGIT_TRACE=%s", tracePath);
+        putenv(traceSetting);
+        options.tracePath = tracePath;
+    }
+    rngState = options.seed ? options.seed : 1;
+
+    double start = clockMilliseconds();
+    bool ok = runCommandLine(&options, "init") && runCommandLine(&options, "config user.name " BENCH_USER);
+    for (int file = 0; ok && file < options.files; file++) {
+        ok = writeSyntheticFile(&options, file);
+    }
+    double generateMs = clockMilliseconds() - start;
+
+    start = clockMilliseconds();
+    for (int commit = 0; ok && commit < options.commits; commit++) {
+        char command[64];
+        snprintf(command, sizeof(command), "commit -m history-%d", commit);
+        ok = (commit == 0 || rewriteFiles(&options)) && runCommandLine(&options, "add .") &&
+             runCommandLine(&options, command);
+    }
+    double historyMs = clockMilliseconds() - start;
+    if (!ok) {
+        fprintf(stderr, "Failed to generate the repository in %s.\n", options.dir);
+        return 1;
+    }
+
+    char grepFile[MAX_PATH_LENGTH];
+    filePath(&options, 0, grepFile, sizeof(grepFile));
+    static Results results;
+    for (int run = 0; run < options.runs; run++) {
+        runIteration(&options, &results, grepFile);
+        fprintf(stderr, "run %d/%d done\n", run + 1, options.runs);
+    }
+
+    if (chdir(startDir) != 0 || (!options.keep && !removeTree(options.dir))) {
+        fprintf(stderr, "Failed to remove %s.\n", options.dir);
+    }
+    if (options.tracePath) {
+        remove(options.tracePath);
+        bool counted = false;
+        for (int i = 0; i < results.count; i++) counted = counted || results.operations[i].allocationRuns > 0;
+        if (!counted) fprintf(stderr, "No allocation counts; build zengit with -DZENGIT_COUNT_ALLOCATIONS.\n");
+    }
+    writeReport(out, &options, &results, generateMs, historyMs);
+    if (out != stdout) fclose(out);
+    return 0;
+}
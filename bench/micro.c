@@ -0,0 +1,644 @@
+// Microbenchmarks for the inner kernels of zengit: file hashing and copying, manifest
+// building, wildcard matching, grep scanning and highlighting, log parsing, log dates and
+// path normalization. Each kernel
+// runs over a few input shapes with a warmup, on a pinned CPU, and reports time per call
+// plus cycles and instructions per call where perf_event is available.
+//
+//   cc -O2 -o zengit-micro bench/micro.c
+//   ./zengit-micro --json baseline.json
+//   ./zengit-micro --baseline baseline.json --threshold 10
+//
+// With --baseline the exit status is 2 if any kernel got slower than the baseline by more
+// than the threshold, so the run can gate a change. The kernels are not part of the public
+// API, so the whole of zengit.c is compiled into this file. Built with
+// -DZENGIT_COUNT_ALLOCATIONS it also reports the heap allocations each call makes.
+
+#define _GNU_SOURCE
+#include "../zengit.c"
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+#define MICRO_MAX_BENCHMARKS 64
+#define MICRO_MAX_SAMPLES 101
+#define MICRO_FIXTURE_DIR "zengit-micro-fixtures"
+#define MICRO_LOG_ENTRIES 256
+#define MICRO_TREE_DIRECTORIES 4
+#define MICRO_TREE_FILES 64
+
+typedef struct {
+    const char* kernel;
+    char param[64];
+    void (*run)(void* context);   // one call of the kernel
+    void* context;
+} MicroBenchmark;
+
+typedef struct {
+    long long iterations;         // calls per sample
+    double medianNs;              // per call
+    double minNs;
+    double cycles;                // per call, negative when unavailable
+    double instructions;
+    double allocations;           // per call, negative unless allocations are counted
+} MicroResult;
+
+typedef struct {
+    int samples;
+    double warmupMs;
+    double sampleMs;
+    int cpu;                      // -1 leaves the scheduler alone
+    const char* filter;
+    const char* jsonPath;
+    const char* baselinePath;
+    double threshold;             // percent
+} MicroOptions;
+
+// Kernel inputs.
+typedef struct {
+    char first[MAX_PATH_LENGTH];
+    char second[MAX_PATH_LENGTH];
+} FilePair;
+
+typedef struct {
+    char path[MAX_PATH_LENGTH];
+} HashInput;
+
+typedef struct {
+    const char* pattern;
+    char* text;
+} MatchInput;
+
+typedef struct {
+    char* line;
+    size_t length;
+    const AhoCorasick* automaton;
+    int* hitCounts;
+} ScanInput;
+
+typedef struct {
+    FILE* file;
+} LogInput;
+
+typedef struct {
+    const char* input;
+    char buffer[MAX_PATH_LENGTH];
+} PathInput;
+
+static volatile long long microSink;
+
+void runHashFileContents(void* context) {
+    HashInput* input = context;
+    uint64_t hash;
+    long long size;
+    hashFileContents(input->path, &hash, &size);
+    microSink += (long long)hash;
+}
+
+// What commit does for the snapshot it just wrote: walk, hash every file and sort.
+void runBuildManifest(void* context) {
+    Manifest manifest;
+    buildManifestFromDirectory(context, &manifest, true);
+    microSink += manifest.count;
+    freeManifest(&manifest);
+}
+
+void runCopyFile(void* context) {
+    FilePair* pair = context;
+    copyFile(pair->first, pair->second);
+}
+
+void runMatch(void* context) {
+    MatchInput* input = context;
+    microSink += match(input->pattern, input->text);
+}
+
+void runAcScan(void* context) {
+    ScanInput* input = context;
+    microSink += acScan(input->automaton, input->line, input->length, input->hitCounts, false, NULL, NULL);
+}
+
+void runHighlightPatterns(void* context) {
+    ScanInput* input = context;
+    highlightPatterns(input->line, input->automaton);
+}
+
+// One entry per call; the file is rewound at the end.
+void runReadLogEntry(void* context) {
+    LogInput* input = context;
+    LogEntry entry;
+    if (!readLogEntry(input->file, &entry)) {
+        rewind(input->file);
+        readLogEntry(input->file, &entry);
+    }
+    microSink += entry.filesCommitted;
+}
+
+void runLogDateStringToTimeT(void* context) {
+    microSink += (long long)logDateStringToTimeT(context);
+}
+
+// normalizePath works in place, so each call starts from a fresh copy of the input.
+void runNormalizePath(void* context) {
+    PathInput* input = context;
+    strcpy(input->buffer, input->input);
+    normalizePath(input->buffer);
+    microSink += input->buffer[0];
+}
+
+#ifdef __linux__
+typedef struct {
+    int cycles;
+    int instructions;
+} PerfCounters;
+
+int openPerfCounter(uint64_t config, int group, bool userOnly) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = userOnly;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Counts kernel and user cycles when allowed, user-space only otherwise.
+bool openPerfCounters(PerfCounters* counters) {
+    for (int userOnly = 0; userOnly <= 1; userOnly++) {
+        counters->cycles = openPerfCounter(PERF_COUNT_HW_CPU_CYCLES, -1, userOnly);
+        if (counters->cycles < 0) continue;
+        counters->instructions = openPerfCounter(PERF_COUNT_HW_INSTRUCTIONS, counters->cycles, userOnly);
+        if (counters->instructions >= 0) return true;
+        close(counters->cycles);
+    }
+    counters->cycles = counters->instructions = -1;
+    return false;
+}
+
+void startPerfCounters(const PerfCounters* counters) {
+    if (counters->cycles < 0) return;
+    ioctl(counters->cycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters->cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+bool stopPerfCounters(const PerfCounters* counters, uint64_t* cycles, uint64_t* instructions) {
+    if (counters->cycles < 0) return false;
+    ioctl(counters->cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t values[3];
+    if (read(counters->cycles, values, sizeof(values)) != (ssize_t)sizeof(values) || values[0] != 2) {
+        return false;
+    }
+    *cycles = values[1];
+    *instructions = values[2];
+    return true;
+}
+#else
+typedef struct {
+    int cycles;
+} PerfCounters;
+
+bool openPerfCounters(PerfCounters* counters) {
+    counters->cycles = -1;
+    return false;
+}
+
+void startPerfCounters(const PerfCounters* counters) {
+}
+
+bool stopPerfCounters(const PerfCounters* counters, uint64_t* cycles, uint64_t* instructions) {
+    return false;
+}
+#endif
+
+bool pinToCpu(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#endif
+}
+
+int compareSampleTimes(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+void runBenchmarkLoop(const MicroBenchmark* benchmark, long long iterations) {
+    for (long long i = 0; i < iterations; i++) {
+        benchmark->run(benchmark->context);
+    }
+}
+
+// Finds how many calls fill one sample, warms up for at least warmupMs, then takes the
+// median of the samples. The cycle and instruction counts come from the same samples.
+MicroResult measureBenchmark(const MicroBenchmark* benchmark, const MicroOptions* options, const PerfCounters* counters) {
+    MicroResult result = { 1, 0, 0, -1, -1, -1 };
+    int64_t warmupEnd = clockNanoseconds() + (int64_t)(options->warmupMs * 1e6);
+    while (true) {
+        int64_t start = clockNanoseconds();
+        runBenchmarkLoop(benchmark, result.iterations);
+        double elapsedMs = (clockNanoseconds() - start) / 1e6;
+        if (elapsedMs >= options->sampleMs && clockNanoseconds() >= warmupEnd) break;
+        if (elapsedMs < options->sampleMs) result.iterations *= 2;
+    }
+
+    double times[MICRO_MAX_SAMPLES], cycles[MICRO_MAX_SAMPLES], instructions[MICRO_MAX_SAMPLES];
+    int counted = 0;
+#ifdef ZENGIT_COUNT_ALLOCATIONS
+    uint64_t allocationsBefore = traceCounters[TRACE_HEAP_ALLOCATIONS];
+#endif
+    for (int s = 0; s < options->samples; s++) {
+        startPerfCounters(counters);
+        int64_t start = clockNanoseconds();
+        runBenchmarkLoop(benchmark, result.iterations);
+        times[s] = (double)(clockNanoseconds() - start) / result.iterations;
+        uint64_t sampleCycles, sampleInstructions;
+        if (stopPerfCounters(counters, &sampleCycles, &sampleInstructions)) {
+            cycles[counted] = (double)sampleCycles / result.iterations;
+            instructions[counted++] = (double)sampleInstructions / result.iterations;
+        }
+    }
+#ifdef ZENGIT_COUNT_ALLOCATIONS
+    result.allocations = (double)(traceCounters[TRACE_HEAP_ALLOCATIONS] - allocationsBefore) /
+                         ((double)result.iterations * options->samples);
+#endif
+    qsort(times, options->samples, sizeof(double), compareSampleTimes);
+    result.medianNs = times[options->samples / 2];
+    result.minNs = times[0];
+    if (counted > 0) {
+        qsort(cycles, counted, sizeof(double), compareSampleTimes);
+        qsort(instructions, counted, sizeof(double), compareSampleTimes);
+        result.cycles = cycles[counted / 2];
+        result.instructions = instructions[counted / 2];
+    }
+    return result;
+}
+
+bool writeFixtureFile(const char* path, long long size, char lastByte) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    for (long long i = 0; i < size; i++) {
+        fputc(i + 1 == size ? lastByte : 'a' + (int)(i % 26), file);
+    }
+    return fclose(file) == 0;
+}
+
+bool writeFixtureLog(const char* path, int messageLength) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < MICRO_LOG_ENTRIES; i++) {
+        fprintf(file, "Date: Mon Oct 19 06:44:%02d 2026\nUser: bench\nCommit ID: %040d\nBranch: master\nMessage: ",
+                i % 60, i);
+        for (int j = 0; j < messageLength; j++) fputc('a' + (i + j) % 26, file);
+        fprintf(file, "\nFiles Committed: %d\n\n", i);
+    }
+    return fclose(file) == 0;
+}
+
+char* repeatedText(const char* unit, int length, const char* tail) {
+    size_t unitLength = strlen(unit), tailLength = strlen(tail);
+    char* text = malloc(length + tailLength + 1);
+    if (!text) return NULL;
+    for (int i = 0; i < length; i++) text[i] = unit[i % unitLength];
+    memcpy(text + length, tail, tailLength + 1);
+    return text;
+}
+
+typedef struct {
+    MicroBenchmark benchmarks[MICRO_MAX_BENCHMARKS];
+    int count;
+    HashInput hashInputs[3];
+    char treeDir[MAX_PATH_LENGTH];
+    FilePair copyPairs[3];
+    MatchInput matchInputs[6];
+    AhoCorasick grepAutomaton;
+    int grepHitCounts[4];
+    ScanInput scanInputs[3];
+    LogInput logInputs[2];
+    PathInput pathInputs[3];
+} MicroSuite;
+
+void addBenchmark(MicroSuite* suite, const char* kernel, const char* param, void (*run)(void*), void* context) {
+    if (suite->count == MICRO_MAX_BENCHMARKS) return;
+    MicroBenchmark* benchmark = &suite->benchmarks[suite->count++];
+    benchmark->kernel = kernel;
+    snprintf(benchmark->param, sizeof(benchmark->param), "%s", param);
+    benchmark->run = run;
+    benchmark->context = context;
+}
+
+bool buildSuite(MicroSuite* suite) {
+    static const long long sizes[] = { 4096, 262144, 4194304 };
+    static const char* sizeNames[] = { "4K", "256K", "4M" };
+    char param[64];
+    ensureDirectoryExists(MICRO_FIXTURE_DIR);
+
+    for (int i = 0; i < 3; i++) {
+        HashInput* input = &suite->hashInputs[i];
+        snprintf(input->path, sizeof(input->path), "%s/hash-%s", MICRO_FIXTURE_DIR, sizeNames[i]);
+        if (!writeFixtureFile(input->path, sizes[i], '\n')) {
+            return false;
+        }
+        addBenchmark(suite, "hashFileContents", sizeNames[i], runHashFileContents, input);
+    }
+
+    snprintf(suite->treeDir, sizeof(suite->treeDir), "%s/tree", MICRO_FIXTURE_DIR);
+    ensureDirectoryExists(suite->treeDir);
+    for (int i = 0; i < MICRO_TREE_FILES; i++) {
+        char path[MAX_PATH_LENGTH + 64];
+        snprintf(path, sizeof(path), "%s/dir-%d", suite->treeDir, i % MICRO_TREE_DIRECTORIES);
+        ensureDirectoryExists(path);
+        snprintf(path, sizeof(path), "%s/dir-%d/file-%d", suite->treeDir, i % MICRO_TREE_DIRECTORIES, i);
+        if (!writeFixtureFile(path, sizes[0], '\n')) {
+            return false;
+        }
+    }
+    snprintf(param, sizeof(param), "%d files of %s", MICRO_TREE_FILES, sizeNames[0]);
+    addBenchmark(suite, "buildManifest", param, runBuildManifest, suite->treeDir);
+
+    for (int i = 0; i < 3; i++) {
+        FilePair* pair = &suite->copyPairs[i];
+        snprintf(pair->first, sizeof(pair->first), "%s", suite->hashInputs[i].path);
+        snprintf(pair->second, sizeof(pair->second), "%s/copy-%s", MICRO_FIXTURE_DIR, sizeNames[i]);
+        addBenchmark(suite, "copyFile", sizeNames[i], runCopyFile, pair);
+    }
+
+    // Ignore-style patterns against paths, then the backtracking worst case.
+    static const int textLengths[] = { 16, 256, 4096 };
+    for (int i = 0; i < 3; i++) {
+        MatchInput* suffix = &suite->matchInputs[2 * i];
+        MatchInput* stars = &suite->matchInputs[2 * i + 1];
+        suffix->pattern = "*.o";
+        suffix->text = repeatedText("src/", textLengths[i], "main.o");
+        stars->pattern = "*a*a*a*a*b";
+        stars->text = repeatedText("a", textLengths[i], "c");
+        if (!suffix->text || !stars->text) return false;
+        snprintf(param, sizeof(param), "*.o vs %d-char path", textLengths[i]);
+        addBenchmark(suite, "match", param, runMatch, suffix);
+        snprintf(param, sizeof(param), "*a*a*a*a*b vs %d a's", textLengths[i]);
+        addBenchmark(suite, "match", param, runMatch, stars);
+    }
+
+    // grep's kernels: one pass of the automaton per line for the hit counts, and the
+    // highlighted output of a matching line.
+    static const char* grepPatterns[] = { "needle", "stack", "haystack", "missing" };
+    if (!acCompile(&suite->grepAutomaton, grepPatterns, 4)) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        ScanInput* input = &suite->scanInputs[i];
+        input->line = repeatedText("hay needle stack ", textLengths[i] * 4, "\n");
+        if (!input->line) return false;
+        input->length = strlen(input->line);
+        input->automaton = &suite->grepAutomaton;
+        input->hitCounts = suite->grepHitCounts;
+        snprintf(param, sizeof(param), "4 patterns, %d-char line", textLengths[i] * 4);
+        addBenchmark(suite, "acScan", param, runAcScan, input);
+    }
+    for (int i = 0; i < 3; i++) {
+        snprintf(param, sizeof(param), "4 patterns, %d-char line", textLengths[i] * 4);
+        addBenchmark(suite, "highlightPatterns", param, runHighlightPatterns, &suite->scanInputs[i]);
+    }
+
+    static const int messageLengths[] = { 16, 200 };
+    for (int i = 0; i < 2; i++) {
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/log-%d", MICRO_FIXTURE_DIR, messageLengths[i]);
+        if (!writeFixtureLog(path, messageLengths[i]) || !(suite->logInputs[i].file = fopen(path, "r"))) {
+            return false;
+        }
+        snprintf(param, sizeof(param), "%d-char message", messageLengths[i]);
+        addBenchmark(suite, "readLogEntry", param, runReadLogEntry, &suite->logInputs[i]);
+    }
+
+    addBenchmark(suite, "logDateStringToTimeT", "Jan", runLogDateStringToTimeT, "Thu Jan  1 00:00:01 2026");
+    addBenchmark(suite, "logDateStringToTimeT", "Dec", runLogDateStringToTimeT, "Mon Dec 28 23:59:59 2026");
+
+    static const char* paths[] = {
+        "./main.c",
+        "src\\module\\parser\\lexer.c",
+        "./a/very/long/path/that/goes/down/many/levels/of/nested/directories/before/it/reaches/the/file.txt"
+    };
+    static const char* pathNames[] = { "short", "backslashes", "deep" };
+    for (int i = 0; i < 3; i++) {
+        suite->pathInputs[i].input = paths[i];
+        addBenchmark(suite, "normalizePath", pathNames[i], runNormalizePath, &suite->pathInputs[i]);
+    }
+    return true;
+}
+
+void freeSuite(MicroSuite* suite) {
+    for (int i = 0; i < 6; i++) free(suite->matchInputs[i].text);
+    for (int i = 0; i < 3; i++) free(suite->scanInputs[i].line);
+    acFree(&suite->grepAutomaton);
+    for (int i = 0; i < 2; i++) {
+        if (suite->logInputs[i].file) fclose(suite->logInputs[i].file);
+    }
+    deleteDirectoryRecursively(MICRO_FIXTURE_DIR);
+    rmdir(MICRO_FIXTURE_DIR);
+}
+
+// Reads "field": "value" or "field": number out of one line of a report.
+bool jsonField(const char* line, const char* field, char* value, size_t size) {
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\": ", field);
+    const char* start = strstr(line, key);
+    if (!start) return false;
+    start += strlen(key);
+    bool quoted = *start == '"';
+    if (quoted) start++;
+    size_t length = strcspn(start, quoted ? "\"" : ",}");
+    snprintf(value, size, "%.*s", (int)(length < size ? length : size - 1), start);
+    return true;
+}
+
+// Baseline median per kernel and parameter, or a negative value when it has none.
+double baselineMedian(const char* baselinePath, const MicroBenchmark* benchmark) {
+    FILE* file = fopen(baselinePath, "r");
+    if (!file) return -1;
+    char line[512], kernel[64], param[64], median[64];
+    double result = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (jsonField(line, "kernel", kernel, sizeof(kernel)) && jsonField(line, "param", param, sizeof(param)) &&
+            jsonField(line, "medianNs", median, sizeof(median)) &&
+            strcmp(kernel, benchmark->kernel) == 0 && strcmp(param, benchmark->param) == 0) {
+            result = atof(median);
+            break;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+void writeJsonNumber(FILE* out, double value) {
+    if (value < 0) {
+        fprintf(out, "null");
+    } else {
+        fprintf(out, "%.3f", value);
+    }
+}
+
+void writeMicroJson(FILE* out, const MicroBenchmark* benchmarks, const MicroResult* results, int count) {
+    fprintf(out, "{\"results\": [\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "  {\"kernel\": \"%s\", \"param\": \"%s\", \"iterations\": %lld, \"medianNs\": %.3f, \"minNs\": %.3f, "
+                "\"cycles\": ", benchmarks[i].kernel, benchmarks[i].param, results[i].iterations,
+                results[i].medianNs, results[i].minNs);
+        writeJsonNumber(out, results[i].cycles);
+        fprintf(out, ", \"instructions\": ");
+        writeJsonNumber(out, results[i].instructions);
+        fprintf(out, ", \"allocations\": ");
+        writeJsonNumber(out, results[i].allocations);
+        fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "]}\n");
+}
+
+void printMicroUsage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --filter <text>       only kernels whose name contains text\n"
+            "  --samples <n>         samples per benchmark, median reported (15)\n"
+            "  --warmup <ms>         minimum warmup per benchmark (50)\n"
+            "  --sample-time <ms>    minimum duration of one sample (10)\n"
+            "  --cpu <n>             CPU to pin to, -1 for none (0)\n"
+            "  --json <file>         write the results as JSON\n"
+            "  --baseline <file>     compare against a JSON report; exit 2 on regressions\n"
+            "  --threshold <pct>     slowdown that counts as a regression (10)\n",
+            program);
+}
+
+bool parseMicroOptions(int argc, char* argv[], MicroOptions* options) {
+    *options = (MicroOptions){ 15, 50, 10, 0, NULL, NULL, NULL, 10 };
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) return false;
+        if (strcmp(argv[i], "--filter") == 0) {
+            options->filter = value;
+        } else if (strcmp(argv[i], "--samples") == 0) {
+            options->samples = atoi(value);
+        } else if (strcmp(argv[i], "--warmup") == 0) {
+            options->warmupMs = atof(value);
+        } else if (strcmp(argv[i], "--sample-time") == 0) {
+            options->sampleMs = atof(value);
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            options->cpu = atoi(value);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            options->jsonPath = value;
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            options->baselinePath = value;
+        } else if (strcmp(argv[i], "--threshold") == 0) {
+            options->threshold = atof(value);
+        } else {
+            return false;
+        }
+        i++;
+    }
+    return options->samples > 0 && options->samples <= MICRO_MAX_SAMPLES && options->sampleMs > 0;
+}
+
+int main(int argc, char* argv[]) {
+    MicroOptions options;
+    if (!parseMicroOptions(argc, argv, &options)) {
+        printMicroUsage(argv[0]);
+        return 1;
+    }
+    if (options.cpu >= 0 && !pinToCpu(options.cpu)) {
+        fprintf(stderr, "Could not pin to CPU %d; timings may be noisier.\n", options.cpu);
+    }
+    PerfCounters counters;
+    if (!openPerfCounters(&counters)) {
+        fprintf(stderr, "perf_event is not available; cycles and instructions are not reported.\n");
+    }
+
+    static MicroSuite suite;
+    if (!buildSuite(&suite)) {
+        freeSuite(&suite);
+        return 1;
+    }
+
+    // highlightPatterns prints; its output goes to the null device while it is measured.
+    fflush(stdout);
+    int savedOut = dup(1);
+    FILE* nullDevice = fopen(NULL_DEVICE, "w");
+    if (savedOut < 0 || !nullDevice) {
+        fprintf(stderr, "Failed to open the null device.\n");
+        freeSuite(&suite);
+        return 1;
+    }
+
+    static MicroResult results[MICRO_MAX_BENCHMARKS];
+    static MicroBenchmark selected[MICRO_MAX_BENCHMARKS];
+    int count = 0;
+    int regressions = 0;
+    printf("%-22s %-28s %12s %12s %12s %12s %8s\n", "kernel", "param", "median ns", "min ns", "cycles", "instructions",
+           "allocs");
+    for (int i = 0; i < suite.count; i++) {
+        const MicroBenchmark* benchmark = &suite.benchmarks[i];
+        if (options.filter && !strstr(benchmark->kernel, options.filter)) continue;
+
+        fflush(stdout);
+        dup2(fileno(nullDevice), 1);
+        MicroResult result = measureBenchmark(benchmark, &options, &counters);
+        fflush(stdout);
+        dup2(savedOut, 1);
+
+        selected[count] = *benchmark;
+        results[count++] = result;
+        printf("%-22s %-28s %12.1f %12.1f ", benchmark->kernel, benchmark->param, result.medianNs, result.minNs);
+        if (result.cycles >= 0) {
+            printf("%12.0f %12.0f", result.cycles, result.instructions);
+        } else {
+            printf("%12s %12s", "-", "-");
+        }
+        if (result.allocations >= 0) {
+            printf(" %8.2f", result.allocations);
+        } else {
+            printf(" %8s", "-");
+        }
+
+        double baseline = options.baselinePath ? baselineMedian(options.baselinePath, benchmark) : -1;
+        if (baseline > 0) {
+            double change = (result.medianNs - baseline) * 100.0 / baseline;
+            bool regressed = change > options.threshold;
+            printf("  %+6.1f%%%s", change, regressed ? "  REGRESSION" : "");
+            if (regressed) regressions++;
+        }
+        printf("\n");
+    }
+    fclose(nullDevice);
+    close(savedOut);
+
+    if (options.jsonPath) {
+        FILE* out = fopen(options.jsonPath, "w");
+        if (!out) {
+            fprintf(stderr, "Failed to write %s: %s\n", options.jsonPath, strerror(errno));
+        } else {
+            writeMicroJson(out, selected, results, count);
+            fclose(out);
+        }
+    }
+    freeSuite(&suite);
+
+    if (options.baselinePath) {
+        printf("%d regression(s) above %.1f%% against %s.\n", regressions, options.threshold, options.baselinePath);
+        return regressions > 0 ? 2 : 0;
+    }
+    return 0;
+}
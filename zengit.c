@@ -0,0 +1,9524 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "zengit.h"
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <windows.h>
+#include <tchar.h>
+#else
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#endif
+
+#ifdef ZENGIT_COUNT_ALLOCATIONS
+// Built with -DZENGIT_COUNT_ALLOCATIONS, every heap call in this file is counted as a
+// trace counter, so ZENGIT_TRACE reports how many allocations a command made.
+static void countHeapCall(bool isFree);
+
+static void* countedMalloc(size_t size) {
+    countHeapCall(false);
+    return malloc(size);
+}
+
+static void* countedCalloc(size_t count, size_t size) {
+    countHeapCall(false);
+    return calloc(count, size);
+}
+
+static void* countedRealloc(void* block, size_t size) {
+    countHeapCall(false);
+    return realloc(block, size);
+}
+
+static char* countedStrdup(const char* text) {
+    countHeapCall(false);
+    return strdup(text);
+}
+
+static void countedFree(void* block) {
+    if (block) countHeapCall(true);
+    free(block);
+}
+
+#define malloc countedMalloc
+#define calloc countedCalloc
+#define realloc countedRealloc
+#define strdup countedStrdup
+#define free countedFree
+#endif
+
+#ifndef _WIN32
+// The little of the Win32 file API the tool uses, on top of POSIX, so the same code builds
+// outside Windows. Paths may use '\\' as the separator, as on Windows.
+#define MAX_PATH 260
+#define INVALID_FILE_ATTRIBUTES ((DWORD)-1)
+#define FILE_ATTRIBUTE_READONLY 0x1
+#define FILE_ATTRIBUTE_HIDDEN 0x2
+#define FILE_ATTRIBUTE_DIRECTORY 0x10
+
+typedef uint32_t DWORD;
+typedef int BOOL;
+
+static void toPosixPath(const char* path, char* out, size_t size) {
+    snprintf(out, size, "%s", path);
+    for (char* c = out; *c; c++) {
+        if (*c == '\\') *c = '/';
+    }
+}
+
+static DWORD GetFileAttributesA(const char* path) {
+    char posixPath[1024];
+    toPosixPath(path, posixPath, sizeof(posixPath));
+    struct stat pathStat;
+    if (stat(posixPath, &pathStat) != 0) return INVALID_FILE_ATTRIBUTES;
+    DWORD attributes = 0;
+    if (S_ISDIR(pathStat.st_mode)) attributes |= FILE_ATTRIBUTE_DIRECTORY;
+    if (!(pathStat.st_mode & S_IWUSR)) attributes |= FILE_ATTRIBUTE_READONLY;
+    return attributes;
+}
+
+// Dot-directories are already hidden.
+static BOOL SetFileAttributesA(const char* path, DWORD attributes) {
+    (void)attributes;
+    return access(path, F_OK) == 0;
+}
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define MAX_CONFIG_LINE 1024
+#define MAX_PATH_LENGTH 1024
+#define MAX_LINE_LENGTH 1024
+#define ARENA_CHUNK_SIZE 65536
+#define TRACE_MAX_DEPTH 64
+#define MAX_LOG_ENTRY_SIZE 2048
+#define BRANCHES_DIR ".zengit/branches"
+#define CURRENT_BRANCH_FILE ".zengit/CurrentBranch"
+#define INDEX_FILE ".zengit/index"
+#define COMMIT_DIR ".zengit/commits"
+#define LOG_FILE_PATH ".zengit/logs"
+#define TAGS_DIR ".zengit/tags"
+#define MAX_TAG_INFO_SIZE 1024
+#define IGNORE_FILE_NAME ".zengitignore"
+#define GLOBAL_IGNORE_PATH "C:/Users/parham/.zengitignore"
+#define SYSTEM_CONFIG_PATH "C:/ProgramData/zengit/.zengitconfig"
+#define GLOBAL_CONFIG_PATH "C:/Users/parham/.zengitconfig"
+#define LOCAL_CONFIG_PATH "./.zengitconfig"
+#define CONFIG_CACHE_FILE ".zengit/config.cache"
+#define CONFIG_CACHE_MAGIC "ZCF2"
+#define MANIFEST_SUFFIX ".manifest"
+#define PARENTS_SUFFIX ".parents"
+#define MERGE_HEAD_FILE ".zengit/MERGE_HEAD"
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define DIFF_CONTEXT_LINES 3
+#define DIFF_MIN_COST 256
+#define SIMILARITY_SKETCH_SIZE 32
+#define SIMILARITY_BANDS 8
+#define RENAME_SIMILARITY_THRESHOLD 50
+#define FSMONITOR_SOCKET ".zengit/fsmonitor.sock"
+#define FSMONITOR_STATE_FILE ".zengit/fsmonitor_state"
+#define FSMONITOR_MAX_DIRTY 65536
+#define SERVE_SOCKET ".zengit/serve.sock"
+#define SERVE_MAX_REQUEST 65536
+#define SHORTCUTS_FILE ".zengit/shortcuts"
+#define SHORTCUTS_INDEX_FILE ".zengit/shortcuts.index"
+#define SHORTCUTS_LOCK_FILE ".zengit/shortcuts.lock"
+#define SHORTCUTS_INDEX_MAGIC "ZSI2"
+#define SHORTCUTS_COMPACT_MIN_BYTES 65536
+#define SHORTCUT_TOMBSTONE '#'
+#define SHORTCUT_SLOT_DELETED UINT64_MAX
+#define STAGE_JOURNAL_FILE ".zengit/stage_journal"
+#define STAGE_JOURNAL_MAGIC 0x4a53475aU
+#define STAGE_JOURNAL_DEFAULT_SIZE (64ULL << 20)
+#define STAGE_JOURNAL_MIN_SIZE 4096
+#define SERVE_MAX_READERS 8
+#define UNTRACKED_CACHE_FILE ".zengit/untracked_cache"
+#define SPARSE_CHECKOUT_FILE ".zengit/sparse-checkout"
+#define STASH_DIR ".zengit/stash"
+#define STASH_LIST_FILE ".zengit/stash/list"
+#define SPARSE_PARENT 1
+#define SPARSE_INCLUDED 2
+#define COPY_RING_ENTRIES 512
+#define COPY_BATCH_FILES 64
+#define COPY_SMALL_FILE_LIMIT 65536
+#define STREAM_BUFFER_SIZE 65536
+#define TAR_BLOCK_SIZE 512
+#define _GNU_SOURCE
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+
+typedef struct LogEntry {
+    char date[30];
+    char user[50];
+    char commitID[41];
+    char branch[50];
+    char message[256];
+    int filesCommitted;
+} LogEntry;
+
+
+typedef struct {
+    int lastN;
+    char branchName[100];
+    char authorName[100];
+    char sinceDate[20];
+    char beforeDate[20];
+    char searchWord[100];
+} LogOptions;
+
+typedef struct {
+    char commitId[MAX_PATH];
+    int64_t creationTime; // nanoseconds
+} CommitEntry;
+
+// Bump allocator for data that lives exactly as long as its owner: allocations are carved
+// out of large chunks and arenaFree releases all of them at once.
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk* head;
+} Arena;
+
+typedef struct {
+    char* path;                   // in the manifest's arena
+    uint64_t hash;
+    long long size;
+    bool hashed;
+} ManifestEntry;
+
+typedef struct {
+    ManifestEntry* entries;
+    int count;
+    int capacity;
+    Arena strings;
+} Manifest;
+
+static void* arenaAlloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaChunk* chunk = arena->head;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunkSize = size > ARENA_CHUNK_SIZE / 4 ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(ArenaChunk) + chunkSize);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->used = 0;
+        chunk->size = chunkSize;
+        // Oversized blocks go behind the current chunk so its free space stays usable.
+        if (arena->head && chunkSize != ARENA_CHUNK_SIZE) {
+            chunk->next = arena->head->next;
+            arena->head->next = chunk;
+        } else {
+            chunk->next = arena->head;
+            arena->head = chunk;
+        }
+    }
+    void* block = chunk->data + chunk->used;
+    chunk->used += size;
+    return block;
+}
+
+static char* arenaStrndup(Arena* arena, const char* text, size_t length) {
+    char* copy = arenaAlloc(arena, length + 1);
+    if (copy) {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+static char* arenaStrdup(Arena* arena, const char* text) {
+    return arenaStrndup(arena, text, strlen(text));
+}
+
+static void arenaFree(Arena* arena) {
+    while (arena->head) {
+        ArenaChunk* next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
+
+// Allocations that last for the rest of the command, such as an expanded alias.
+static Arena commandArena;
+
+// Tracing, switched on by the ZENGIT_TRACE environment variable. Spans nest; each one
+// records its start, duration and how far every counter moved while it was open, and the
+// trace is reported when the process exits: ZENGIT_TRACE=1 prints a per-span summary to
+// stderr, any other value names a file that receives Chrome trace-event JSON. Counters are
+// plain additions that always run; with tracing off a span is a single branch.
+typedef enum {
+    TRACE_STAT_CALLS,
+    TRACE_DIRECTORIES_READ,
+    TRACE_BYTES_READ,
+    TRACE_BYTES_WRITTEN,
+    TRACE_OBJECTS_HASHED,
+    TRACE_CACHE_HITS,
+    TRACE_CACHE_MISSES,
+#ifdef ZENGIT_COUNT_ALLOCATIONS
+    TRACE_HEAP_ALLOCATIONS,
+    TRACE_HEAP_FREES,
+#endif
+    TRACE_COUNTER_COUNT
+} TraceCounter;
+
+static const char* traceCounterNames[TRACE_COUNTER_COUNT] = {
+    "stat calls", "directories read", "bytes read", "bytes written", "objects hashed", "cache hits", "cache misses",
+#ifdef ZENGIT_COUNT_ALLOCATIONS
+    "heap allocations", "heap frees",
+#endif
+};
+
+static uint64_t traceCounters[TRACE_COUNTER_COUNT];
+
+#ifdef ZENGIT_COUNT_ALLOCATIONS
+static void countHeapCall(bool isFree) {
+    traceCounters[isFree ? TRACE_HEAP_FREES : TRACE_HEAP_ALLOCATIONS]++;
+}
+#endif
+
+typedef enum { TRACE_UNKNOWN, TRACE_OFF, TRACE_SUMMARY, TRACE_JSON } TraceMode;
+
+typedef struct {
+    const char* name;
+    int parent;                   // index of the enclosing span, -1 at the top
+    int depth;
+    int64_t start;                // nanoseconds since tracing started
+    int64_t duration;
+    uint64_t counters[TRACE_COUNTER_COUNT]; // values at the start, deltas once closed
+} TraceSpan;
+
+typedef struct {
+    TraceMode mode;
+    char path[MAX_PATH_LENGTH];
+    int64_t origin;
+    TraceSpan* spans;
+    int count;
+    int capacity;
+    int open[TRACE_MAX_DEPTH];
+    int depth;                    // may exceed TRACE_MAX_DEPTH; deeper spans are not recorded
+} Tracer;
+
+static Tracer tracer;
+
+static void traceCount(TraceCounter counter, uint64_t amount) {
+    traceCounters[counter] += amount;
+}
+
+static int64_t clockNanoseconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (int64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+static void writeTrace(void);
+
+static void startTracing(void) {
+    const char* setting = getenv("ZENGIT_TRACE");
+    if (!setting || !setting[0] || strcmp(setting, "0") == 0) {
+        tracer.mode = TRACE_OFF;
+        return;
+    }
+    tracer.mode = strcmp(setting, "1") == 0 ? TRACE_SUMMARY : TRACE_JSON;
+    snprintf(tracer.path, sizeof(tracer.path), "%s", setting);
+    tracer.origin = clockNanoseconds();
+    atexit(writeTrace);
+}
+
+// Long-running daemons would only accumulate spans they never report.
+static void stopTracing(void) {
+    free(tracer.spans);
+    memset(&tracer, 0, sizeof(tracer));
+    tracer.mode = TRACE_OFF;
+}
+
+void zengitTraceBegin(const char* name) {
+    if (tracer.mode == TRACE_UNKNOWN) startTracing();
+    if (tracer.mode == TRACE_OFF) return;
+
+    if (tracer.depth < TRACE_MAX_DEPTH) {
+        if (tracer.count == tracer.capacity) {
+            int capacity = tracer.capacity ? tracer.capacity * 2 : 256;
+            TraceSpan* spans = realloc(tracer.spans, capacity * sizeof(TraceSpan));
+            if (!spans) {
+                tracer.open[tracer.depth++] = -1;
+                return;
+            }
+            tracer.spans = spans;
+            tracer.capacity = capacity;
+        }
+        TraceSpan* span = &tracer.spans[tracer.count];
+        span->name = name;
+        span->parent = tracer.depth > 0 ? tracer.open[tracer.depth - 1] : -1;
+        span->depth = tracer.depth;
+        span->duration = -1;
+        memcpy(span->counters, traceCounters, sizeof(traceCounters));
+        span->start = clockNanoseconds() - tracer.origin;
+        tracer.open[tracer.depth] = tracer.count++;
+    }
+    tracer.depth++;
+}
+
+void zengitTraceEnd(void) {
+    if (tracer.mode != TRACE_SUMMARY && tracer.mode != TRACE_JSON) return;
+    if (tracer.depth == 0) return;
+
+    tracer.depth--;
+    if (tracer.depth >= TRACE_MAX_DEPTH || tracer.open[tracer.depth] < 0) return;
+    TraceSpan* span = &tracer.spans[tracer.open[tracer.depth]];
+    span->duration = clockNanoseconds() - tracer.origin - span->start;
+    for (int i = 0; i < TRACE_COUNTER_COUNT; i++) {
+        span->counters[i] = traceCounters[i] - span->counters[i];
+    }
+}
+
+static void writeJsonString(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void writeTraceJson(FILE* out, int64_t end) {
+    long pid = (long)getpid();
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (int i = 0; i < tracer.count; i++) {
+        const TraceSpan* span = &tracer.spans[i];
+        fprintf(out, "{\"name\":");
+        writeJsonString(out, span->name);
+        fprintf(out, ",\"cat\":\"zengit\",\"ph\":\"X\",\"pid\":%ld,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                pid, span->start / 1000.0, span->duration / 1000.0);
+        bool first = true;
+        for (int c = 0; c < TRACE_COUNTER_COUNT; c++) {
+            if (!span->counters[c]) continue;
+            fprintf(out, "%s\"%s\":%" PRIu64, first ? "" : ",", traceCounterNames[c], span->counters[c]);
+            first = false;
+        }
+        fprintf(out, "}},\n");
+    }
+    fprintf(out, "{\"name\":\"counters\",\"cat\":\"zengit\",\"ph\":\"C\",\"pid\":%ld,\"tid\":1,\"ts\":%.3f,\"args\":{",
+            pid, end / 1000.0);
+    for (int c = 0; c < TRACE_COUNTER_COUNT; c++) {
+        fprintf(out, "%s\"%s\":%" PRIu64, c ? "," : "", traceCounterNames[c], traceCounters[c]);
+    }
+    fprintf(out, "}}\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+typedef struct {
+    const char* name;
+    int depth;
+    int calls;
+    int64_t total;
+    int64_t self;
+} TraceSummaryRow;
+
+// One row per distinct span name and depth, in the order they first started, with the
+// time spent in the span itself next to the total.
+static void writeTraceSummary(FILE* out, int64_t end) {
+    TraceSummaryRow* rows = malloc((tracer.count + 1) * sizeof(TraceSummaryRow));
+    int* spanRows = malloc((tracer.count + 1) * sizeof(int));
+    if (!rows || !spanRows) {
+        free(rows);
+        free(spanRows);
+        return;
+    }
+    int numRows = 0;
+    for (int i = 0; i < tracer.count; i++) {
+        const TraceSpan* span = &tracer.spans[i];
+        int r = 0;
+        while (r < numRows && (rows[r].depth != span->depth || strcmp(rows[r].name, span->name) != 0)) r++;
+        if (r == numRows) {
+            rows[numRows++] = (TraceSummaryRow){ span->name, span->depth, 0, 0, 0 };
+        }
+        spanRows[i] = r;
+        rows[r].calls++;
+        rows[r].total += span->duration;
+        rows[r].self += span->duration;
+        if (span->parent >= 0) rows[spanRows[span->parent]].self -= span->duration;
+    }
+
+    fprintf(out, "zengit trace: %.3f ms, %d spans\n", end / 1e6, tracer.count);
+    fprintf(out, "  %-32s %7s %12s %12s\n", "span", "calls", "total ms", "self ms");
+    for (int r = 0; r < numRows; r++) {
+        int indent = rows[r].depth < 12 ? 2 * rows[r].depth : 24;
+        fprintf(out, "  %*s%-*s %7d %12.3f %12.3f\n", indent, "", 32 - indent, rows[r].name,
+                rows[r].calls, rows[r].total / 1e6, rows[r].self / 1e6);
+    }
+    for (int c = 0; c < TRACE_COUNTER_COUNT; c++) {
+        fprintf(out, "  %-32s %" PRIu64 "\n", traceCounterNames[c], traceCounters[c]);
+    }
+    free(rows);
+    free(spanRows);
+}
+
+static void writeTrace(void) {
+    if (tracer.mode != TRACE_SUMMARY && tracer.mode != TRACE_JSON) return;
+    while (tracer.depth > 0) zengitTraceEnd();
+    int64_t end = clockNanoseconds() - tracer.origin;
+
+    if (tracer.mode == TRACE_SUMMARY) {
+        writeTraceSummary(stderr, end);
+    } else {
+        FILE* out = fopen(tracer.path, "w");
+        if (out) {
+            writeTraceJson(out, end);
+            fclose(out);
+        } else {
+            fprintf(stderr, "Failed to write trace to %s: %s\n", tracer.path, strerror(errno));
+        }
+    }
+    stopTracing();
+}
+
+// Library calls work on the repository of the handle they were given without changing the
+// process working directory: paths stay relative to the repository root everywhere and are
+// resolved against repositoryRoot where they reach the file system. It is empty for the
+// command line, which runs in the root.
+#define ROOTED_PATH_SIZE 4096
+static char repositoryRoot[ROOTED_PATH_SIZE];
+
+// Calls without a handle work in the current directory, as the command line does.
+static void useWorkingDirectory(void) {
+    repositoryRoot[0] = '\0';
+}
+
+static bool isAbsolutePath(const char* path) {
+    return path[0] == '/' || path[0] == '\\' || (isalpha((unsigned char)path[0]) && path[1] == ':');
+}
+
+// Returns path itself, or root/path in buffer; NULL when that does not fit.
+static const char* rootedPath(const char* path, char* buffer, size_t size) {
+    if (!repositoryRoot[0] || isAbsolutePath(path)) {
+        return path;
+    }
+    int written = snprintf(buffer, size, "%s/%s", repositoryRoot, path);
+    if (written < 0 || (size_t)written >= size) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return buffer;
+}
+
+static FILE* repoFopen(const char* path, const char* mode) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    return rooted ? fopen(rooted, mode) : NULL;
+}
+
+static int repoOpen(const char* path, int flags, int mode) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    return rooted ? open(rooted, flags, mode) : -1;
+}
+
+static DIR* repoOpendir(const char* path) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    return rooted ? opendir(rooted) : NULL;
+}
+
+static int repoStat(const char* path, struct stat* pathStat) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    return rooted ? stat(rooted, pathStat) : -1;
+}
+
+static int repoMkdir(const char* path, int mode) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    if (!rooted) {
+        return -1;
+    }
+#ifdef _WIN32
+    (void)mode;
+    return _mkdir(rooted);
+#else
+    return mkdir(rooted, (mode_t)mode);
+#endif
+}
+
+static int repoRmdir(const char* path) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    return rooted ? rmdir(rooted) : -1;
+}
+
+static int repoRemove(const char* path) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    return rooted ? remove(rooted) : -1;
+}
+
+static int repoUnlink(const char* path) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    return rooted ? unlink(rooted) : -1;
+}
+
+static int repoRename(const char* from, const char* to) {
+    char fromBuffer[ROOTED_PATH_SIZE], toBuffer[ROOTED_PATH_SIZE];
+    const char* rootedFrom = rootedPath(from, fromBuffer, sizeof(fromBuffer));
+    const char* rootedTo = rootedPath(to, toBuffer, sizeof(toBuffer));
+    return rootedFrom && rootedTo ? rename(rootedFrom, rootedTo) : -1;
+}
+
+// Formats a path into buffer, reporting it instead of silently truncating when it does not fit.
+static bool formatPath(char* buffer, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer, size, format, args);
+    va_end(args);
+    if (written < 0 || (size_t)written >= size) {
+        fprintf(stderr, "Error: Path too long: %s...\n", buffer);
+        return false;
+    }
+    return true;
+}
+
+// Positional reads and writes that leave the descriptor's offset alone. Windows has no
+// pread or pwrite, so the offset goes into an OVERLAPPED there.
+static ssize_t readFileAt(int fd, void* buffer, size_t size, long long offset) {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD transferred = 0;
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), buffer, (DWORD)size, &transferred, &overlapped)) {
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    }
+    return (ssize_t)transferred;
+#else
+    return pread(fd, buffer, size, (off_t)offset);
+#endif
+}
+
+static ssize_t writeFileAt(int fd, const void* buffer, size_t size, long long offset) {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD transferred = 0;
+    if (!WriteFile((HANDLE)_get_osfhandle(fd), buffer, (DWORD)size, &transferred, &overlapped)) {
+        return -1;
+    }
+    return (ssize_t)transferred;
+#else
+    return pwrite(fd, buffer, size, (off_t)offset);
+#endif
+}
+
+// Also moves the offset to the end; -1 on failure.
+static long long fileDescriptorSize(int fd) {
+#ifdef _WIN32
+    return _lseeki64(fd, 0, SEEK_END);
+#else
+    return (long long)lseek(fd, 0, SEEK_END);
+#endif
+}
+
+// Waits for an exclusive lock on the whole file, which closing fd releases.
+static bool lockFileExclusive(int fd) {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {0};
+    return LockFileEx((HANDLE)_get_osfhandle(fd), LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+#else
+    return flock(fd, LOCK_EX) == 0;
+#endif
+}
+
+static bool fileExists(const char *filename) {
+    struct stat buffer;
+    traceCount(TRACE_STAT_CALLS, 1);
+    return (repoStat(filename, &buffer) == 0);
+}
+
+static void ensureDirectoryExists(const char* path) {
+    struct stat st;
+    if (repoStat(path, &st) == -1) {
+        repoMkdir(path, 0700);
+    }
+}
+
+static bool updateConfigFile(const char* filePath, const char* key, const char* value) {
+    if (!fileExists(filePath)) {
+        FILE *file = repoFopen(filePath, "w");
+        if (file == NULL) {
+            perror("Error creating config file");
+            return false;
+        }
+        fclose(file);
+    }
+
+    char tempFilePath[1024];
+    snprintf(tempFilePath, sizeof(tempFilePath), "%s.tmp", filePath);
+
+    FILE* origFile = repoFopen(filePath, "r");
+    if (origFile == NULL) {
+        perror("Error opening original file");
+        return false;
+    }
+
+    FILE* tempFile = repoFopen(tempFilePath, "w");
+    if (tempFile == NULL) {
+        perror("Error opening temp file");
+        fclose(origFile);
+        return false;
+    }
+
+    bool keyFound = false;
+    char line[MAX_CONFIG_LINE];
+    char currentKey[MAX_CONFIG_LINE];
+    while (fgets(line, MAX_CONFIG_LINE, origFile) != NULL) {
+        sscanf(line, "%1023[^=]", currentKey);
+        if (strcmp(currentKey, key) == 0) {
+            fprintf(tempFile, "%s=%s\n", key, value);
+            keyFound = true;
+        } else {
+            fputs(line, tempFile);
+        }
+    }
+
+    if (!keyFound) {
+        fprintf(tempFile, "%s=%s\n", key, value);
+    }
+
+    fclose(origFile);
+    fclose(tempFile);
+
+    repoRemove(filePath);
+    repoRename(tempFilePath, filePath);
+
+    return true;
+}
+
+enum { CONFIG_SYSTEM, CONFIG_GLOBAL, CONFIG_LOCAL, CONFIG_LAYERS };
+
+static const char* configLayerPath(int layer);
+static const char* configGet(const char* key);
+static void invalidateConfig(void);
+
+static bool processAlias(int *argc, char ***argv) {
+
+    if (strncmp((*argv)[1], "alias.", 6) != 0) {
+        return true;
+    }
+
+    char aliasKey[MAX_CONFIG_LINE];
+    snprintf(aliasKey, sizeof(aliasKey), "%s", (*argv)[1]);
+
+    const char* command = configGet(aliasKey);
+    if (command) {
+
+        // argv belongs to the caller (usually main), so the expansion gets its own array.
+        char** newArgv = arenaAlloc(&commandArena, (strlen(command) / 2 + 3) * sizeof(char*));
+        char* tokens = arenaStrdup(&commandArena, command);
+        if (!newArgv || !tokens) {
+            return false;
+        }
+        int newArgc = 1;
+        newArgv[0] = (*argv)[0];
+
+        char *token = strtok(tokens, " ");
+        while (token != NULL) {
+            newArgv[newArgc++] = token;
+            token = strtok(NULL, " ");
+        }
+        newArgv[newArgc] = NULL;
+
+        *argv = newArgv;
+        *argc = newArgc;
+        return true;
+    }
+
+
+    return true;
+}
+
+
+static bool isAliasCommandValid(const char* value) {
+
+    if (value == NULL || strlen(value) == 0) {
+        return false;
+    }
+
+
+
+
+    return true;
+}
+
+static bool handleConfigCommand(int argc, char *argv[]) {
+    if ((argc != 4 && !(argc == 5 && strcmp(argv[2], "-global") == 0)) ||
+        (argc == 5 && strncmp(argv[2], "alias.", 6) != 0 && strcmp(argv[2], "-global") != 0)) {
+        fprintf(stderr, "Usage: %s config [-global] key \"value\"\n", argv[0]);
+        fprintf(stderr, "       %s config [-global] alias.<alias-name> \"command\"\n", argv[0]);
+        return false;
+    }
+
+    bool isGlobal = argc == 5 && strcmp(argv[2], "-global") == 0;
+    const char* key = argv[2 + (isGlobal ? 1 : 0)];
+    const char* value = argv[3 + (isGlobal ? 1 : 0)];
+
+
+    if (strncmp(key, "alias.", 6) == 0 && !isAliasCommandValid(value)) {
+        fprintf(stderr, "Invalid alias command.\n");
+        return false;
+    }
+
+    const char* configPath = isGlobal ? configLayerPath(CONFIG_GLOBAL) : LOCAL_CONFIG_PATH;
+
+    bool updated = updateConfigFile(configPath, key, value);
+    invalidateConfig();
+    if (updated) {
+        printf("Configuration updated successfully.\n");
+        return true;
+    } else {
+        printf("Failed to update configuration.\n");
+        return false;
+    }
+}
+
+static bool isRepositoryExistInCurrentOrParentDir(const char* dir) {
+    char path[MAX_PATH_LENGTH];
+    strcpy(path, dir);
+
+    while (strcmp(path, "C:\\") != 0 && strcmp(path, "\\") != 0) {
+        char zengitPath[MAX_PATH_LENGTH + sizeof("/.zengit")];
+        snprintf(zengitPath, sizeof(zengitPath), "%s/.zengit", path);
+
+        if (fileExists(zengitPath)) {
+            return true;
+        }
+
+
+        char* lastSeparator = strrchr(path, '/');
+        char* lastBackslash = strrchr(path, '\\');
+        if (!lastSeparator || (lastBackslash && lastBackslash > lastSeparator)) {
+            lastSeparator = lastBackslash;
+        }
+        if (lastSeparator != NULL) {
+            *lastSeparator = '\0';
+        } else {
+
+            break;
+        }
+    }
+
+    return false;
+}
+
+static bool initializeRepository(const char* repoPath) {
+    int status;
+
+
+    const char* directories[] = {
+            "commits",
+            "branches",
+            "objects",
+            "tags",
+
+    };
+
+
+    status = repoMkdir(repoPath, 0777);
+    if (status != 0) {
+        perror("Failed to create .zengit directory");
+        return false;
+    }
+
+
+    DWORD attributes = GetFileAttributesA(repoPath);
+    if (attributes == INVALID_FILE_ATTRIBUTES || !SetFileAttributesA(repoPath, attributes | FILE_ATTRIBUTE_HIDDEN)) {
+        perror("Failed to set .zengit directory as hidden");
+        return false;
+    }
+
+
+    for (size_t i = 0; i < sizeof(directories) / sizeof(directories[0]); i++) {
+        char dirPath[MAX_PATH_LENGTH];
+        snprintf(dirPath, sizeof(dirPath), "%s/%s", repoPath, directories[i]);
+        status = repoMkdir(dirPath, 0777);
+        if (status != 0 && errno != EEXIST) {
+            perror("Failed to create directory within .zengit");
+            return false;
+        }
+    }
+
+
+    const char* files[] = {
+            "shortcuts",
+            "logs",
+            "CurrentBranch",
+            "HEAD",
+
+    };
+
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        char filePath[MAX_PATH_LENGTH];
+        snprintf(filePath, sizeof(filePath), "%s/%s", repoPath, files[i]);
+        FILE* file = repoFopen(filePath, "w");
+        if (!file) {
+            perror("Failed to create essential file within .zengit");
+            return false;
+        }
+        fclose(file);
+    }
+
+    return true;
+}
+
+static bool handleInitCommand() {
+    const char* currentDirectory = ".";
+    const char* zengitDirectory = "./.zengit";
+
+    if (isRepositoryExistInCurrentOrParentDir(currentDirectory)) {
+        fprintf(stderr, "zengit repository already exists.\n");
+        return false;
+    }
+
+    return initializeRepository(zengitDirectory);
+}
+
+static bool isFile(const char* path) {
+    struct stat path_stat;
+    traceCount(TRACE_STAT_CALLS, 1);
+    repoStat(path, &path_stat);
+    return S_ISREG(path_stat.st_mode);
+}
+
+static bool isDirectory(const char* path) {
+    struct stat path_stat;
+    traceCount(TRACE_STAT_CALLS, 1);
+    repoStat(path, &path_stat);
+    return S_ISDIR(path_stat.st_mode);
+}
+
+static int match(const char *pattern, const char *str);
+
+// A compiled .zengitignore line. Every rule carries the literal text before its first
+// wildcard and after its last one, so most candidates are rejected with a strncmp
+// before match() runs.
+typedef struct {
+    char* pattern;
+    char* base;
+    size_t baseLength;
+    const char* prefix;
+    size_t prefixLength;
+    const char* suffix;
+    size_t suffixLength;
+    bool hasWildcard;
+    bool negated;
+    bool directoryOnly;
+    bool anchored;
+} IgnoreRule;
+
+typedef struct {
+    IgnoreRule* rules;
+    int count;
+    int capacity;
+} IgnoreRules;
+
+// "./a/b" and "a/b" name the same work tree path; "." is the root.
+static const char* relativeWorkTreePath(const char* path) {
+    while (strncmp(path, "./", 2) == 0) path += 2;
+    return strcmp(path, ".") == 0 ? "" : path;
+}
+
+static bool addIgnoreRule(IgnoreRules* rules, const char* line, const char* base) {
+    char pattern[MAX_PATH_LENGTH];
+    snprintf(pattern, sizeof(pattern), "%s", line);
+    pattern[strcspn(pattern, "\r\n")] = 0;
+
+    size_t length = strlen(pattern);
+    while (length > 0 && (pattern[length - 1] == ' ' || pattern[length - 1] == '\t')) pattern[--length] = '\0';
+    if (length == 0 || pattern[0] == '#') return true;
+
+    IgnoreRule rule;
+    memset(&rule, 0, sizeof(rule));
+    char* text = pattern;
+    if (*text == '!') {
+        rule.negated = true;
+        text++;
+    }
+    length = strlen(text);
+    if (length > 0 && text[length - 1] == '/') {
+        rule.directoryOnly = true;
+        text[--length] = '\0';
+    }
+    if (*text == '/') {
+        rule.anchored = true;
+        text++;
+    }
+    if (!*text) return true;
+    if (strchr(text, '/')) rule.anchored = true;
+
+    if (rules->count == rules->capacity) {
+        int capacity = rules->capacity ? rules->capacity * 2 : 16;
+        IgnoreRule* resized = realloc(rules->rules, capacity * sizeof(IgnoreRule));
+        if (!resized) return false;
+        rules->rules = resized;
+        rules->capacity = capacity;
+    }
+
+    rule.pattern = strdup(text);
+    rule.base = strdup(base);
+    if (!rule.pattern || !rule.base) {
+        free(rule.pattern);
+        free(rule.base);
+        return false;
+    }
+    rule.baseLength = strlen(rule.base);
+
+    size_t firstWildcard = strcspn(rule.pattern, "*?");
+    rule.hasWildcard = rule.pattern[firstWildcard] != '\0';
+    rule.prefix = rule.pattern;
+    rule.prefixLength = firstWildcard;
+    if (rule.hasWildcard) {
+        const char* lastWildcard = rule.pattern;
+        for (const char* c = rule.pattern; *c; c++) {
+            if (*c == '*' || *c == '?') lastWildcard = c;
+        }
+        rule.suffix = lastWildcard + 1;
+        rule.suffixLength = strlen(rule.suffix);
+    }
+
+    rules->rules[rules->count++] = rule;
+    return true;
+}
+
+static void loadIgnoreFile(IgnoreRules* rules, const char* filePath, const char* base) {
+    FILE* file = repoFopen(filePath, "r");
+    if (!file) {
+        return;
+    }
+
+    char line[MAX_PATH_LENGTH];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        addIgnoreRule(rules, line, base);
+    }
+    fclose(file);
+}
+
+// Loads the .zengitignore of one directory (relative to the repository root) on top of
+// the rules already in effect; popIgnoreRules drops them again when the walk leaves it.
+static int pushDirectoryIgnoreRules(IgnoreRules* rules, const char* relativeDir) {
+    int previousCount = rules->count;
+    char filePath[MAX_PATH_LENGTH];
+    if (relativeDir[0]) {
+        if (!formatPath(filePath, sizeof(filePath), "%s/%s", relativeDir, IGNORE_FILE_NAME)) {
+            return previousCount;
+        }
+    } else {
+        snprintf(filePath, sizeof(filePath), "%s", IGNORE_FILE_NAME);
+    }
+    loadIgnoreFile(rules, filePath, relativeDir);
+    return previousCount;
+}
+
+static void popIgnoreRules(IgnoreRules* rules, int previousCount) {
+    while (rules->count > previousCount) {
+        rules->count--;
+        free(rules->rules[rules->count].pattern);
+        free(rules->rules[rules->count].base);
+    }
+}
+
+static void freeIgnoreRules(IgnoreRules* rules) {
+    popIgnoreRules(rules, 0);
+    free(rules->rules);
+    memset(rules, 0, sizeof(*rules));
+}
+
+// Global rules, then the root .zengitignore, then one for every directory between the
+// root and relativeDir (exclusive), matching what a walk from the root would have loaded.
+static void initIgnoreRules(IgnoreRules* rules, const char* relativeDir) {
+    memset(rules, 0, sizeof(*rules));
+    loadIgnoreFile(rules, GLOBAL_IGNORE_PATH, "");
+    pushDirectoryIgnoreRules(rules, "");
+
+    char ancestor[MAX_PATH_LENGTH];
+    snprintf(ancestor, sizeof(ancestor), "%s", relativeDir);
+    for (char* slash = strchr(ancestor, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        pushDirectoryIgnoreRules(rules, ancestor);
+        *slash = '/';
+    }
+}
+
+static bool ignoreRuleMatches(const IgnoreRule* rule, const char* target) {
+    if (rule->prefixLength && strncmp(target, rule->prefix, rule->prefixLength) != 0) return false;
+    if (!rule->hasWildcard) return target[rule->prefixLength] == '\0';
+
+    size_t targetLength = strlen(target);
+    if (rule->suffixLength) {
+        if (targetLength < rule->prefixLength + rule->suffixLength) return false;
+        if (memcmp(target + targetLength - rule->suffixLength, rule->suffix, rule->suffixLength) != 0) return false;
+    }
+    return match(rule->pattern, target);
+}
+
+// relativePath is relative to the repository root. The last matching rule wins, so a
+// later "!pattern" can re-include something an earlier rule excluded.
+static bool isPathIgnored(const IgnoreRules* rules, const char* relativePath, bool isDir) {
+    const char* name = strrchr(relativePath, '/');
+    name = name ? name + 1 : relativePath;
+    if (strcmp(name, ".zengit") == 0) return true;
+    if (!rules) return false;
+
+    for (int i = rules->count - 1; i >= 0; i--) {
+        const IgnoreRule* rule = &rules->rules[i];
+        if (rule->directoryOnly && !isDir) continue;
+
+        const char* target = name;
+        if (rule->anchored) {
+            if (rule->baseLength) {
+                if (strncmp(relativePath, rule->base, rule->baseLength) != 0 || relativePath[rule->baseLength] != '/') continue;
+                target = relativePath + rule->baseLength + 1;
+            } else {
+                target = relativePath;
+            }
+        }
+
+        if (ignoreRuleMatches(rule, target)) {
+            return !rule->negated;
+        }
+    }
+    return false;
+}
+
+// Whether a path named on the command line is excluded, either itself or through any of
+// its ancestor directories, with each directory's rules loaded on the way down as a walk
+// from the root would.
+static bool isWorkTreePathIgnored(const char* path, bool isDirectory) {
+    char relativePath[MAX_PATH_LENGTH];
+    snprintf(relativePath, sizeof(relativePath), "%s", relativeWorkTreePath(path));
+    size_t length = strlen(relativePath);
+    while (length > 0 && relativePath[length - 1] == '/') relativePath[--length] = '\0';
+    if (length == 0) {
+        return false;
+    }
+
+    IgnoreRules rules;
+    initIgnoreRules(&rules, "");
+    bool ignored = false;
+    for (char* slash = strchr(relativePath, '/'); slash && !ignored; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        ignored = isPathIgnored(&rules, relativePath, true);
+        if (!ignored) pushDirectoryIgnoreRules(&rules, relativePath);
+        *slash = '/';
+    }
+    ignored = ignored || isPathIgnored(&rules, relativePath, isDirectory);
+    freeIgnoreRules(&rules);
+    return ignored;
+}
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+static bool appendBytes(ByteBuffer* buffer, const char* data, size_t length) {
+    if (buffer->size + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->size + length) capacity *= 2;
+        char* resized = realloc(buffer->data, capacity);
+        if (!resized) {
+            return false;
+        }
+        buffer->data = resized;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+    return true;
+}
+
+static void freeByteBuffer(ByteBuffer* buffer) {
+    free(buffer->data);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+// Walks a directory tree calling visit for every entry below the starting directory.
+// visit decides whether a directory is descended into; leave runs after its children.
+// On Linux entries are opened relative to their parent's descriptor and typed from d_type,
+// so a stat is only issued for files when statFiles asks for one (or d_type is unknown).
+typedef enum { WALK_FILE, WALK_DIRECTORY, WALK_OTHER } WalkEntryType;
+typedef enum { WALK_CONTINUE, WALK_SKIP, WALK_STOP } WalkAction;
+
+typedef struct {
+    const char* path;         // root joined with relativePath
+    const char* relativePath; // relative to the walk root
+    const char* name;
+    WalkEntryType type;
+    const struct stat* stat;  // regular files only, and only with statFiles
+    int depth;                // 1 for entries directly inside the starting directory
+    int mark;                 // set by visit, handed back to leave
+} WalkEntry;
+
+typedef struct {
+    WalkAction (*visit)(WalkEntry* entry, void* context);
+    void (*leave)(WalkEntry* directory, void* context);
+    void* context;
+    bool statFiles;
+} DirectoryWalker;
+
+typedef struct {
+    const DirectoryWalker* walker;
+    ByteBuffer path;
+    size_t relativeStart;
+    bool stopped;
+} WalkState;
+
+static WalkEntryType walkEntryTypeFromMode(mode_t mode) {
+    return S_ISREG(mode) ? WALK_FILE : S_ISDIR(mode) ? WALK_DIRECTORY : WALK_OTHER;
+}
+
+// Appends "/name" to the walk path; the caller restores the previous length afterwards.
+static bool pushWalkPath(WalkState* state, const char* name) {
+    state->path.size--; // drop the terminator
+    return appendBytes(&state->path, "/", 1) && appendBytes(&state->path, name, strlen(name) + 1);
+}
+
+static void popWalkPath(WalkState* state, size_t size) {
+    state->path.size = size;
+    state->path.data[size - 1] = '\0';
+}
+
+static void fillWalkEntry(WalkState* state, WalkEntry* entry, size_t nameLength) {
+    entry->path = state->path.data;
+    entry->relativePath = state->path.data + state->relativeStart;
+    entry->name = state->path.data + state->path.size - 1 - nameLength;
+}
+
+#ifdef __linux__
+static bool walkDirectoryLevel(WalkState* state, int dirFd, int depth) {
+    DIR* dir = fdopendir(dirFd);
+    if (!dir) {
+        close(dirFd);
+        return false;
+    }
+    traceCount(TRACE_DIRECTORIES_READ, 1);
+
+    const DirectoryWalker* walker = state->walker;
+    struct dirent* dirEntry;
+    while (!state->stopped && (dirEntry = readdir(dir)) != NULL) {
+        const char* name = dirEntry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        struct stat entryStat;
+        bool haveStat = false;
+        WalkEntryType type = WALK_OTHER;
+        if (dirEntry->d_type == DT_REG) {
+            type = WALK_FILE;
+        } else if (dirEntry->d_type == DT_DIR) {
+            type = WALK_DIRECTORY;
+        } else if (dirEntry->d_type == DT_LNK || dirEntry->d_type == DT_UNKNOWN) {
+            traceCount(TRACE_STAT_CALLS, 1);
+            if (fstatat(dirfd(dir), name, &entryStat, 0) != 0) continue;
+            haveStat = true;
+            type = walkEntryTypeFromMode(entryStat.st_mode);
+        }
+        if (type == WALK_FILE && walker->statFiles && !haveStat) {
+            traceCount(TRACE_STAT_CALLS, 1);
+            if (fstatat(dirfd(dir), name, &entryStat, 0) != 0) continue;
+            haveStat = true;
+        }
+
+        size_t savedSize = state->path.size;
+        if (!pushWalkPath(state, name)) {
+            state->stopped = true;
+            break;
+        }
+        WalkEntry entry = { NULL, NULL, NULL, type, type == WALK_FILE && haveStat ? &entryStat : NULL, depth, 0 };
+        fillWalkEntry(state, &entry, strlen(name));
+
+        WalkAction action = walker->visit(&entry, walker->context);
+        if (action == WALK_STOP) {
+            state->stopped = true;
+        } else if (action == WALK_CONTINUE && type == WALK_DIRECTORY) {
+            int childFd = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (childFd >= 0) {
+                walkDirectoryLevel(state, childFd, depth + 1);
+            }
+            fillWalkEntry(state, &entry, strlen(name));
+            if (walker->leave) walker->leave(&entry, walker->context);
+        }
+        popWalkPath(state, savedSize);
+    }
+
+    closedir(dir);
+    return true;
+}
+#else
+static bool walkDirectoryLevel(WalkState* state, int depth) {
+    DIR* dir = repoOpendir(state->path.data);
+    if (!dir) {
+        return false;
+    }
+    traceCount(TRACE_DIRECTORIES_READ, 1);
+
+    const DirectoryWalker* walker = state->walker;
+    struct dirent* dirEntry;
+    while (!state->stopped && (dirEntry = readdir(dir)) != NULL) {
+        const char* name = dirEntry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+        size_t savedSize = state->path.size;
+        if (!pushWalkPath(state, name)) {
+            state->stopped = true;
+            break;
+        }
+        struct stat entryStat;
+        traceCount(TRACE_STAT_CALLS, 1);
+        if (repoStat(state->path.data, &entryStat) != 0) {
+            popWalkPath(state, savedSize);
+            continue;
+        }
+        WalkEntryType type = walkEntryTypeFromMode(entryStat.st_mode);
+        WalkEntry entry = { NULL, NULL, NULL, type, type == WALK_FILE ? &entryStat : NULL, depth, 0 };
+        fillWalkEntry(state, &entry, strlen(name));
+
+        WalkAction action = walker->visit(&entry, walker->context);
+        if (action == WALK_STOP) {
+            state->stopped = true;
+        } else if (action == WALK_CONTINUE && type == WALK_DIRECTORY) {
+            walkDirectoryLevel(state, depth + 1);
+            fillWalkEntry(state, &entry, strlen(name));
+            if (walker->leave) walker->leave(&entry, walker->context);
+        }
+        popWalkPath(state, savedSize);
+    }
+
+    closedir(dir);
+    return true;
+}
+#endif
+
+// Walks root/relativeDir; entry paths are reported relative to root. Returns false if
+// the starting directory cannot be opened or visit stopped the walk.
+static bool walkDirectoryTree(const char* root, const char* relativeDir, const DirectoryWalker* walker) {
+    WalkState state;
+    memset(&state, 0, sizeof(state));
+    state.walker = walker;
+    state.relativeStart = strlen(root) + 1;
+    bool ok = appendBytes(&state.path, root, strlen(root) + 1);
+    if (ok && relativeDir[0]) {
+        ok = pushWalkPath(&state, relativeDir);
+    }
+
+#ifdef __linux__
+    int fd = ok ? repoOpen(state.path.data, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0) : -1;
+    ok = fd >= 0 && walkDirectoryLevel(&state, fd, 1);
+#else
+    ok = ok && walkDirectoryLevel(&state, 1);
+#endif
+
+    freeByteBuffer(&state.path);
+    return ok && !state.stopped;
+}
+
+static bool isFileStaged(const char* path);
+static bool isDirectoryStaged(const char* dirPath);
+
+static bool isFileStaged(const char* path) {
+    FILE *file = repoFopen(".zengit/index", "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[MAX_PATH_LENGTH];
+    bool found = false;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+
+        if (strcmp(line, path) == 0) {
+            found = true;
+            break;
+        }
+    }
+
+    fclose(file);
+
+
+    if (!found) {
+        struct stat pathStat;
+        if (repoStat(path, &pathStat) == 0 && S_ISDIR(pathStat.st_mode)) {
+            found = isDirectoryStaged(path);
+        }
+    }
+
+    return found;
+}
+
+static WalkAction visitForStagedCheck(WalkEntry* entry, void* context) {
+    if (entry->type == WALK_FILE && !isFileStaged(entry->path)) {
+        *(bool*)context = false;
+        return WALK_STOP;
+    }
+    return WALK_CONTINUE;
+}
+
+static bool isDirectoryStaged(const char* dirPath) {
+    bool isStaged = true;
+    DirectoryWalker walker = { visitForStagedCheck, NULL, &isStaged, false };
+    return walkDirectoryTree(dirPath, "", &walker) && isStaged;
+}
+
+enum { STAGE_ADD = 1, STAGE_REMOVE, STAGE_UNDO, STAGE_REDO };
+
+static bool appendStageRecord(uint32_t type, uint64_t target, char** paths, int count);
+static bool unstagePaths(char** paths, int count);
+static void stageUndo(void);
+static bool stageRedo(void);
+
+static void addToStage(const char* path) {
+    if (isFileStaged(path)) {
+        printf("File '%s' is already staged.\n", path);
+        return;
+    }
+
+    FILE* file = repoFopen(".zengit/index", "a");
+    if (file != NULL) {
+        fprintf(file, "%s\n", path);
+        fclose(file);
+        char* paths[] = { (char*)path };
+        appendStageRecord(STAGE_ADD, 0, paths, 1);
+    } else {
+        perror("Error opening staging area file");
+    }
+}
+
+// Paths gathered for staging, in the order they were found.
+typedef struct {
+    char** paths;
+    int count;
+    int capacity;
+    Arena strings;
+} PathList;
+
+static bool appendPathList(PathList* list, const char* path) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char** grown = realloc(list->paths, capacity * sizeof(char*));
+        if (!grown) {
+            return false;
+        }
+        list->paths = grown;
+        list->capacity = capacity;
+    }
+    list->paths[list->count] = arenaStrdup(&list->strings, path);
+    if (!list->paths[list->count]) {
+        return false;
+    }
+    list->count++;
+    return true;
+}
+
+static void freePathList(PathList* list) {
+    arenaFree(&list->strings);
+    free(list->paths);
+    memset(list, 0, sizeof(*list));
+}
+
+static bool refreshSparseCheckout(void);
+static bool isPathInSparseCheckout(const char* path, bool isDirectory);
+
+typedef struct {
+    IgnoreRules* rules;
+    PathList* paths;
+} StagingWalk;
+
+static WalkAction visitForStaging(WalkEntry* entry, void* context) {
+    StagingWalk* staging = context;
+    const char* relativePath = relativeWorkTreePath(entry->path);
+    if (!isPathInSparseCheckout(relativePath, entry->type == WALK_DIRECTORY)) {
+        return WALK_SKIP;
+    }
+    if (entry->type == WALK_FILE) {
+        if (!isPathIgnored(staging->rules, relativePath, false)) {
+            appendPathList(staging->paths, entry->path);
+        }
+    } else if (entry->type == WALK_DIRECTORY) {
+        if (isPathIgnored(staging->rules, relativePath, true)) {
+            return WALK_SKIP;
+        }
+        entry->mark = pushDirectoryIgnoreRules(staging->rules, relativePath);
+    }
+    return WALK_CONTINUE;
+}
+
+static void leaveStagedDirectory(WalkEntry* directory, void* context) {
+    popIgnoreRules(((StagingWalk*)context)->rules, directory->mark);
+}
+
+static void collectDirectoryWithRules(const char* dirPath, IgnoreRules* ignoreRules, PathList* paths) {
+    int savedRules = pushDirectoryIgnoreRules(ignoreRules, relativeWorkTreePath(dirPath));
+    StagingWalk staging = { ignoreRules, paths };
+    DirectoryWalker walker = { visitForStaging, leaveStagedDirectory, &staging, false };
+    if (!walkDirectoryTree(dirPath, "", &walker)) {
+        perror("Failed to open directory");
+    }
+    popIgnoreRules(ignoreRules, savedRules);
+}
+
+static bool buildMonitoredWorkTreeManifest(Manifest* manifest);
+static void saveFsMonitorState(const Manifest* manifest);
+static void freeManifest(Manifest* manifest);
+
+// With the fsmonitor running, the files to stage come from the monitored work tree
+// manifest instead of a fresh walk.
+static bool collectMonitoredDirectory(const char* dirPath, PathList* paths) {
+    Manifest workTree;
+    if (!buildMonitoredWorkTreeManifest(&workTree)) {
+        return false;
+    }
+
+    const char* relativeDir = relativeWorkTreePath(dirPath);
+    size_t length = strlen(relativeDir);
+    for (int i = 0; i < workTree.count; i++) {
+        const char* path = workTree.entries[i].path;
+        if (length && (strncmp(path, relativeDir, length) != 0 || path[length] != '/')) continue;
+        if (!isPathInSparseCheckout(path, false)) continue;
+
+        char fullPath[MAX_PATH_LENGTH];
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", dirPath, length ? path + length + 1 : path);
+        appendPathList(paths, fullPath);
+    }
+    saveFsMonitorState(&workTree);
+    freeManifest(&workTree);
+    return true;
+}
+
+// Collects every file below dirPath that .zengitignore does not exclude.
+static void collectDirectoryForStaging(const char* dirPath, PathList* paths) {
+    refreshSparseCheckout();
+    if (collectMonitoredDirectory(dirPath, paths)) {
+        return;
+    }
+
+    zengitTraceBegin("walk");
+    IgnoreRules ignoreRules;
+    initIgnoreRules(&ignoreRules, relativeWorkTreePath(dirPath));
+    collectDirectoryWithRules(dirPath, &ignoreRules, paths);
+    freeIgnoreRules(&ignoreRules);
+    zengitTraceEnd();
+}
+
+static void listDirectoryContents(const char* basePath, int depth, int currentLevel);
+
+static WalkAction visitForUnstaging(WalkEntry* entry, void* context) {
+    if (entry->type != WALK_DIRECTORY) {
+        appendPathList(context, entry->path);
+    }
+    return WALK_CONTINUE;
+}
+
+// Gathers the files a reset of path unstages.
+static void collectResetPath(const char* path, PathList* paths) {
+    if (isFile(path)) {
+        appendPathList(paths, path);
+    } else if (isDirectory(path)) {
+        DirectoryWalker walker = { visitForUnstaging, NULL, paths, false };
+        if (!walkDirectoryTree(path, "", &walker)) {
+            fprintf(stderr, "Error opening directory: %s\n", path);
+        }
+    } else {
+        fprintf(stderr, "Error: The specified file or directory does not exist: %s\n", path);
+    }
+}
+
+static bool handleAddCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s add [-f | -n <depth>] <file or directory path> [...]\n", argv[0]);
+        return false;
+    }
+
+    if (!isRepositoryExistInCurrentOrParentDir(".")) {
+        fprintf(stderr, "No zengit repository found in this directory or any parent directories.\n");
+        return false;
+    }
+
+    bool success = true;
+
+    if (strcmp(argv[2], "-f") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s add -f <file1> <file2> <dir1> [...]\n", argv[0]);
+            return false;
+        }
+
+        for (int i = 3; i < argc; i++) {
+            const char* path = argv[i];
+            if (isFile(path) || isDirectory(path)) {
+                addToStage(path);
+            } else {
+                fprintf(stderr, "Warning: The specified path does not exist, but -f was used: %s\n", path);
+                success = false;
+            }
+        }
+    } else if (strcmp(argv[2], "-redo") == 0) {
+        success = stageRedo();
+    } else if (strcmp(argv[2], "-n") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "Usage: %s add -n <depth>\n", argv[0]);
+            return false;
+        }
+        int depth = atoi(argv[3]);
+        if (depth < 1) {
+            fprintf(stderr, "Error: Depth must be greater than 0.\n");
+            return false;
+        }
+
+        listDirectoryContents(".", depth, 1);
+    } else {
+        // Plain paths are staged through zengitRepoAdd.
+        fprintf(stderr, "Usage: %s add [-f | -n <depth> | -redo] <file or directory path> [...]\n", argv[0]);
+        success = false;
+    }
+    return success;
+}
+
+static bool handleResetCommand(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s reset [-f] <file or directory path> [...]\n", argv[0]);
+        return false;
+    }
+
+    bool forceReset = false;
+    int startIndex = 2;
+
+    if (strcmp(argv[2], "-undo") == 0) {
+        stageUndo();
+        return true;
+    } else if (strcmp(argv[2], "-f") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s reset -f <file1> <file2> <dir1> [...]\n", argv[0]);
+            return false;
+        }
+        forceReset = true;
+        startIndex = 3;
+    }
+
+    // The whole command is one index rewrite and one journal group.
+    PathList paths = {0};
+    for (int i = startIndex; i < argc; i++) {
+        const char* path = argv[i];
+        if (forceReset || isFile(path) || isDirectory(path)) {
+            collectResetPath(path, &paths);
+        } else {
+            fprintf(stderr, "Warning: The specified path does not exist, but -f was used: %s\n", path);
+        }
+    }
+    unstagePaths(paths.paths, paths.count);
+    freePathList(&paths);
+
+    return true;
+}
+
+static char* getCurrentBranch() {
+    static char currentBranch[256] = "master";
+    FILE *file = repoFopen(CURRENT_BRANCH_FILE, "r");
+    if (file) {
+        if (fgets(currentBranch, sizeof(currentBranch), file) == NULL) {
+
+            strcpy(currentBranch, "master");
+        }
+        fclose(file);
+        currentBranch[strcspn(currentBranch, "\n")] = '\0';
+    }
+    return currentBranch;
+}
+
+static void generateCommitID(char *commitID, size_t size) {
+    // Seeded from more than the current second so commits made in quick succession differ.
+    srand((unsigned int)((uint64_t)time(NULL) ^ (uint64_t)clockNanoseconds() ^ ((uint64_t)getpid() << 16)));
+    const char *chars = "abcdefghijklmnopqrstuvwxyz0123456789";
+    for (size_t i = 0; i < size - 1; ++i) {
+        commitID[i] = chars[rand() % (sizeof(chars) - 1)];
+    }
+    commitID[size - 1] = '\0';
+}
+
+// Pending file copies; flushFileCopies performs them in batches.
+typedef struct {
+    char** sources;
+    char** destinations;
+    int count;
+    int capacity;
+} CopyQueue;
+
+static void copyFile(const char* srcPath, const char* destPath);
+static void ensureDirectoryStructureExists(const char* path);
+static void copyDirectoryRecursively(const char* srcDirPath, const char* destDirPath, IgnoreRules* ignoreRules, bool sparse);
+static void queueDirectoryCopy(const char* srcDirPath, const char* destDirPath, IgnoreRules* ignoreRules, bool sparse, CopyQueue* queue);
+static void queueFileCopy(CopyQueue* queue, const char* srcPath, const char* destPath);
+static void flushFileCopies(CopyQueue* queue);
+
+static void copyStagedFilesToCommitDir(const char* commitDir, const char* indexPath) {
+    FILE* index = repoFopen(indexPath, "r");
+    if (!index) {
+        perror("Failed to open index file");
+        return;
+    }
+
+    CopyQueue queue;
+    memset(&queue, 0, sizeof(queue));
+    char stagedFilePath[MAX_PATH_LENGTH];
+    while (fgets(stagedFilePath, sizeof(stagedFilePath), index)) {
+        stagedFilePath[strcspn(stagedFilePath, "\n")] = 0;
+
+        char destPath[MAX_PATH_LENGTH];
+        if (!formatPath(destPath, sizeof(destPath), "%s/%s", commitDir, stagedFilePath)) {
+            continue;
+        }
+
+        if (isDirectory(stagedFilePath)) {
+            IgnoreRules ignoreRules;
+            initIgnoreRules(&ignoreRules, relativeWorkTreePath(stagedFilePath));
+            queueDirectoryCopy(stagedFilePath, destPath, &ignoreRules, false, &queue);
+            freeIgnoreRules(&ignoreRules);
+        } else {
+            char* lastSlash = strrchr(destPath, '/');
+            *lastSlash = '\0';
+            ensureDirectoryStructureExists(destPath);
+            *lastSlash = '/';
+            queueFileCopy(&queue, stagedFilePath, destPath);
+        }
+    }
+
+    fclose(index);
+    flushFileCopies(&queue);
+}
+
+static void ensureDirectoryStructureExists(const char* path) {
+    char tempPath[MAX_PATH_LENGTH];
+    strcpy(tempPath, path);
+
+    for (char* p = tempPath + 1; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            *p = '\0';
+            repoMkdir(tempPath, 0777);
+            *p = '/';
+        }
+    }
+
+    repoMkdir(tempPath, 0777);
+}
+
+static void copyFile(const char* srcPath, const char* destPath) {
+    FILE* src = repoFopen(srcPath, "rb");
+    if (!src) {
+        perror("Failed to open source file for copying");
+        return;
+    }
+
+
+    char* lastSlash = strrchr(destPath, '/');
+    if (lastSlash) {
+        *lastSlash = '\0';
+        ensureDirectoryStructureExists(destPath);
+        *lastSlash = '/';
+    }
+
+    FILE* dest = repoFopen(destPath, "wb");
+    if (!dest) {
+        fprintf(stderr, "Failed to open destination file for copying: %s\n", destPath);
+        fclose(src);
+        return;
+    }
+
+    char buffer[4096];
+    size_t bytesRead;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), src)) > 0) {
+        fwrite(buffer, 1, bytesRead, dest);
+        traceCount(TRACE_BYTES_READ, bytesRead);
+        traceCount(TRACE_BYTES_WRITTEN, bytesRead);
+    }
+
+    fclose(src);
+    fclose(dest);
+}
+
+// Queued paths are kept resolved against the repository root, since the ring opens them
+// relative to the working directory.
+static void queueFileCopy(CopyQueue* queue, const char* srcPath, const char* destPath) {
+    char srcBuffer[ROOTED_PATH_SIZE], destBuffer[ROOTED_PATH_SIZE];
+    const char* rootedSrc = rootedPath(srcPath, srcBuffer, sizeof(srcBuffer));
+    const char* rootedDest = rootedPath(destPath, destBuffer, sizeof(destBuffer));
+    if (!rootedSrc || !rootedDest) {
+        copyFile(srcPath, destPath);
+        return;
+    }
+    if (queue->count == queue->capacity) {
+        int capacity = queue->capacity ? queue->capacity * 2 : 256;
+        char** sources = realloc(queue->sources, capacity * sizeof(char*));
+        if (sources) queue->sources = sources;
+        char** destinations = realloc(queue->destinations, capacity * sizeof(char*));
+        if (destinations) queue->destinations = destinations;
+        if (!sources || !destinations) {
+            copyFile(srcPath, destPath);
+            return;
+        }
+        queue->capacity = capacity;
+    }
+    queue->sources[queue->count] = strdup(rootedSrc);
+    queue->destinations[queue->count] = strdup(rootedDest);
+    queue->count++;
+}
+
+#ifdef __linux__
+// Minimal io_uring driver on top of the raw syscalls. One ring per process is set up
+// lazily; small files are copied as linked openat -> read -> openat -> write -> close ->
+// close chains on direct descriptors, after a batch of statx calls has sized them.
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    unsigned localTail;
+} IoRing;
+
+static IoRing copyRing;
+static int copyRingState = 0; // 0 untried, 1 ready, -1 unavailable
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete) {
+    int result;
+    do {
+        result = (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (result < 0 && errno == EINTR);
+    return result;
+}
+
+static bool ioRingSupportsCopyOps(int fd) {
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, probeSize);
+    if (!probe) return false;
+    bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) >= 0;
+    const int ops[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE };
+    for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); i++) {
+        supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+static bool setupCopyRing(void) {
+    if (copyRingState != 0) {
+        return copyRingState > 0;
+    }
+    copyRingState = -1;
+    const char* mode = getenv("ZENGIT_IO");
+    if (mode && strcmp(mode, "sync") == 0) {
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL;
+    int fd = (int)syscall(__NR_io_uring_setup, COPY_RING_ENTRIES, &params);
+    if (fd < 0) {
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !ioRingSupportsCopyOps(fd)) {
+        close(fd);
+        return false;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ringSize = sqSize > cqSize ? sqSize : cqSize;
+    char* ring = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    struct io_uring_sqe* sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        munmap(ring, ringSize);
+        close(fd);
+        return false;
+    }
+
+    // Two direct descriptor slots per file in a batch: source and destination.
+    int slots[2 * COPY_BATCH_FILES];
+    for (int i = 0; i < 2 * COPY_BATCH_FILES; i++) slots[i] = -1;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, slots, 2 * COPY_BATCH_FILES) < 0) {
+        munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        munmap(ring, ringSize);
+        close(fd);
+        return false;
+    }
+
+    copyRing.fd = fd;
+    copyRing.entries = params.sq_entries;
+    copyRing.sqHead = (unsigned*)(ring + params.sq_off.head);
+    copyRing.sqTail = (unsigned*)(ring + params.sq_off.tail);
+    copyRing.sqMask = (unsigned*)(ring + params.sq_off.ring_mask);
+    copyRing.sqArray = (unsigned*)(ring + params.sq_off.array);
+    copyRing.cqHead = (unsigned*)(ring + params.cq_off.head);
+    copyRing.cqTail = (unsigned*)(ring + params.cq_off.tail);
+    copyRing.cqMask = (unsigned*)(ring + params.cq_off.ring_mask);
+    copyRing.cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+    copyRing.sqes = sqes;
+    copyRing.localTail = *copyRing.sqTail;
+    copyRingState = 1;
+    return true;
+}
+
+static struct io_uring_sqe* nextSqe(IoRing* ring, int opcode, uint64_t userData) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->localTail - head >= ring->entries) {
+        return NULL;
+    }
+    unsigned index = ring->localTail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->user_data = userData;
+    ring->sqArray[index] = index;
+    ring->localTail++;
+    return sqe;
+}
+
+// Submits everything queued and calls handle for each of the expected completions.
+static bool runRingBatch(IoRing* ring, unsigned expected, void (*handle)(uint64_t userData, int result, void* context), void* context) {
+    unsigned toSubmit = ring->localTail - *ring->sqTail;
+    __atomic_store_n(ring->sqTail, ring->localTail, __ATOMIC_RELEASE);
+    if (toSubmit > 0 && ioUringEnter(ring->fd, toSubmit, expected) != (int)toSubmit) {
+        return false;
+    }
+
+    unsigned seen = 0;
+    while (seen < expected) {
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (ioUringEnter(ring->fd, 0, expected - seen) < 0) return false;
+            continue;
+        }
+        for (; head != tail; head++, seen++) {
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+            handle(cqe->user_data, cqe->res, context);
+        }
+        __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+typedef struct {
+    struct statx* stats;
+    long long* sizes;     // expected byte count per file, -1 when it goes the slow way
+    bool* failed;
+} CopyBatch;
+
+static void handleStatxCompletion(uint64_t userData, int result, void* context) {
+    CopyBatch* batch = context;
+    const struct statx* stats = &batch->stats[userData];
+    bool small = result == 0 && S_ISREG(stats->stx_mode) && stats->stx_size <= COPY_SMALL_FILE_LIMIT;
+    traceCount(TRACE_STAT_CALLS, 1);
+    batch->sizes[userData] = small ? (long long)stats->stx_size : -1;
+}
+
+static void handleCopyCompletion(uint64_t userData, int result, void* context) {
+    CopyBatch* batch = context;
+    int file = (int)(userData >> 3);
+    int step = (int)(userData & 7);
+    bool transfer = step == 1 || step == 3; // the read and the write
+    if (result < 0 || (transfer && result != batch->sizes[file])) {
+        batch->failed[file] = true;
+    } else if (transfer) {
+        traceCount(step == 1 ? TRACE_BYTES_READ : TRACE_BYTES_WRITTEN, (uint64_t)result);
+    }
+}
+
+// Copies up to COPY_BATCH_FILES files through the ring. Anything the ring could not
+// handle (large files, errors, short transfers) is left with failed set.
+static bool copyFilesWithRing(char** sources, char** destinations, int count, char* buffers, CopyBatch* batch) {
+    IoRing* ring = &copyRing;
+    for (int i = 0; i < count; i++) {
+        struct io_uring_sqe* sqe = nextSqe(ring, IORING_OP_STATX, (uint64_t)i);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)sources[i];
+        sqe->len = STATX_TYPE | STATX_SIZE;
+        sqe->off = (uint64_t)(uintptr_t)&batch->stats[i];
+    }
+    if (!runRingBatch(ring, count, handleStatxCompletion, batch)) {
+        return false;
+    }
+
+    unsigned expected = 0;
+    for (int i = 0; i < count; i++) {
+        batch->failed[i] = batch->sizes[i] < 0;
+        if (batch->failed[i]) continue;
+
+        char* buffer = buffers + (size_t)i * COPY_SMALL_FILE_LIMIT;
+        unsigned sourceSlot = 2 * i, destSlot = 2 * i + 1;
+        uint64_t tag = (uint64_t)i << 3;
+
+        struct io_uring_sqe* sqe = nextSqe(ring, IORING_OP_OPENAT, tag | 0);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)sources[i];
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = sourceSlot + 1;
+        sqe->flags = IOSQE_IO_LINK;
+
+        sqe = nextSqe(ring, IORING_OP_READ, tag | 1);
+        sqe->fd = (int)sourceSlot;
+        sqe->addr = (uint64_t)(uintptr_t)buffer;
+        sqe->len = (unsigned)batch->sizes[i];
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+
+        sqe = nextSqe(ring, IORING_OP_OPENAT, tag | 2);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)destinations[i];
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+        sqe->len = 0666;
+        sqe->file_index = destSlot + 1;
+        sqe->flags = IOSQE_IO_LINK;
+
+        sqe = nextSqe(ring, IORING_OP_WRITE, tag | 3);
+        sqe->fd = (int)destSlot;
+        sqe->addr = (uint64_t)(uintptr_t)buffer;
+        sqe->len = (unsigned)batch->sizes[i];
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+
+        sqe = nextSqe(ring, IORING_OP_CLOSE, tag | 4);
+        sqe->file_index = sourceSlot + 1;
+        sqe->flags = IOSQE_IO_LINK;
+
+        sqe = nextSqe(ring, IORING_OP_CLOSE, tag | 5);
+        sqe->file_index = destSlot + 1;
+        expected += 6;
+    }
+    return runRingBatch(ring, expected, handleCopyCompletion, batch);
+}
+#endif
+
+// Copies every queued file, through io_uring where the kernel supports it and with
+// copyFile otherwise (or for whatever the ring left behind).
+static void flushFileCopies(CopyQueue* queue) {
+    zengitTraceBegin("copy");
+    int done = 0;
+#ifdef __linux__
+    if (queue->count > 1 && setupCopyRing()) {
+        CopyBatch batch;
+        batch.stats = malloc(COPY_BATCH_FILES * sizeof(struct statx));
+        batch.sizes = malloc(COPY_BATCH_FILES * sizeof(long long));
+        batch.failed = malloc(COPY_BATCH_FILES * sizeof(bool));
+        char* buffers = malloc((size_t)COPY_BATCH_FILES * COPY_SMALL_FILE_LIMIT);
+        bool ok = batch.stats && batch.sizes && batch.failed && buffers;
+        while (ok && done < queue->count) {
+            int count = queue->count - done < COPY_BATCH_FILES ? queue->count - done : COPY_BATCH_FILES;
+            ok = copyFilesWithRing(queue->sources + done, queue->destinations + done, count, buffers, &batch);
+            for (int i = 0; ok && i < count; i++) {
+                if (batch.failed[i]) copyFile(queue->sources[done + i], queue->destinations[done + i]);
+            }
+            if (ok) done += count;
+        }
+        if (!ok) copyRingState = -1;
+        free(batch.stats);
+        free(batch.sizes);
+        free(batch.failed);
+        free(buffers);
+    }
+#endif
+    for (int i = done; i < queue->count; i++) {
+        copyFile(queue->sources[i], queue->destinations[i]);
+    }
+
+    for (int i = 0; i < queue->count; i++) {
+        free(queue->sources[i]);
+        free(queue->destinations[i]);
+    }
+    free(queue->sources);
+    free(queue->destinations);
+    memset(queue, 0, sizeof(*queue));
+    zengitTraceEnd();
+}
+
+
+
+typedef struct {
+    ByteBuffer destPath;
+    IgnoreRules* ignoreRules;
+    bool sparse;                  // skip what the sparse checkout excludes
+    CopyQueue* queue;
+} CopyContext;
+
+static WalkAction visitForCopy(WalkEntry* entry, void* context) {
+    CopyContext* copy = context;
+    bool isDir = entry->type == WALK_DIRECTORY;
+    const char* relativePath = relativeWorkTreePath(entry->path);
+    if (copy->ignoreRules && isPathIgnored(copy->ignoreRules, relativePath, isDir)) {
+        return WALK_SKIP;
+    }
+    if (copy->sparse && !isPathInSparseCheckout(entry->relativePath, isDir)) {
+        return WALK_SKIP;
+    }
+
+    // destPath holds the destination root; the entry's relative path goes after it.
+    size_t rootSize = copy->destPath.size;
+    if (!appendBytes(&copy->destPath, "/", 1) || !appendBytes(&copy->destPath, entry->relativePath, strlen(entry->relativePath) + 1)) {
+        return WALK_STOP;
+    }
+    if (isDir) {
+        ensureDirectoryStructureExists(copy->destPath.data);
+        if (copy->ignoreRules) entry->mark = pushDirectoryIgnoreRules(copy->ignoreRules, relativePath);
+    } else {
+        queueFileCopy(copy->queue, entry->path, copy->destPath.data);
+    }
+    copy->destPath.size = rootSize;
+    return WALK_CONTINUE;
+}
+
+static void leaveCopiedDirectory(WalkEntry* directory, void* context) {
+    CopyContext* copy = context;
+    if (copy->ignoreRules) popIgnoreRules(copy->ignoreRules, directory->mark);
+}
+
+// ignoreRules is only passed when copying out of the work tree; snapshots are copied
+// back verbatim, except for what sparse leaves out. Files are only queued; the caller
+// flushes the queue.
+static void queueDirectoryCopy(const char* srcDirPath, const char* destDirPath, IgnoreRules* ignoreRules, bool sparse, CopyQueue* queue) {
+    ensureDirectoryStructureExists(destDirPath);
+
+    CopyContext copy;
+    memset(&copy, 0, sizeof(copy));
+    copy.ignoreRules = ignoreRules;
+    copy.sparse = sparse;
+    copy.queue = queue;
+    appendBytes(&copy.destPath, destDirPath, strlen(destDirPath));
+    int savedRules = ignoreRules ? pushDirectoryIgnoreRules(ignoreRules, relativeWorkTreePath(srcDirPath)) : 0;
+
+    DirectoryWalker walker = { visitForCopy, leaveCopiedDirectory, &copy, false };
+    zengitTraceBegin("walk");
+    if (!walkDirectoryTree(srcDirPath, "", &walker)) {
+        perror("Failed to open source directory for copying");
+    }
+    zengitTraceEnd();
+
+    if (ignoreRules) popIgnoreRules(ignoreRules, savedRules);
+    freeByteBuffer(&copy.destPath);
+}
+
+static void copyDirectoryRecursively(const char* srcDirPath, const char* destDirPath, IgnoreRules* ignoreRules, bool sparse) {
+    CopyQueue queue;
+    memset(&queue, 0, sizeof(queue));
+    queueDirectoryCopy(srcDirPath, destDirPath, ignoreRules, sparse, &queue);
+    flushFileCopies(&queue);
+}
+
+static void clearIndexFile(const char* indexPath) {
+
+    FILE* index = repoFopen(indexPath, "w");
+    if (!index) {
+        perror("Failed to clear index file");
+        return;
+    }
+
+    fclose(index);
+}
+
+static WalkAction visitForFileCount(WalkEntry* entry, void* context) {
+    if (entry->type != WALK_DIRECTORY) {
+        ++*(int*)context;
+    }
+    return WALK_CONTINUE;
+}
+
+static int countFilesInCommitDir(const char* dirPath) {
+    int count = 0;
+    DirectoryWalker walker = { visitForFileCount, NULL, &count, false };
+    zengitTraceBegin("walk");
+    walkDirectoryTree(dirPath, "", &walker);
+    zengitTraceEnd();
+    return count;
+}
+
+
+static bool isFileEmpty(const char* filename) {
+    FILE *file = repoFopen(filename, "r");
+    if (file == NULL) {
+        return true;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fclose(file);
+    return fileSize == 0;
+}
+
+static uint64_t hashBytes(uint64_t hash, const unsigned char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static bool hashFileContents(const char* path, uint64_t* hash, long long* size) {
+    FILE* file = repoFopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    unsigned char buffer[65536];
+    size_t bytesRead;
+    *hash = FNV_OFFSET_BASIS;
+    *size = 0;
+    while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        *hash = hashBytes(*hash, buffer, bytesRead);
+        *size += (long long)bytesRead;
+    }
+
+    fclose(file);
+    traceCount(TRACE_BYTES_READ, (uint64_t)*size);
+    traceCount(TRACE_OBJECTS_HASHED, 1);
+    return true;
+}
+
+// Open-addressing map from strings to ints. Keys are copied into the table's arena;
+// capacity is a power of two and the table is kept at most half full.
+typedef struct {
+    char** keys;
+    int* values;
+    int capacity;
+    int count;
+    Arena keyStrings;
+} StringTable;
+
+static uint64_t hashString(const char* text) {
+    return hashBytes(FNV_OFFSET_BASIS, (const unsigned char*)text, strlen(text));
+}
+
+static bool stringTableInit(StringTable* table, int expectedCount) {
+    table->capacity = 16;
+    while (table->capacity < expectedCount * 2) table->capacity <<= 1;
+    table->count = 0;
+    table->keyStrings.head = NULL;
+    table->keys = calloc(table->capacity, sizeof(char*));
+    table->values = malloc(table->capacity * sizeof(int));
+    if (!table->keys || !table->values) {
+        free(table->keys);
+        free(table->values);
+        memset(table, 0, sizeof(*table));
+        return false;
+    }
+    return true;
+}
+
+static void stringTableFree(StringTable* table) {
+    arenaFree(&table->keyStrings);
+    free(table->keys);
+    free(table->values);
+    memset(table, 0, sizeof(*table));
+}
+
+static int stringTableSlot(const StringTable* table, const char* key) {
+    int slot = (int)(hashString(key) & (uint64_t)(table->capacity - 1));
+    while (table->keys[slot] && strcmp(table->keys[slot], key) != 0) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return slot;
+}
+
+static int* stringTableFind(const StringTable* table, const char* key) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    int slot = stringTableSlot(table, key);
+    return table->keys[slot] ? &table->values[slot] : NULL;
+}
+
+static bool stringTablePut(StringTable* table, const char* key, int value) {
+    if ((table->count + 1) * 2 > table->capacity) {
+        StringTable grown;
+        if (!stringTableInit(&grown, table->capacity)) {
+            return false;
+        }
+        for (int i = 0; i < table->capacity; i++) {
+            if (table->keys[i]) {
+                int slot = stringTableSlot(&grown, table->keys[i]);
+                grown.keys[slot] = table->keys[i];
+                grown.values[slot] = table->values[i];
+                grown.count++;
+            }
+        }
+        free(table->keys);
+        free(table->values);
+        grown.keyStrings = table->keyStrings;
+        *table = grown;
+    }
+
+    int slot = stringTableSlot(table, key);
+    if (!table->keys[slot]) {
+        table->keys[slot] = arenaStrdup(&table->keyStrings, key);
+        if (!table->keys[slot]) {
+            return false;
+        }
+        table->count++;
+    }
+    table->values[slot] = value;
+    return true;
+}
+
+// What a cache remembers about the file it was built from. Without nanosecond mtimes or
+// inode numbers (Windows) a rewrite of the same size within the same second looks
+// unchanged, so a file modified in the second its signature was taken is marked racy and
+// never matches, as the untracked cache does for directories.
+typedef struct {
+    bool exists;
+    bool racy;
+    long long size;
+    long long mtime;
+    long mtimeNsec;
+    unsigned long long inode;
+} FileSignature;
+
+static FileSignature readFileSignature(const char* path) {
+    FileSignature signature = {0};
+    struct stat fileStat;
+    traceCount(TRACE_STAT_CALLS, 1);
+    if (repoStat(path, &fileStat) != 0) {
+        return signature;
+    }
+    signature.exists = true;
+    signature.size = (long long)fileStat.st_size;
+    signature.mtime = (long long)fileStat.st_mtime;
+#ifdef __linux__
+    signature.mtimeNsec = fileStat.st_mtim.tv_nsec;
+#endif
+    signature.inode = (unsigned long long)fileStat.st_ino;
+    signature.racy = fileStat.st_mtime >= time(NULL);
+    return signature;
+}
+
+static bool sameFileSignature(const FileSignature* a, const FileSignature* b) {
+    return a->exists == b->exists && !a->racy && !b->racy && a->size == b->size && a->mtime == b->mtime &&
+           a->mtimeNsec == b->mtimeNsec && a->inode == b->inode;
+}
+
+// Config. Values come from, lowest precedence first, the system file, the global file, the
+// repository's .zengitconfig and the environment (ZENGIT_CONFIG_COUNT=<n> with
+// ZENGIT_CONFIG_KEY_<i> and ZENGIT_CONFIG_VALUE_<i>). ZENGIT_CONFIG_SYSTEM and
+// ZENGIT_CONFIG_GLOBAL replace the paths of the first two files. A process parses the files
+// once; inside a repository the merged result is also saved to .zengit/config.cache together
+// with the files' signatures, and later processes load that instead while none changed.
+
+typedef struct {
+    bool loaded;
+    FileSignature signatures[CONFIG_LAYERS];
+    StringTable keys;              // key -> index into values
+    char** values;
+    int count;
+    int capacity;
+    Arena strings;
+} ConfigTable;
+
+static ConfigTable config;
+
+static const char* configLayerPath(int layer) {
+    const char* path = NULL;
+    if (layer == CONFIG_SYSTEM) {
+        path = getenv("ZENGIT_CONFIG_SYSTEM");
+        return path && *path ? path : SYSTEM_CONFIG_PATH;
+    } else if (layer == CONFIG_GLOBAL) {
+        path = getenv("ZENGIT_CONFIG_GLOBAL");
+        return path && *path ? path : GLOBAL_CONFIG_PATH;
+    }
+    return LOCAL_CONFIG_PATH;
+}
+
+static void invalidateConfig(void) {
+    stringTableFree(&config.keys);
+    arenaFree(&config.strings);
+    free(config.values);
+    memset(&config, 0, sizeof(config));
+}
+
+static bool configSet(const char* key, size_t keyLength, const char* value, size_t valueLength) {
+    if (config.keys.capacity == 0 && !stringTableInit(&config.keys, 0)) {
+        return false;
+    }
+    char* keyCopy = arenaStrndup(&config.strings, key, keyLength);
+    char* valueCopy = arenaStrndup(&config.strings, value, valueLength);
+    if (!keyCopy || !valueCopy) {
+        return false;
+    }
+    int* index = stringTableFind(&config.keys, keyCopy);
+    if (index) {
+        config.values[*index] = valueCopy;
+        return true;
+    }
+    if (config.count == config.capacity) {
+        int capacity = config.capacity ? config.capacity * 2 : 16;
+        char** values = realloc(config.values, capacity * sizeof(char*));
+        if (!values) {
+            return false;
+        }
+        config.values = values;
+        config.capacity = capacity;
+    }
+    config.values[config.count] = valueCopy;
+    return stringTablePut(&config.keys, keyCopy, config.count++);
+}
+
+// key=value lines; anything without '=' is skipped.
+static bool parseConfigFile(const char* path) {
+    FILE* file = repoFopen(path, "r");
+    if (!file) {
+        return true;
+    }
+    char line[MAX_CONFIG_LINE];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        traceCount(TRACE_BYTES_READ, strlen(line));
+        line[strcspn(line, "\r\n")] = '\0';
+        char* equals = strchr(line, '=');
+        if (equals && equals != line) {
+            ok = configSet(line, equals - line, equals + 1, strlen(equals + 1));
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+static bool readConfigCache(const FileSignature* signatures) {
+    FILE* file = repoFopen(CONFIG_CACHE_FILE, "rb");
+    if (!file) {
+        return false;
+    }
+    char magic[4];
+    FileSignature cached[CONFIG_LAYERS];
+    uint32_t count = 0;
+    bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, CONFIG_CACHE_MAGIC, 4) == 0 &&
+              fread(cached, sizeof(cached), 1, file) == 1 && fread(&count, sizeof(count), 1, file) == 1;
+    for (int i = 0; ok && i < CONFIG_LAYERS; i++) {
+        ok = sameFileSignature(&cached[i], &signatures[i]);
+    }
+
+    char text[2 * MAX_CONFIG_LINE];
+    for (uint32_t i = 0; ok && i < count; i++) {
+        uint32_t lengths[2];
+        ok = fread(lengths, sizeof(lengths), 1, file) == 1 && lengths[0] + lengths[1] <= sizeof(text) &&
+             fread(text, 1, lengths[0] + lengths[1], file) == lengths[0] + lengths[1] &&
+             configSet(text, lengths[0], text + lengths[0], lengths[1]);
+        traceCount(TRACE_BYTES_READ, sizeof(lengths) + lengths[0] + lengths[1]);
+    }
+    fclose(file);
+    if (!ok) {
+        invalidateConfig();
+    }
+    return ok;
+}
+
+// Written to a temporary file and renamed, so a concurrent reader sees the old or new cache.
+static void writeConfigCache(const FileSignature* signatures) {
+    if (!isDirectory(".zengit")) {
+        return;
+    }
+    char tempPath[MAX_PATH_LENGTH];
+    snprintf(tempPath, sizeof(tempPath), "%s.%ld", CONFIG_CACHE_FILE, (long)getpid());
+    FILE* file = repoFopen(tempPath, "wb");
+    if (!file) {
+        return;
+    }
+    uint32_t count = (uint32_t)config.count;
+    fwrite(CONFIG_CACHE_MAGIC, 1, 4, file);
+    fwrite(signatures, sizeof(FileSignature), CONFIG_LAYERS, file);
+    fwrite(&count, sizeof(count), 1, file);
+    for (int i = 0; i < config.keys.capacity; i++) {
+        const char* key = config.keys.keys[i];
+        if (!key) continue;
+        const char* value = config.values[config.keys.values[i]];
+        uint32_t lengths[2] = { (uint32_t)strlen(key), (uint32_t)strlen(value) };
+        fwrite(lengths, sizeof(lengths), 1, file);
+        fwrite(key, 1, lengths[0], file);
+        fwrite(value, 1, lengths[1], file);
+        traceCount(TRACE_BYTES_WRITTEN, sizeof(lengths) + lengths[0] + lengths[1]);
+    }
+    if (fclose(file) != 0 || repoRename(tempPath, CONFIG_CACHE_FILE) != 0) {
+        repoRemove(tempPath);
+    }
+}
+
+static void applyConfigEnvironment(void) {
+    const char* countText = getenv("ZENGIT_CONFIG_COUNT");
+    int count = countText ? atoi(countText) : 0;
+    for (int i = 0; i < count; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "ZENGIT_CONFIG_KEY_%d", i);
+        const char* key = getenv(name);
+        snprintf(name, sizeof(name), "ZENGIT_CONFIG_VALUE_%d", i);
+        const char* value = getenv(name);
+        if (key && *key && value) {
+            configSet(key, strlen(key), value, strlen(value));
+        }
+    }
+}
+
+// Reloads when a config file changed since the last load; cheap otherwise (three stats).
+static void refreshConfig(void) {
+    FileSignature signatures[CONFIG_LAYERS];
+    bool unchanged = config.loaded;
+    for (int i = 0; i < CONFIG_LAYERS; i++) {
+        signatures[i] = readFileSignature(configLayerPath(i));
+        unchanged = unchanged && sameFileSignature(&signatures[i], &config.signatures[i]);
+    }
+    if (unchanged) {
+        traceCount(TRACE_CACHE_HITS, 1);
+        return;
+    }
+
+    traceCount(TRACE_CACHE_MISSES, 1);
+    zengitTraceBegin("config load");
+    invalidateConfig();
+    if (!readConfigCache(signatures)) {
+        bool parsed = true;
+        for (int i = 0; parsed && i < CONFIG_LAYERS; i++) {
+            parsed = parseConfigFile(configLayerPath(i));
+        }
+        if (parsed) {
+            writeConfigCache(signatures);
+        }
+    }
+    applyConfigEnvironment();
+    memcpy(config.signatures, signatures, sizeof(signatures));
+    config.loaded = true;
+    zengitTraceEnd();
+}
+
+// NULL when no layer sets key. The value stays valid until the config is reloaded.
+static const char* configGet(const char* key) {
+    if (!config.loaded) {
+        refreshConfig();
+    }
+    int* index = stringTableFind(&config.keys, key);
+    return index ? config.values[*index] : NULL;
+}
+
+// Staging journal. Each add and reset appends one group to .zengit/stage_journal holding
+// the paths it staged or unstaged, and "reset -undo" / "add -redo" append a marker naming
+// the group they reverted or re-applied. A group is applied as a single rewrite of the
+// index however many paths it has. Every record ends with a trailer pointing at its start,
+// so the journal is read back from the tail without a scan. History goes back as far as
+// stage.journalSize bytes (config, default 64 MB); older records are dropped.
+typedef struct {
+    uint32_t magic;
+    uint32_t type;                 // STAGE_*
+    uint64_t sequence;
+    uint64_t target;               // undo and redo: sequence of the group
+    uint64_t invocation;           // the add or reset command that wrote the group
+    uint64_t count;                // paths
+    uint64_t payloadBytes;         // the paths, each NUL-terminated
+} StageRecordHeader;
+
+typedef struct {
+    uint64_t start;
+    uint64_t magic;
+} StageRecordTrailer;
+
+// Several zengitRepoAdd calls from one command extend a single group.
+static uint64_t stagingInvocation(void) {
+    static pid_t owner;
+    static uint64_t invocation;
+    if (owner != getpid()) {
+        owner = getpid();
+        invocation = (uint64_t)clockNanoseconds() ^ ((uint64_t)owner << 32);
+    }
+    return invocation;
+}
+
+// Reads the record that ends at end.
+static bool readStageRecordBefore(int fd, uint64_t end, StageRecordHeader* header, uint64_t* start) {
+    StageRecordTrailer trailer;
+    if (end < sizeof(*header) + sizeof(trailer) ||
+        readFileAt(fd, &trailer, sizeof(trailer), (long long)(end - sizeof(trailer))) != (ssize_t)sizeof(trailer) ||
+        trailer.magic != STAGE_JOURNAL_MAGIC || trailer.start > end - sizeof(*header) - sizeof(trailer)) {
+        return false;
+    }
+    if (readFileAt(fd, header, sizeof(*header), (long long)trailer.start) != (ssize_t)sizeof(*header) ||
+        header->magic != STAGE_JOURNAL_MAGIC ||
+        trailer.start + sizeof(*header) + header->payloadBytes + sizeof(trailer) != end) {
+        return false;
+    }
+    *start = trailer.start;
+    return true;
+}
+
+// Returns the record's paths as an array into one allocation; free the array only.
+static char** readStageRecordPaths(int fd, uint64_t start, const StageRecordHeader* header) {
+    size_t count = (size_t)header->count;
+    char** paths = malloc(count * sizeof(char*) + header->payloadBytes);
+    if (!paths) {
+        return NULL;
+    }
+    char* payload = (char*)(paths + count);
+    if (readFileAt(fd, payload, header->payloadBytes, (long long)(start + sizeof(*header))) != (ssize_t)header->payloadBytes) {
+        free(paths);
+        return NULL;
+    }
+    traceCount(TRACE_BYTES_READ, header->payloadBytes);
+    char* cursor = payload;
+    char* end = payload + header->payloadBytes;
+    for (size_t i = 0; i < count; i++) {
+        char* terminator = cursor < end ? memchr(cursor, '\0', end - cursor) : NULL;
+        if (!terminator) {
+            free(paths);
+            return NULL;
+        }
+        paths[i] = cursor;
+        cursor = terminator + 1;
+    }
+    return paths;
+}
+
+static uint64_t stageJournalLimit(void) {
+    const char* value = configGet("stage.journalSize");
+    unsigned long long limit = value ? strtoull(value, NULL, 10) : 0;
+    if (limit == 0) return STAGE_JOURNAL_DEFAULT_SIZE;
+    return limit < STAGE_JOURNAL_MIN_SIZE ? STAGE_JOURNAL_MIN_SIZE : limit;
+}
+
+// Drops the oldest records, keeping at least the newest one and at most half the limit, so
+// the next trim is far away.
+static void trimStageJournal(int fd, uint64_t end, uint64_t limit) {
+    uint64_t keepFrom = end, start;
+    StageRecordHeader header;
+    while (readStageRecordBefore(fd, keepFrom, &header, &start) && (keepFrom == end || end - start <= limit / 2)) {
+        keepFrom = start;
+    }
+    if (keepFrom == 0 || keepFrom == end) {
+        return;
+    }
+
+    char tempPath[MAX_PATH_LENGTH];
+    snprintf(tempPath, sizeof(tempPath), "%s.%ld", STAGE_JOURNAL_FILE, (long)getpid());
+    int out = repoOpen(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (out < 0) {
+        return;
+    }
+    char buffer[65536];
+    bool ok = true;
+    for (uint64_t offset = keepFrom; ok && offset < end;) {
+        size_t chunk = end - offset < sizeof(buffer) ? (size_t)(end - offset) : sizeof(buffer);
+        ssize_t got = readFileAt(fd, buffer, chunk, (long long)offset);
+        ok = got > 0 && write(out, buffer, (size_t)got) == got;
+        offset += got > 0 ? (uint64_t)got : 0;
+    }
+    if (close(out) != 0 || !ok || repoRename(tempPath, STAGE_JOURNAL_FILE) != 0) {
+        repoRemove(tempPath);
+    }
+}
+
+// Appends a group (STAGE_ADD, STAGE_REMOVE) of paths or a marker (STAGE_UNDO, STAGE_REDO)
+// for the group numbered target. A group from the same command as the last record grows
+// that record instead.
+static bool appendStageRecord(uint32_t type, uint64_t target, char** paths, int count) {
+    int fd = repoOpen(STAGE_JOURNAL_FILE, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open the staging journal: %s\n", strerror(errno));
+        return false;
+    }
+    long long size = fileDescriptorSize(fd);
+    uint64_t end = size > 0 ? (uint64_t)size : 0;
+    StageRecordHeader tail, header = {0};
+    uint64_t tailStart = 0;
+    bool hasTail = readStageRecordBefore(fd, end, &tail, &tailStart);
+    bool extend = hasTail && (type == STAGE_ADD || type == STAGE_REMOVE) && tail.type == type &&
+                  tail.invocation == stagingInvocation();
+
+    ByteBuffer payload = {0};
+    bool ok = true;
+    for (int i = 0; ok && i < count; i++) {
+        ok = appendBytes(&payload, paths[i], strlen(paths[i]) + 1);
+    }
+
+    uint64_t start = end;
+    if (extend) {
+        header = tail;
+        start = tailStart;
+        end -= sizeof(StageRecordTrailer);
+    } else {
+        header.magic = STAGE_JOURNAL_MAGIC;
+        header.type = type;
+        header.sequence = hasTail ? tail.sequence + 1 : 1;
+        header.target = target;
+        header.invocation = stagingInvocation();
+        ok = ok && writeFileAt(fd, &header, sizeof(header), (long long)end) == (ssize_t)sizeof(header);
+        end += sizeof(header);
+    }
+    header.count += (uint64_t)count;
+    header.payloadBytes += payload.size;
+
+    StageRecordTrailer trailer = { start, STAGE_JOURNAL_MAGIC };
+    ok = ok && (payload.size == 0 || writeFileAt(fd, payload.data, payload.size, (long long)end) == (ssize_t)payload.size) &&
+         writeFileAt(fd, &trailer, sizeof(trailer), (long long)(end + payload.size)) == (ssize_t)sizeof(trailer) &&
+         writeFileAt(fd, &header, sizeof(header), (long long)start) == (ssize_t)sizeof(header);
+    end += payload.size + sizeof(trailer);
+    traceCount(TRACE_BYTES_WRITTEN, payload.size + sizeof(header) + sizeof(trailer));
+    freeByteBuffer(&payload);
+
+    if (ok) {
+        uint64_t limit = stageJournalLimit();
+        if (end > limit) trimStageJournal(fd, end, limit);
+    } else {
+        fprintf(stderr, "Failed to write the staging journal.\n");
+    }
+    close(fd);
+    return ok;
+}
+
+// Removes paths from the index in one rewrite; found[i] tells whether paths[i] was staged.
+// Returns how many index lines were removed, or -1.
+static int removePathsFromIndex(char** paths, int count, bool* found) {
+    StringTable unstage;
+    if (!stringTableInit(&unstage, count)) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        found[i] = false;
+        if (!stringTablePut(&unstage, paths[i], i)) {
+            stringTableFree(&unstage);
+            return -1;
+        }
+    }
+
+    FILE* in = repoFopen(INDEX_FILE, "r");
+    if (!in) {
+        stringTableFree(&unstage);
+        return 0;
+    }
+    FILE* out = repoFopen(".zengit/index_tmp", "w");
+    if (!out) {
+        perror("Error opening staging area");
+        fclose(in);
+        stringTableFree(&unstage);
+        return -1;
+    }
+    int removed = 0;
+    char line[MAX_PATH_LENGTH];
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\n")] = '\0';
+        int* index = stringTableFind(&unstage, line);
+        if (index) {
+            found[*index] = true;
+            removed++;
+        } else {
+            fprintf(out, "%s\n", line);
+        }
+    }
+    fclose(in);
+    bool ok = fclose(out) == 0;
+    for (int i = 0; i < count; i++) {
+        found[i] = found[*stringTableFind(&unstage, paths[i])];
+    }
+    stringTableFree(&unstage);
+
+    if (removed > 0 && ok) {
+        ok = repoRename(".zengit/index_tmp", INDEX_FILE) == 0;
+    } else {
+        repoRemove(".zengit/index_tmp");
+    }
+    return ok ? removed : -1;
+}
+
+// Appends the paths the index does not hold yet; added[i] tells which were new.
+static int addPathsToIndex(char** paths, int count, bool* added) {
+    StringTable staged;
+    if (!stringTableInit(&staged, count)) {
+        return -1;
+    }
+    FILE* file = repoFopen(INDEX_FILE, "r");
+    char line[MAX_PATH_LENGTH];
+    bool ok = true;
+    while (ok && file && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        ok = stringTablePut(&staged, line, 1);
+    }
+    if (file) fclose(file);
+
+    file = ok ? repoFopen(INDEX_FILE, "a") : NULL;
+    int addedCount = 0;
+    for (int i = 0; file && ok && i < count; i++) {
+        added[i] = !stringTableFind(&staged, paths[i]);
+        if (added[i]) {
+            fprintf(file, "%s\n", paths[i]);
+            ok = stringTablePut(&staged, paths[i], 1);
+            addedCount++;
+        }
+    }
+    ok = file && fclose(file) == 0 && ok;
+    stringTableFree(&staged);
+    return ok ? addedCount : -1;
+}
+
+// Unstages paths as one journal group and reports the ones that were not staged.
+static bool unstagePaths(char** paths, int count) {
+    if (count == 0) {
+        return false;
+    }
+    bool* found = malloc(count * sizeof(bool));
+    char** unstaged = malloc(count * sizeof(char*));
+    int removed = found && unstaged ? removePathsFromIndex(paths, count, found) : -1;
+    if (removed < 0) {
+        fprintf(stderr, "Error updating the staging area.\n");
+        free(found);
+        free(unstaged);
+        return false;
+    }
+    int unstagedCount = 0;
+    for (int i = 0; i < count; i++) {
+        if (found[i]) {
+            unstaged[unstagedCount++] = paths[i];
+        } else {
+            fprintf(stderr, "File %s not found in staging area.\n", paths[i]);
+        }
+    }
+    if (unstagedCount > 0) {
+        appendStageRecord(STAGE_REMOVE, 0, unstaged, unstagedCount);
+    }
+    free(found);
+    free(unstaged);
+    return unstagedCount == count;
+}
+
+// Latest undo or redo marker seen for each group while walking back from the tail.
+typedef struct {
+    uint64_t* sequences;
+    bool* undone;
+    int count;
+    int capacity;
+} StageMarkers;
+
+// Records the marker unless a newer one for the same group was seen; returns whether the
+// group's latest marker is an undo.
+static bool noteStageMarker(StageMarkers* markers, const StageRecordHeader* header) {
+    for (int i = 0; i < markers->count; i++) {
+        if (markers->sequences[i] == header->target) return markers->undone[i];
+    }
+    if (markers->count == markers->capacity) {
+        int capacity = markers->capacity ? markers->capacity * 2 : 16;
+        uint64_t* sequences = realloc(markers->sequences, capacity * sizeof(uint64_t));
+        if (sequences) markers->sequences = sequences;
+        bool* undone = realloc(markers->undone, capacity * sizeof(bool));
+        if (undone) markers->undone = undone;
+        if (!sequences || !undone) return header->type == STAGE_UNDO;
+        markers->capacity = capacity;
+    }
+    markers->sequences[markers->count] = header->target;
+    markers->undone[markers->count++] = header->type == STAGE_UNDO;
+    return header->type == STAGE_UNDO;
+}
+
+static bool isStageGroupUndone(const StageMarkers* markers, uint64_t sequence) {
+    for (int i = 0; i < markers->count; i++) {
+        if (markers->sequences[i] == sequence) return markers->undone[i];
+    }
+    return false;
+}
+
+// Finds the group an undo (redo false) or redo reverts or re-applies: for undo the newest
+// group not undone, for redo the group of the newest undo that no later group superseded.
+static bool findStageGroup(int fd, bool redo, StageRecordHeader* group, uint64_t* groupStart) {
+    StageMarkers markers = {0};
+    long long size = fileDescriptorSize(fd);
+    uint64_t end = size > 0 ? (uint64_t)size : 0, start;
+    uint64_t redoTarget = 0;
+    bool found = false;
+    StageRecordHeader header;
+    while (!found && readStageRecordBefore(fd, end, &header, &start)) {
+        end = start;
+        if (header.type == STAGE_UNDO || header.type == STAGE_REDO) {
+            bool seen = false;
+            for (int i = 0; i < markers.count && !seen; i++) seen = markers.sequences[i] == header.target;
+            if (noteStageMarker(&markers, &header) && !seen && redo && redoTarget == 0) {
+                redoTarget = header.target;
+            }
+        } else if (redo) {
+            if (redoTarget == 0 && !isStageGroupUndone(&markers, header.sequence)) break;
+            found = redoTarget != 0 && header.sequence == redoTarget;
+        } else {
+            found = !isStageGroupUndone(&markers, header.sequence);
+        }
+        if (found) {
+            *group = header;
+            *groupStart = start;
+        }
+    }
+    free(markers.sequences);
+    free(markers.undone);
+    return found;
+}
+
+// Applies a group (or, with inverse, its opposite) to the index in one pass.
+static int applyStageGroup(const StageRecordHeader* group, char** paths, bool inverse) {
+    bool* changed = malloc((group->count ? group->count : 1) * sizeof(bool));
+    if (!changed) {
+        return -1;
+    }
+    bool stage = (group->type == STAGE_ADD) != inverse;
+    int count = stage ? addPathsToIndex(paths, (int)group->count, changed)
+                      : removePathsFromIndex(paths, (int)group->count, changed);
+    free(changed);
+    return count;
+}
+
+static bool undoOrRedoStaging(bool redo) {
+    int fd = repoOpen(STAGE_JOURNAL_FILE, O_RDONLY | O_BINARY, 0);
+    StageRecordHeader group;
+    uint64_t start;
+    if (fd < 0 || !findStageGroup(fd, redo, &group, &start)) {
+        if (fd >= 0) close(fd);
+        printf(redo ? "No undone staging actions to redo.\n" : "No staging actions to undo.\n");
+        return !redo;
+    }
+    char** paths = readStageRecordPaths(fd, start, &group);
+    close(fd);
+    int changed = paths ? applyStageGroup(&group, paths, !redo) : -1;
+    free(paths);
+    if (changed < 0) {
+        fprintf(stderr, "Error applying the staging journal to the index.\n");
+        return false;
+    }
+    appendStageRecord(redo ? STAGE_REDO : STAGE_UNDO, group.sequence, NULL, 0);
+
+    const char* action = group.type == STAGE_ADD ? "add" : "reset";
+    if (redo) {
+        printf("Last undone %s redone: %d file(s) %s.\n", action, changed, group.type == STAGE_ADD ? "staged" : "unstaged");
+    } else {
+        printf("Last %s undone: %d file(s) %s.\n", action, changed, group.type == STAGE_ADD ? "unstaged" : "staged again");
+    }
+    return true;
+}
+
+static void stageUndo(void) {
+    undoOrRedoStaging(false);
+}
+
+static bool stageRedo(void) {
+    return undoOrRedoStaging(true);
+}
+
+// Interned paths. Each path is stored once as (parent id, last component) together with
+// the hash of the whole path, so looking up "a/b/c" costs one probe per component and two
+// paths are equal exactly when their ids are. Id 0 is the root. Components are split on
+// '/' and '\\', and empty and "." components are skipped, so "./a//b" and "a/b" share an id.
+typedef struct {
+    int parent;
+    uint32_t nameLength;
+    const char* name;             // in the table's arena, not NUL-terminated
+    uint64_t hash;                // hashString of the full path
+    int value;                    // free for the owner, 0 when interned
+} InternedPath;
+
+typedef struct {
+    InternedPath* paths;
+    int count;
+    int capacity;
+    int* slots;                   // open addressing over paths, -1 when empty
+    int slotCapacity;
+    Arena names;
+} PathTable;
+
+static bool pathTableInit(PathTable* table) {
+    memset(table, 0, sizeof(*table));
+    table->capacity = 64;
+    table->slotCapacity = 128;
+    table->paths = malloc(table->capacity * sizeof(InternedPath));
+    table->slots = malloc(table->slotCapacity * sizeof(int));
+    if (!table->paths || !table->slots) {
+        free(table->paths);
+        free(table->slots);
+        memset(table, 0, sizeof(*table));
+        return false;
+    }
+    memset(table->slots, -1, table->slotCapacity * sizeof(int));
+    table->paths[0] = (InternedPath){ -1, 0, "", FNV_OFFSET_BASIS, 0 };
+    table->count = 1;
+    return true;
+}
+
+static void pathTableFree(PathTable* table) {
+    free(table->paths);
+    free(table->slots);
+    arenaFree(&table->names);
+    memset(table, 0, sizeof(*table));
+}
+
+static uint64_t childPathHash(uint64_t parentHash, bool parentIsRoot, const char* name, size_t length) {
+    uint64_t hash = parentIsRoot ? FNV_OFFSET_BASIS : hashBytes(parentHash, (const unsigned char*)"/", 1);
+    return hashBytes(hash, (const unsigned char*)name, length);
+}
+
+static int pathTableSlot(const PathTable* table, int parent, const char* name, size_t length, uint64_t hash) {
+    int mask = table->slotCapacity - 1;
+    int slot = (int)(hash & (uint64_t)mask);
+    while (table->slots[slot] >= 0) {
+        const InternedPath* path = &table->paths[table->slots[slot]];
+        if (path->hash == hash && path->parent == parent && path->nameLength == length &&
+            memcmp(path->name, name, length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static bool growPathTable(PathTable* table) {
+    if (table->count == table->capacity) {
+        int capacity = table->capacity * 2;
+        InternedPath* grown = realloc(table->paths, capacity * sizeof(InternedPath));
+        if (!grown) return false;
+        table->paths = grown;
+        table->capacity = capacity;
+    }
+    if ((table->count + 1) * 2 > table->slotCapacity) {
+        int slotCapacity = table->slotCapacity * 2;
+        int* slots = malloc(slotCapacity * sizeof(int));
+        if (!slots) return false;
+        memset(slots, -1, slotCapacity * sizeof(int));
+        for (int id = 1; id < table->count; id++) {
+            int slot = (int)(table->paths[id].hash & (uint64_t)(slotCapacity - 1));
+            while (slots[slot] >= 0) slot = (slot + 1) & (slotCapacity - 1);
+            slots[slot] = id;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->slotCapacity = slotCapacity;
+    }
+    return true;
+}
+
+// Returns the id of name under parent, adding it when insert is set; -1 if absent.
+static int pathTableChild(PathTable* table, int parent, const char* name, size_t length, bool insert) {
+    uint64_t hash = childPathHash(table->paths[parent].hash, parent == 0, name, length);
+    int slot = pathTableSlot(table, parent, name, length, hash);
+    if (table->slots[slot] >= 0 || !insert) {
+        return table->slots[slot];
+    }
+    if (!growPathTable(table)) {
+        return -1;
+    }
+    slot = pathTableSlot(table, parent, name, length, hash);
+    const char* copy = arenaStrndup(&table->names, name, length);
+    if (!copy) {
+        return -1;
+    }
+    int id = table->count++;
+    table->paths[id] = (InternedPath){ parent, (uint32_t)length, copy, hash, 0 };
+    table->slots[slot] = id;
+    return id;
+}
+
+static int pathTableIntern(PathTable* table, const char* path, bool insert) {
+    int id = 0;
+    while (*path && id >= 0) {
+        size_t length = strcspn(path, "/\\");
+        if (length > 0 && !(length == 1 && path[0] == '.')) {
+            id = pathTableChild(table, id, path, length, insert);
+        }
+        path += length;
+        if (*path) path++;
+    }
+    return id;
+}
+
+// Interns every staged path with value 1.
+static bool loadIndexTable(PathTable* index) {
+    if (!pathTableInit(index)) {
+        return false;
+    }
+    zengitTraceBegin("index load");
+    FILE* file = repoFopen(INDEX_FILE, "r");
+    if (file) {
+        char line[MAX_PATH_LENGTH];
+        while (fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            int id = pathTableIntern(index, line, true);
+            if (id > 0) {
+                index->paths[id].value = 1;
+            }
+        }
+        fclose(file);
+    }
+    zengitTraceEnd();
+    return true;
+}
+
+// Sparse checkout. .zengit/sparse-checkout lists one included directory per line, as in
+// git's cone mode: everything below a listed directory is included, and so are the files
+// directly inside each of its ancestors, the root among them. The directories go into a
+// path table used as a prefix trie, listed ones marked SPARSE_INCLUDED and their ancestors
+// SPARSE_PARENT, so deciding a path costs one probe per component and a walk that meets a
+// directory outside every prefix skips it without opening it. Without the file every path
+// is included.
+typedef struct {
+    bool loaded;
+    bool enabled;
+    FileSignature signature;
+    PathTable prefixes;
+} SparseCheckout;
+
+static SparseCheckout sparseCheckout;
+
+// Reloads the pattern file when it changed; returns whether a sparse checkout is active.
+static bool refreshSparseCheckout(void) {
+    FileSignature signature = readFileSignature(SPARSE_CHECKOUT_FILE);
+    if (sparseCheckout.loaded && sameFileSignature(&signature, &sparseCheckout.signature)) {
+        return sparseCheckout.enabled;
+    }
+
+    if (sparseCheckout.enabled) pathTableFree(&sparseCheckout.prefixes);
+    sparseCheckout.enabled = false;
+    sparseCheckout.signature = signature;
+    sparseCheckout.loaded = true;
+    FILE* file = signature.exists ? repoFopen(SPARSE_CHECKOUT_FILE, "r") : NULL;
+    if (!file || !pathTableInit(&sparseCheckout.prefixes)) {
+        if (file) fclose(file);
+        return false;
+    }
+
+    PathTable* prefixes = &sparseCheckout.prefixes;
+    char line[MAX_PATH_LENGTH];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        int id = pathTableIntern(prefixes, line, true);
+        if (id < 0) continue;
+        prefixes->paths[id].value = SPARSE_INCLUDED;
+        for (int parent = prefixes->paths[id].parent; parent > 0 && !prefixes->paths[parent].value;
+             parent = prefixes->paths[parent].parent) {
+            prefixes->paths[parent].value = SPARSE_PARENT;
+        }
+    }
+    fclose(file);
+    sparseCheckout.enabled = true;
+    return true;
+}
+
+// path is relative to the repository root. Uses the patterns of the last refresh.
+static bool isPathInSparseCheckout(const char* path, bool isDirectory) {
+    if (!sparseCheckout.enabled) {
+        return true;
+    }
+    PathTable* prefixes = &sparseCheckout.prefixes;
+    int id = 0;
+    while (*path) {
+        if (prefixes->paths[id].value == SPARSE_INCLUDED) {
+            return true;
+        }
+        size_t length = strcspn(path, "/\\");
+        bool last = path[length] == '\0';
+        if (length > 0 && !(length == 1 && path[0] == '.')) {
+            int child = pathTableChild(prefixes, id, path, length, false);
+            if (child < 0) {
+                return last && !isDirectory;
+            }
+            id = child;
+        }
+        path += length;
+        if (*path) path++;
+    }
+    return id == 0 || prefixes->paths[id].value != 0;
+}
+
+// Drops the entries the sparse checkout excludes.
+static void filterSparseManifest(Manifest* manifest) {
+    int kept = 0;
+    for (int i = 0; i < manifest->count; i++) {
+        if (isPathInSparseCheckout(manifest->entries[i].path, false)) {
+            manifest->entries[kept++] = manifest->entries[i];
+        }
+    }
+    manifest->count = kept;
+}
+
+// add -n: the work tree down to a depth, files marked staged or not and every directory
+// down to the limit marked by the files below it. The index is loaded once and each file
+// costs one table lookup. Staged and total files are counted as the walk goes; a directory
+// remembers the counts it was entered with and is reported when the walk leaves it, from
+// the difference. Lines come out in walk order, with memory independent of the size of
+// the tree.
+typedef struct {
+    long long files;
+    long long stagedFiles;
+} ListingCounts;
+
+typedef struct {
+    int depth;
+    PathTable index;
+    ListingCounts total;
+    ListingCounts* entered;        // counts when each open directory was entered, by depth
+    int enteredCapacity;
+} ListingContext;
+
+static bool isListedPathStaged(const ListingContext* listing, const char* path) {
+    int id = pathTableIntern((PathTable*)&listing->index, path, false);
+    return id > 0 && listing->index.paths[id].value;
+}
+
+static WalkAction visitForListing(WalkEntry* entry, void* context) {
+    ListingContext* listing = context;
+    if (strcmp(entry->name, ".zengit") == 0) return WALK_SKIP;
+    const char* formattedPath = relativeWorkTreePath(entry->path);
+    if (entry->depth > listing->depth) {
+        // Inside a directory at the limit: once it is known to be partially staged the rest
+        // of it does not matter, to it or to the directories above it.
+        const ListingCounts* entered = &listing->entered[listing->depth];
+        long long files = listing->total.files - entered->files;
+        long long stagedFiles = listing->total.stagedFiles - entered->stagedFiles;
+        bool decided = stagedFiles > 0 && stagedFiles < files;
+        if (entry->type == WALK_FILE && !decided) {
+            listing->total.files++;
+            listing->total.stagedFiles += isListedPathStaged(listing, formattedPath);
+        }
+        return decided ? WALK_SKIP : WALK_CONTINUE;
+    }
+
+    if (entry->type == WALK_FILE) {
+        bool staged = isListedPathStaged(listing, formattedPath);
+        listing->total.files++;
+        listing->total.stagedFiles += staged;
+        printf("%s - %s\n", formattedPath, staged ? "Staged" : "Not Staged");
+    } else if (entry->type == WALK_DIRECTORY) {
+        if (isListedPathStaged(listing, formattedPath)) {
+            listing->total.files++;
+            listing->total.stagedFiles++;
+            printf("%s - Staged\n", formattedPath);
+            return WALK_SKIP;
+        }
+        if (entry->depth >= listing->enteredCapacity) {
+            int capacity = listing->enteredCapacity ? listing->enteredCapacity * 2 : 16;
+            while (capacity <= entry->depth) capacity *= 2;
+            ListingCounts* resized = realloc(listing->entered, capacity * sizeof(ListingCounts));
+            if (!resized) {
+                return WALK_STOP;
+            }
+            listing->entered = resized;
+            listing->enteredCapacity = capacity;
+        }
+        listing->entered[entry->depth] = listing->total;
+    }
+    return WALK_CONTINUE;
+}
+
+static void leaveListedDirectory(WalkEntry* directory, void* context) {
+    ListingContext* listing = context;
+    if (directory->depth > listing->depth) {
+        return;
+    }
+    const ListingCounts* entered = &listing->entered[directory->depth];
+    long long files = listing->total.files - entered->files;
+    long long stagedFiles = listing->total.stagedFiles - entered->stagedFiles;
+    // An empty directory has nothing staged in it.
+    const char* state = "Not Staged";
+    if (files > 0 && stagedFiles == files) {
+        state = "Staged";
+    } else if (stagedFiles > 0) {
+        state = "Partially Staged";
+    }
+    printf("%s - %s\n", relativeWorkTreePath(directory->path), state);
+}
+
+static void listDirectoryContents(const char* basePath, int depth, int currentLevel) {
+    if (depth < currentLevel) return;
+
+    ListingContext listing = {0};
+    listing.depth = depth - currentLevel + 1;
+    if (!loadIndexTable(&listing.index)) {
+        fprintf(stderr, "Error reading the staging area.\n");
+        return;
+    }
+    DirectoryWalker walker = { visitForListing, leaveListedDirectory, &listing, false };
+    zengitTraceBegin("walk");
+    walkDirectoryTree(basePath, "", &walker);
+    zengitTraceEnd();
+    free(listing.entered);
+    pathTableFree(&listing.index);
+}
+
+static void freeManifest(Manifest* manifest) {
+    free(manifest->entries);
+    arenaFree(&manifest->strings);
+    manifest->entries = NULL;
+    manifest->count = manifest->capacity = 0;
+}
+
+static bool addManifestEntry(Manifest* manifest, const char* path, uint64_t hash, long long size, bool hashed) {
+    if (manifest->count == manifest->capacity) {
+        int capacity = manifest->capacity ? manifest->capacity * 2 : 64;
+        ManifestEntry* resized = realloc(manifest->entries, capacity * sizeof(ManifestEntry));
+        if (!resized) {
+            return false;
+        }
+        manifest->entries = resized;
+        manifest->capacity = capacity;
+    }
+
+    ManifestEntry* entry = &manifest->entries[manifest->count];
+    entry->path = arenaStrdup(&manifest->strings, path);
+    if (!entry->path) {
+        return false;
+    }
+    entry->hash = hash;
+    entry->size = size;
+    entry->hashed = hashed;
+    manifest->count++;
+    return true;
+}
+
+static int compareManifestEntries(const void* a, const void* b) {
+    return strcmp(((const ManifestEntry*)a)->path, ((const ManifestEntry*)b)->path);
+}
+
+static void sortManifest(Manifest* manifest) {
+    qsort(manifest->entries, manifest->count, sizeof(ManifestEntry), compareManifestEntries);
+}
+
+static ManifestEntry* findManifestEntry(const Manifest* manifest, const char* path) {
+    ManifestEntry key = { (char*)path, 0, 0, false };
+    return bsearch(&key, manifest->entries, manifest->count, sizeof(ManifestEntry), compareManifestEntries);
+}
+
+typedef struct {
+    Manifest* manifest;
+    bool hashContents;
+    IgnoreRules* ignoreRules;
+} ManifestWalk;
+
+static WalkAction visitForManifest(WalkEntry* entry, void* context) {
+    ManifestWalk* walk = context;
+    if (strcmp(entry->name, ".zengit") == 0) return WALK_SKIP;
+
+    bool isDir = entry->type == WALK_DIRECTORY;
+    if (walk->ignoreRules && isPathIgnored(walk->ignoreRules, entry->relativePath, isDir)) return WALK_SKIP;
+
+    if (isDir) {
+        if (walk->ignoreRules) entry->mark = pushDirectoryIgnoreRules(walk->ignoreRules, entry->relativePath);
+    } else if (entry->type == WALK_FILE) {
+        uint64_t hash = 0;
+        long long size = (long long)entry->stat->st_size;
+        bool hashed = walk->hashContents && hashFileContents(entry->path, &hash, &size);
+        addManifestEntry(walk->manifest, entry->relativePath, hash, size, hashed);
+    }
+    return WALK_CONTINUE;
+}
+
+static void leaveManifestDirectory(WalkEntry* directory, void* context) {
+    ManifestWalk* walk = context;
+    if (walk->ignoreRules) popIgnoreRules(walk->ignoreRules, directory->mark);
+}
+
+static void collectManifestEntries(Manifest* manifest, const char* rootDir, const char* relativeDir, bool hashContents,
+                            IgnoreRules* ignoreRules) {
+    ManifestWalk walk = { manifest, hashContents, ignoreRules };
+    int savedRules = ignoreRules ? pushDirectoryIgnoreRules(ignoreRules, relativeDir) : 0;
+    DirectoryWalker walker = { visitForManifest, leaveManifestDirectory, &walk, true };
+    walkDirectoryTree(rootDir, relativeDir, &walker);
+    if (ignoreRules) popIgnoreRules(ignoreRules, savedRules);
+}
+
+// Lists every regular file under rootDir (excluding .zengit). Without hashContents only
+// sizes are recorded and hashes are filled in on demand by ensureManifestEntryHashed.
+static bool buildManifestFromDirectory(const char* rootDir, Manifest* manifest, bool hashContents) {
+    zengitTraceBegin("walk");
+    memset(manifest, 0, sizeof(*manifest));
+    collectManifestEntries(manifest, rootDir, "", hashContents, NULL);
+    sortManifest(manifest);
+    zengitTraceEnd();
+    return true;
+}
+
+// Per-directory listing cache for work tree scans. A directory whose mtime and effective
+// ignore rules match the cached record is listed from the cache instead of readdir; its
+// files are still stat'ed for their sizes.
+typedef struct {
+    long long mtime;
+    uint64_t rulesHash;
+    char** names;
+    bool* isDir;
+    int count;
+    int capacity;
+} CachedDirectory;
+
+typedef struct {
+    StringTable lookup; // relative directory -> index into directories
+    CachedDirectory* directories;
+    int count;
+    int capacity;
+    Arena names;        // names of cached and freshly listed entries, until the scan ends
+} UntrackedCache;
+
+typedef struct {
+    UntrackedCache cache;
+    FILE* out;
+    time_t scanStart;
+} WorkTreeScan;
+
+static uint64_t hashIgnoreRules(const IgnoreRules* rules) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (int i = 0; i < rules->count; i++) {
+        const IgnoreRule* rule = &rules->rules[i];
+        unsigned char flags = (rule->negated ? 1 : 0) | (rule->directoryOnly ? 2 : 0) | (rule->anchored ? 4 : 0);
+        hash = hashBytes(hash, &flags, 1);
+        hash = hashBytes(hash, (const unsigned char*)rule->pattern, strlen(rule->pattern) + 1);
+        hash = hashBytes(hash, (const unsigned char*)rule->base, strlen(rule->base) + 1);
+    }
+    return hash;
+}
+
+// The name is copied into strings, or borrowed as is when strings is NULL.
+static bool addCachedName(CachedDirectory* directory, const char* name, bool isDir, Arena* strings) {
+    if (directory->count == directory->capacity) {
+        int capacity = directory->capacity ? directory->capacity * 2 : 16;
+        char** names = realloc(directory->names, capacity * sizeof(char*));
+        if (!names) return false;
+        directory->names = names;
+        bool* flags = realloc(directory->isDir, capacity * sizeof(bool));
+        if (!flags) return false;
+        directory->isDir = flags;
+        directory->capacity = capacity;
+    }
+    directory->names[directory->count] = strings ? arenaStrdup(strings, name) : (char*)name;
+    if (!directory->names[directory->count]) return false;
+    directory->isDir[directory->count++] = isDir;
+    return true;
+}
+
+static void freeCachedDirectory(CachedDirectory* directory) {
+    free(directory->names);
+    free(directory->isDir);
+    memset(directory, 0, sizeof(*directory));
+}
+
+static void freeUntrackedCache(UntrackedCache* cache) {
+    for (int i = 0; i < cache->count; i++) freeCachedDirectory(&cache->directories[i]);
+    free(cache->directories);
+    stringTableFree(&cache->lookup);
+    arenaFree(&cache->names);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// File format: "D <mtime> <rules hash> <dir>" starts a directory ("." is the root), followed
+// by one "F <name>" or "S <name>" line per file or subdirectory that survived the ignore rules.
+static void loadUntrackedCache(UntrackedCache* cache) {
+    memset(cache, 0, sizeof(*cache));
+    stringTableInit(&cache->lookup, 0);
+    FILE* file = repoFopen(UNTRACKED_CACHE_FILE, "r");
+    if (!file) {
+        return;
+    }
+
+    char line[MAX_PATH_LENGTH + 64];
+    CachedDirectory* current = NULL;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+        long long mtime = 0;
+        uint64_t rulesHash = 0;
+        int offset = 0;
+        if (line[0] == 'D' && sscanf(line, "D %lld %" SCNx64 " %n", &mtime, &rulesHash, &offset) == 2 && line[offset]) {
+            if (cache->count == cache->capacity) {
+                int capacity = cache->capacity ? cache->capacity * 2 : 64;
+                CachedDirectory* resized = realloc(cache->directories, capacity * sizeof(CachedDirectory));
+                if (!resized) {
+                    ok = false;
+                    break;
+                }
+                cache->directories = resized;
+                cache->capacity = capacity;
+            }
+            const char* path = strcmp(line + offset, ".") == 0 ? "" : line + offset;
+            current = &cache->directories[cache->count];
+            memset(current, 0, sizeof(*current));
+            current->mtime = mtime;
+            current->rulesHash = rulesHash;
+            ok = stringTablePut(&cache->lookup, path, cache->count++);
+        } else if ((line[0] == 'F' || line[0] == 'S') && line[1] == ' ' && line[2] && current) {
+            ok = addCachedName(current, line + 2, line[0] == 'S', &cache->names);
+        } else {
+            ok = false;
+        }
+    }
+    fclose(file);
+
+    if (!ok) {
+        freeUntrackedCache(cache);
+        stringTableInit(&cache->lookup, 0);
+    }
+}
+
+typedef struct {
+    CachedDirectory* listing;
+    IgnoreRules* rules;
+    Arena* names;
+} ListingWalk;
+
+// One directory level: d_type decides between file and directory, so nothing is stat'ed here.
+static WalkAction visitForCachedListing(WalkEntry* entry, void* context) {
+    ListingWalk* walk = context;
+    bool isDir = entry->type == WALK_DIRECTORY;
+    if (entry->type != WALK_OTHER && strcmp(entry->name, ".zengit") != 0 && !isPathIgnored(walk->rules, entry->relativePath, isDir)) {
+        addCachedName(walk->listing, entry->name, isDir, walk->names);
+    }
+    return WALK_SKIP;
+}
+
+// Returns false when relativeDir is no longer a directory, which invalidates the parent's
+// cached listing.
+static bool collectCachedWorkTreeEntries(Manifest* manifest, const char* relativeDir, IgnoreRules* rules, WorkTreeScan* scan) {
+    const char* dirPath = relativeDir[0] ? relativeDir : ".";
+    struct stat dirStat;
+    traceCount(TRACE_STAT_CALLS, 1);
+    if (repoStat(dirPath, &dirStat) != 0 || !S_ISDIR(dirStat.st_mode)) {
+        return false;
+    }
+    int savedRules = pushDirectoryIgnoreRules(rules, relativeDir);
+    uint64_t rulesHash = hashIgnoreRules(rules);
+
+    const int* slot = stringTableFind(&scan->cache.lookup, relativeDir);
+    const CachedDirectory* cached = slot ? &scan->cache.directories[*slot] : NULL;
+    bool fromCache = cached && cached->mtime == (long long)dirStat.st_mtime && cached->rulesHash == rulesHash;
+    traceCount(fromCache ? TRACE_CACHE_HITS : TRACE_CACHE_MISSES, 1);
+
+    CachedDirectory listing;
+    memset(&listing, 0, sizeof(listing));
+    if (fromCache) {
+        // Each directory is visited once per scan, so the listing can borrow the cached names.
+        for (int i = 0; i < cached->count; i++) {
+            addCachedName(&listing, cached->names[i], cached->isDir[i], NULL);
+        }
+    } else {
+        ListingWalk walk = { &listing, rules, &scan->cache.names };
+        DirectoryWalker walker = { visitForCachedListing, NULL, &walk, false };
+        walkDirectoryTree(".", relativeDir, &walker);
+    }
+
+    // A directory changed within the second of this scan may change again without its
+    // mtime moving, so it is recorded as never matching.
+    bool racy = dirStat.st_mtime >= scan->scanStart;
+    ByteBuffer path;
+    memset(&path, 0, sizeof(path));
+    for (int i = 0; i < listing.count; i++) {
+        path.size = 0;
+        if (relativeDir[0] && (!appendBytes(&path, relativeDir, strlen(relativeDir)) || !appendBytes(&path, "/", 1))) break;
+        if (!appendBytes(&path, listing.names[i], strlen(listing.names[i]) + 1)) break;
+        // Excluded entries stay in the cached listing, so the cache still serves a full scan.
+        if (!isPathInSparseCheckout(path.data, listing.isDir[i])) continue;
+
+        bool present;
+        if (listing.isDir[i]) {
+            present = collectCachedWorkTreeEntries(manifest, path.data, rules, scan);
+        } else {
+            struct stat pathStat;
+            traceCount(TRACE_STAT_CALLS, 1);
+            present = repoStat(path.data, &pathStat) == 0 && S_ISREG(pathStat.st_mode);
+            if (present) addManifestEntry(manifest, path.data, 0, (long long)pathStat.st_size, false);
+        }
+        if (!present) {
+            racy = true;
+            listing.names[i][0] = '\0';
+        }
+    }
+    freeByteBuffer(&path);
+
+    if (scan->out) {
+        fprintf(scan->out, "D %lld %016" PRIx64 " %s\n", racy ? -1LL : (long long)dirStat.st_mtime, rulesHash, dirPath);
+        for (int i = 0; i < listing.count; i++) {
+            if (listing.names[i][0]) fprintf(scan->out, "%c %s\n", listing.isDir[i] ? 'S' : 'F', listing.names[i]);
+        }
+    }
+
+    freeCachedDirectory(&listing);
+    popIgnoreRules(rules, savedRules);
+    return true;
+}
+
+// Lists the work tree through the untracked cache and writes the refreshed cache back.
+static void scanWorkTree(Manifest* manifest) {
+    zengitTraceBegin("walk");
+    WorkTreeScan scan;
+    loadUntrackedCache(&scan.cache);
+    scan.scanStart = time(NULL);
+    char tempPath[MAX_PATH_LENGTH];
+    snprintf(tempPath, sizeof(tempPath), "%s.%ld.tmp", UNTRACKED_CACHE_FILE, (long)getpid());
+    scan.out = repoFopen(tempPath, "w");
+
+    IgnoreRules ignoreRules;
+    memset(&ignoreRules, 0, sizeof(ignoreRules));
+    loadIgnoreFile(&ignoreRules, GLOBAL_IGNORE_PATH, "");
+    memset(manifest, 0, sizeof(*manifest));
+    collectCachedWorkTreeEntries(manifest, "", &ignoreRules, &scan);
+    sortManifest(manifest);
+    freeIgnoreRules(&ignoreRules);
+    freeUntrackedCache(&scan.cache);
+
+    if (scan.out) {
+        if (fclose(scan.out) == 0) {
+            repoRename(tempPath, UNTRACKED_CACHE_FILE);
+        } else {
+            repoRemove(tempPath);
+        }
+    }
+    zengitTraceEnd();
+}
+
+// Token handed out by the fsmonitor daemon on the last query. saveFsMonitorState stores
+// it together with the manifest it describes so the next query only reports later changes.
+static char fsMonitorToken[64] = "";
+
+#ifdef __linux__
+// Fills a Unix socket address with path resolved against the repository root; false when
+// the result does not fit, in which case the socket is treated as absent.
+static bool setSocketPath(struct sockaddr_un* address, const char* path) {
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    return rooted && strlen(rooted) < sizeof(address->sun_path) && strcpy(address->sun_path, rooted);
+}
+
+static int connectFsMonitor(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_un address;
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (!setSocketPath(&address, FSMONITOR_SOCKET) || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one request line and reads the reply up to the point where the daemon closes the
+// connection. The reply is NUL-terminated.
+static bool fsMonitorRequest(const char* request, ByteBuffer* reply) {
+    memset(reply, 0, sizeof(*reply));
+    int fd = connectFsMonitor();
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t length = strlen(request);
+    bool ok = write(fd, request, length) == (ssize_t)length;
+    char chunk[4096];
+    ssize_t bytesRead = 0;
+    while (ok && (bytesRead = read(fd, chunk, sizeof(chunk))) > 0) {
+        ok = appendBytes(reply, chunk, (size_t)bytesRead);
+    }
+    close(fd);
+
+    ok = ok && bytesRead == 0 && appendBytes(reply, "", 1);
+    if (!ok) {
+        freeByteBuffer(reply);
+    }
+    return ok;
+}
+#else
+static bool fsMonitorRequest(const char* request, ByteBuffer* reply) {
+    (void)request;
+    memset(reply, 0, sizeof(*reply));
+    return false;
+}
+#endif
+
+// Asks the daemon what changed since token. On success fsMonitorToken holds the new token
+// and either *full is set or dirtyPaths lists every path touched since then.
+static bool queryFsMonitor(const char* token, char*** dirtyPaths, int* numDirty, bool* full) {
+    char request[128];
+    snprintf(request, sizeof(request), "QUERY %s\n", token[0] ? token : "-");
+    ByteBuffer reply;
+    fsMonitorToken[0] = '\0';
+    *dirtyPaths = NULL;
+    *numDirty = 0;
+    *full = false;
+    zengitTraceBegin("fsmonitor query");
+    bool answered = fsMonitorRequest(request, &reply);
+    zengitTraceEnd();
+    if (!answered) {
+        return false;
+    }
+
+    int capacity = 0;
+    bool complete = false;
+    char* saveState = NULL;
+    for (char* line = strtok_r(reply.data, "\n", &saveState); line; line = strtok_r(NULL, "\n", &saveState)) {
+        if (strncmp(line, "TOKEN ", 6) == 0) {
+            snprintf(fsMonitorToken, sizeof(fsMonitorToken), "%s", line + 6);
+        } else if (strcmp(line, "FULL") == 0) {
+            *full = true;
+        } else if (strncmp(line, "PATH ", 5) == 0) {
+            if (*numDirty == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                char** resized = realloc(*dirtyPaths, capacity * sizeof(char*));
+                if (!resized) break;
+                *dirtyPaths = resized;
+            }
+            (*dirtyPaths)[(*numDirty)++] = strdup(line + 5);
+        } else if (strcmp(line, "END") == 0) {
+            complete = true;
+        }
+    }
+    freeByteBuffer(&reply);
+
+    if (!complete || !fsMonitorToken[0]) {
+        for (int i = 0; i < *numDirty; i++) free((*dirtyPaths)[i]);
+        free(*dirtyPaths);
+        *dirtyPaths = NULL;
+        *numDirty = 0;
+        fsMonitorToken[0] = '\0';
+        return false;
+    }
+    return true;
+}
+
+static bool loadFsMonitorState(Manifest* manifest, char* token, size_t tokenSize) {
+    memset(manifest, 0, sizeof(*manifest));
+    FILE* file = repoFopen(FSMONITOR_STATE_FILE, "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[MAX_PATH_LENGTH + 64];
+    bool ok = fgets(line, sizeof(line), file) != NULL;
+    if (ok) {
+        line[strcspn(line, "\n")] = 0;
+        snprintf(token, tokenSize, "%s", line);
+    }
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+        int hashed = 0, offset = 0;
+        uint64_t hash = 0;
+        long long size = 0;
+        if (sscanf(line, "%d %" SCNx64 " %lld %n", &hashed, &hash, &size, &offset) != 3 || !line[offset]) {
+            ok = false;
+        } else {
+            ok = addManifestEntry(manifest, line + offset, hash, size, hashed != 0);
+        }
+    }
+    fclose(file);
+
+    if (!ok) {
+        freeManifest(manifest);
+    }
+    return ok;
+}
+
+// Persists the work tree manifest (including any hashes computed since it was built) under
+// the token it is valid for. Does nothing when no daemon answered the last query.
+static void saveFsMonitorState(const Manifest* manifest) {
+    if (!fsMonitorToken[0]) {
+        return;
+    }
+
+    char tempPath[MAX_PATH_LENGTH];
+    snprintf(tempPath, sizeof(tempPath), "%s.%ld.tmp", FSMONITOR_STATE_FILE, (long)getpid());
+    FILE* file = repoFopen(tempPath, "w");
+    if (!file) {
+        return;
+    }
+    fprintf(file, "%s\n", fsMonitorToken);
+    for (int i = 0; i < manifest->count; i++) {
+        const ManifestEntry* entry = &manifest->entries[i];
+        fprintf(file, "%d %016" PRIx64 " %lld %s\n", entry->hashed ? 1 : 0, entry->hash, entry->size, entry->path);
+    }
+    if (fclose(file) == 0) {
+        repoRename(tempPath, FSMONITOR_STATE_FILE);
+    } else {
+        repoRemove(tempPath);
+    }
+}
+
+static bool isUnderDirtyPath(const StringTable* dirty, const char* path) {
+    char prefix[MAX_PATH_LENGTH];
+    snprintf(prefix, sizeof(prefix), "%s", path);
+    for (;;) {
+        if (stringTableFind(dirty, prefix)) return true;
+        char* slash = strrchr(prefix, '/');
+        if (!slash) return false;
+        *slash = '\0';
+    }
+}
+
+// Brings a saved work tree manifest up to date by re-examining only the reported paths: a
+// dirty path drops every entry at or below it, then whatever exists there now is added back.
+// Returns false when the change set cannot be applied locally (an ignore file changed).
+static bool applyFsMonitorChanges(Manifest* manifest, char** dirtyPaths, int numDirty) {
+    StringTable dirty;
+    if (!stringTableInit(&dirty, numDirty)) {
+        return false;
+    }
+    for (int i = 0; i < numDirty; i++) {
+        const char* name = strrchr(dirtyPaths[i], '/');
+        name = name ? name + 1 : dirtyPaths[i];
+        if (strcmp(name, IGNORE_FILE_NAME) == 0 || !stringTablePut(&dirty, dirtyPaths[i], i)) {
+            stringTableFree(&dirty);
+            return false;
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < manifest->count; i++) {
+        if (!isUnderDirtyPath(&dirty, manifest->entries[i].path)) {
+            manifest->entries[kept++] = manifest->entries[i];
+        }
+    }
+    manifest->count = kept;
+    stringTableFree(&dirty);
+
+    for (int i = 0; i < numDirty; i++) {
+        const char* path = dirtyPaths[i];
+        struct stat pathStat;
+        if (repoStat(path, &pathStat) != 0) continue;
+
+        char parent[MAX_PATH_LENGTH] = "";
+        const char* lastSlash = strrchr(path, '/');
+        if (lastSlash) {
+            snprintf(parent, sizeof(parent), "%.*s", (int)(lastSlash - path), path);
+        }
+        IgnoreRules rules;
+        initIgnoreRules(&rules, parent);
+        if (parent[0]) pushDirectoryIgnoreRules(&rules, parent);
+
+        if (!isPathIgnored(&rules, path, S_ISDIR(pathStat.st_mode))) {
+            if (S_ISDIR(pathStat.st_mode)) {
+                collectManifestEntries(manifest, ".", path, false, &rules);
+            } else if (S_ISREG(pathStat.st_mode)) {
+                addManifestEntry(manifest, path, 0, (long long)pathStat.st_size, false);
+            }
+        }
+        freeIgnoreRules(&rules);
+    }
+
+    // A directory and a file inside it can both be dirty; keep one entry per path.
+    sortManifest(manifest);
+    kept = 0;
+    for (int i = 0; i < manifest->count; i++) {
+        if (kept == 0 || strcmp(manifest->entries[kept - 1].path, manifest->entries[i].path) != 0) {
+            manifest->entries[kept++] = manifest->entries[i];
+        }
+    }
+    manifest->count = kept;
+    return true;
+}
+
+// Builds the work tree manifest from the saved state plus the fsmonitor's change list.
+// Returns false without touching the disk when no daemon is running; if the daemon cannot
+// vouch for the saved state the tree is scanned in full instead.
+static bool buildMonitoredWorkTreeManifest(Manifest* manifest) {
+    char savedToken[64] = "";
+    Manifest saved;
+    bool haveState = loadFsMonitorState(&saved, savedToken, sizeof(savedToken));
+
+    char** dirtyPaths;
+    int numDirty;
+    bool full;
+    if (!queryFsMonitor(haveState ? savedToken : "", &dirtyPaths, &numDirty, &full)) {
+        if (haveState) freeManifest(&saved);
+        return false;
+    }
+
+    if (haveState && !full && applyFsMonitorChanges(&saved, dirtyPaths, numDirty)) {
+        traceCount(TRACE_CACHE_HITS, 1);
+        *manifest = saved;
+    } else {
+        traceCount(TRACE_CACHE_MISSES, 1);
+        if (haveState) freeManifest(&saved);
+        scanWorkTree(manifest);
+    }
+
+    for (int i = 0; i < numDirty; i++) free(dirtyPaths[i]);
+    free(dirtyPaths);
+    return true;
+}
+
+// Same as buildManifestFromDirectory for the work tree, minus everything .zengitignore
+// or the sparse checkout excludes. Ignored and excluded directories are never opened.
+static bool buildWorkTreeManifest(Manifest* manifest) {
+    bool sparse = refreshSparseCheckout();
+    if (!buildMonitoredWorkTreeManifest(manifest)) {
+        scanWorkTree(manifest);
+    } else if (sparse) {
+        filterSparseManifest(manifest);
+    }
+    return true;
+}
+
+#ifdef __linux__
+#define FSMONITOR_EVENT_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+                              IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct {
+    int inotifyFd;
+    char** watchPaths; // relative directory per watch descriptor
+    int watchCapacity;
+    int numWatches;
+    bool complete;
+    StringTable dirty; // path -> sequence number of its latest change
+    int sequence;
+    int overflowSequence; // tokens older than this get a FULL answer
+    char instance[32];
+} FsMonitor;
+
+static bool addFsMonitorWatch(FsMonitor* monitor, const char* path, const char* relativeDir) {
+    int wd = inotify_add_watch(monitor->inotifyFd, path, FSMONITOR_EVENT_MASK);
+    if (wd < 0) {
+        return false;
+    }
+    if (wd >= monitor->watchCapacity) {
+        int capacity = monitor->watchCapacity ? monitor->watchCapacity : 64;
+        while (capacity <= wd) capacity *= 2;
+        char** resized = realloc(monitor->watchPaths, capacity * sizeof(char*));
+        if (!resized) return false;
+        memset(resized + monitor->watchCapacity, 0, (capacity - monitor->watchCapacity) * sizeof(char*));
+        monitor->watchPaths = resized;
+        monitor->watchCapacity = capacity;
+    }
+    if (!monitor->watchPaths[wd]) monitor->numWatches++;
+    free(monitor->watchPaths[wd]);
+    monitor->watchPaths[wd] = strdup(relativeDir);
+    return monitor->watchPaths[wd] != NULL;
+}
+
+typedef struct {
+    FsMonitor* monitor;
+    IgnoreRules* rules;
+    bool ok;
+} WatchWalk;
+
+static WalkAction visitForWatches(WalkEntry* entry, void* context) {
+    WatchWalk* walk = context;
+    if (entry->type != WALK_DIRECTORY || isPathIgnored(walk->rules, entry->relativePath, true)) {
+        return WALK_SKIP;
+    }
+    if (!addFsMonitorWatch(walk->monitor, entry->path, entry->relativePath)) {
+        walk->ok = false;
+        return WALK_STOP;
+    }
+    entry->mark = pushDirectoryIgnoreRules(walk->rules, entry->relativePath);
+    return WALK_CONTINUE;
+}
+
+static void leaveWatchedDirectory(WalkEntry* directory, void* context) {
+    popIgnoreRules(((WatchWalk*)context)->rules, directory->mark);
+}
+
+static bool addFsMonitorWatches(FsMonitor* monitor, const char* relativeDir, IgnoreRules* rules) {
+    if (!addFsMonitorWatch(monitor, relativeDir[0] ? relativeDir : ".", relativeDir)) {
+        return false;
+    }
+    WatchWalk walk = { monitor, rules, true };
+    int savedRules = pushDirectoryIgnoreRules(rules, relativeDir);
+    DirectoryWalker walker = { visitForWatches, leaveWatchedDirectory, &walk, false };
+    walkDirectoryTree(".", relativeDir, &walker);
+    popIgnoreRules(rules, savedRules);
+    return walk.ok;
+}
+
+static void resetFsMonitorChanges(FsMonitor* monitor) {
+    stringTableFree(&monitor->dirty);
+    stringTableInit(&monitor->dirty, 0);
+    monitor->overflowSequence = ++monitor->sequence;
+}
+
+// Drops every watch and rebuilds the set from the current tree and ignore rules. Used at
+// startup and whenever the directory layout changed in a way paths cannot follow.
+static void rewatchFsMonitor(FsMonitor* monitor) {
+    if (monitor->inotifyFd >= 0) close(monitor->inotifyFd);
+    for (int i = 0; i < monitor->watchCapacity; i++) {
+        free(monitor->watchPaths[i]);
+        monitor->watchPaths[i] = NULL;
+    }
+    monitor->numWatches = 0;
+
+    monitor->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    IgnoreRules rules;
+    memset(&rules, 0, sizeof(rules));
+    loadIgnoreFile(&rules, GLOBAL_IGNORE_PATH, "");
+    monitor->complete = monitor->inotifyFd >= 0 && addFsMonitorWatches(monitor, "", &rules);
+    freeIgnoreRules(&rules);
+    resetFsMonitorChanges(monitor);
+}
+
+static void recordFsMonitorEvent(FsMonitor* monitor, const struct inotify_event* event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        resetFsMonitorChanges(monitor);
+        return;
+    }
+    if (event->wd < 0 || event->wd >= monitor->watchCapacity || !monitor->watchPaths[event->wd]) {
+        return;
+    }
+    if (event->mask & IN_IGNORED) {
+        free(monitor->watchPaths[event->wd]);
+        monitor->watchPaths[event->wd] = NULL;
+        monitor->numWatches--;
+        return;
+    }
+    if (event->mask & IN_MOVE_SELF) {
+        // Watches below a moved directory still carry the old paths.
+        rewatchFsMonitor(monitor);
+        return;
+    }
+    if (event->len == 0) {
+        return;
+    }
+
+    const char* dir = monitor->watchPaths[event->wd];
+    char relativePath[MAX_PATH_LENGTH];
+    if (dir[0]) {
+        snprintf(relativePath, sizeof(relativePath), "%s/%s", dir, event->name);
+    } else {
+        snprintf(relativePath, sizeof(relativePath), "%s", event->name);
+    }
+    if (strcmp(event->name, IGNORE_FILE_NAME) == 0) {
+        // Which directories are watched depends on the ignore rules.
+        rewatchFsMonitor(monitor);
+        return;
+    }
+
+    monitor->sequence++;
+    if (monitor->dirty.count >= FSMONITOR_MAX_DIRTY || !stringTablePut(&monitor->dirty, relativePath, monitor->sequence)) {
+        resetFsMonitorChanges(monitor);
+    }
+
+    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR)) {
+        IgnoreRules rules;
+        initIgnoreRules(&rules, dir);
+        if (dir[0]) pushDirectoryIgnoreRules(&rules, dir);
+        if (!isPathIgnored(&rules, relativePath, true) && !addFsMonitorWatches(monitor, relativePath, &rules)) {
+            monitor->complete = false;
+        }
+        freeIgnoreRules(&rules);
+    }
+}
+
+static void drainFsMonitorEvents(FsMonitor* monitor) {
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t length = read(monitor->inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            return;
+        }
+        for (char* cursor = buffer; cursor < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)cursor;
+            cursor += sizeof(struct inotify_event) + event->len;
+            int fdBefore = monitor->inotifyFd;
+            recordFsMonitorEvent(monitor, event);
+            if (monitor->inotifyFd != fdBefore) {
+                // Rewatched: the rest of this buffer refers to the old descriptor.
+                break;
+            }
+        }
+    }
+}
+
+static void answerFsMonitorQuery(FsMonitor* monitor, const char* token, FILE* out) {
+    const char* colon = strrchr(token, ':');
+    bool sameInstance = colon && (size_t)(colon - token) == strlen(monitor->instance) &&
+                        strncmp(token, monitor->instance, colon - token) == 0;
+    int since = sameInstance ? atoi(colon + 1) : -1;
+
+    fprintf(out, "TOKEN %s:%d\n", monitor->instance, monitor->sequence);
+    if (!monitor->complete || since < monitor->overflowSequence) {
+        fprintf(out, "FULL\n");
+    } else {
+        for (int i = 0; i < monitor->dirty.capacity; i++) {
+            if (monitor->dirty.keys[i] && monitor->dirty.values[i] > since) {
+                fprintf(out, "PATH %s\n", monitor->dirty.keys[i]);
+            }
+        }
+    }
+    fprintf(out, "END\n");
+}
+
+// Serves one connection. Pending inotify events are folded in first so a change made just
+// before the query is never missed. Returns false on STOP.
+static bool handleFsMonitorClient(FsMonitor* monitor, int client) {
+    struct timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[256];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+        ssize_t bytesRead = read(client, request + length, sizeof(request) - 1 - length);
+        if (bytesRead <= 0) break;
+        length += (size_t)bytesRead;
+        if (memchr(request, '\n', length)) break;
+    }
+    request[length] = '\0';
+    request[strcspn(request, "\r\n")] = 0;
+
+    drainFsMonitorEvents(monitor);
+
+    FILE* out = fdopen(dup(client), "w");
+    if (!out) {
+        return true;
+    }
+    bool keepRunning = true;
+    if (strncmp(request, "QUERY ", 6) == 0) {
+        answerFsMonitorQuery(monitor, request + 6, out);
+    } else if (strcmp(request, "STATUS") == 0) {
+        fprintf(out, "Watching %d directories, %d changed paths tracked%s\n", monitor->numWatches,
+                monitor->dirty.count, monitor->complete ? "" : " (incomplete, answering FULL)");
+    } else if (strcmp(request, "STOP") == 0) {
+        fprintf(out, "Stopped\n");
+        keepRunning = false;
+    }
+    fclose(out);
+    return keepRunning;
+}
+
+static void runFsMonitorDaemon(int listenFd) {
+    FsMonitor monitor;
+    memset(&monitor, 0, sizeof(monitor));
+    monitor.inotifyFd = -1;
+    snprintf(monitor.instance, sizeof(monitor.instance), "%ld-%ld", (long)getpid(), (long)time(NULL));
+    stringTableInit(&monitor.dirty, 0);
+    rewatchFsMonitor(&monitor);
+
+    bool running = true;
+    while (running) {
+        struct pollfd fds[2] = { { monitor.inotifyFd, POLLIN, 0 }, { listenFd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            drainFsMonitorEvents(&monitor);
+        }
+        if (fds[1].revents & POLLIN) {
+            int client = accept(listenFd, NULL, NULL);
+            if (client >= 0) {
+                running = handleFsMonitorClient(&monitor, client);
+                close(client);
+            }
+        }
+    }
+
+    repoUnlink(FSMONITOR_SOCKET);
+    close(listenFd);
+    if (monitor.inotifyFd >= 0) close(monitor.inotifyFd);
+    for (int i = 0; i < monitor.watchCapacity; i++) free(monitor.watchPaths[i]);
+    free(monitor.watchPaths);
+    stringTableFree(&monitor.dirty);
+}
+
+static bool startFsMonitor(void) {
+    ByteBuffer reply;
+    if (fsMonitorRequest("STATUS\n", &reply)) {
+        freeByteBuffer(&reply);
+        printf("fsmonitor is already running.\n");
+        return true;
+    }
+    repoUnlink(FSMONITOR_SOCKET);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address;
+    if (listenFd < 0 || !setSocketPath(&address, FSMONITOR_SOCKET) ||
+        bind(listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 16) != 0) {
+        perror("Failed to create fsmonitor socket");
+        if (listenFd >= 0) close(listenFd);
+        return false;
+    }
+
+    // The socket is listening before the fork, so clients that connect while the
+    // daemon is still setting up its watches simply wait in the backlog.
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Failed to start fsmonitor");
+        close(listenFd);
+        repoUnlink(FSMONITOR_SOCKET);
+        return false;
+    }
+    if (pid == 0) {
+        setsid();
+        stopTracing();
+        signal(SIGPIPE, SIG_IGN);
+        int devNull = open("/dev/null", O_RDWR);
+        if (devNull >= 0) {
+            dup2(devNull, STDIN_FILENO);
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            if (devNull > STDERR_FILENO) close(devNull);
+        }
+        runFsMonitorDaemon(listenFd);
+        _exit(0);
+    }
+
+    close(listenFd);
+    printf("fsmonitor started (pid %ld).\n", (long)pid);
+    return true;
+}
+
+static bool handleFsMonitorCommand(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s fsmonitor start|stop|status\n", argv[0]);
+        return false;
+    }
+
+    ByteBuffer reply;
+    if (strcmp(argv[2], "start") == 0) {
+        return startFsMonitor();
+    } else if (strcmp(argv[2], "stop") == 0) {
+        if (!fsMonitorRequest("STOP\n", &reply)) {
+            printf("fsmonitor is not running.\n");
+            return false;
+        }
+        freeByteBuffer(&reply);
+        printf("fsmonitor stopped.\n");
+        return true;
+    } else if (strcmp(argv[2], "status") == 0) {
+        if (!fsMonitorRequest("STATUS\n", &reply)) {
+            printf("fsmonitor is not running.\n");
+            return false;
+        }
+        printf("fsmonitor is running. %s", reply.data);
+        freeByteBuffer(&reply);
+        return true;
+    }
+    fprintf(stderr, "Usage: %s fsmonitor start|stop|status\n", argv[0]);
+    return false;
+}
+#else
+static bool handleFsMonitorCommand(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+    fprintf(stderr, "fsmonitor is only supported on Linux; status and diff scan the work tree instead.\n");
+    return false;
+}
+#endif
+
+// sparse set|add <dir>... rewrites or extends the pattern file, sparse disable removes it.
+// The work tree follows on the next checkout. The fsmonitor state saved under the old
+// patterns may lack files the new ones include, so it is dropped.
+static bool handleSparseCommand(int argc, char* argv[]) {
+    const char* action = argc >= 3 ? argv[2] : "";
+    if (strcmp(action, "list") == 0 && argc == 3) {
+        FILE* file = repoFopen(SPARSE_CHECKOUT_FILE, "r");
+        if (!file) {
+            printf("Sparse checkout is disabled.\n");
+            return true;
+        }
+        char line[MAX_PATH_LENGTH];
+        while (fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] && line[0] != '#') printf("%s\n", line);
+        }
+        fclose(file);
+        return true;
+    }
+
+    if (strcmp(action, "disable") == 0 && argc == 3) {
+        if (repoRemove(SPARSE_CHECKOUT_FILE) != 0 && errno != ENOENT) {
+            perror("Failed to remove the sparse checkout file");
+            return false;
+        }
+        repoRemove(FSMONITOR_STATE_FILE);
+        printf("Sparse checkout disabled; check out a commit to restore the full tree.\n");
+        return true;
+    }
+
+    if ((strcmp(action, "set") != 0 && strcmp(action, "add") != 0) || argc < 4) {
+        fprintf(stderr, "Usage: %s sparse set|add <directory>... | list | disable\n", argv[0]);
+        return false;
+    }
+    for (int i = 3; i < argc; i++) {
+        if (strstr(argv[i], "..")) {
+            fprintf(stderr, "Error: sparse checkout directories must stay inside the repository: %s\n", argv[i]);
+            return false;
+        }
+    }
+
+    FILE* file = repoFopen(SPARSE_CHECKOUT_FILE, strcmp(action, "set") == 0 ? "w" : "a");
+    if (!file) {
+        perror("Failed to write the sparse checkout file");
+        return false;
+    }
+    for (int i = 3; i < argc; i++) {
+        const char* directory = relativeWorkTreePath(argv[i]);
+        size_t length = strlen(directory);
+        while (length > 0 && directory[length - 1] == '/') length--;
+        if (length == 0) {
+            directory = ".";
+            length = 1;
+        }
+        fprintf(file, "%.*s\n", (int)length, directory);
+    }
+    if (fclose(file) != 0) {
+        perror("Failed to write the sparse checkout file");
+        return false;
+    }
+    repoRemove(FSMONITOR_STATE_FILE);
+    printf("Sparse checkout updated; check out a commit to apply it.\n");
+    return true;
+}
+
+static bool ensureManifestEntryHashed(ManifestEntry* entry, const char* rootDir) {
+    if (entry->hashed) {
+        return true;
+    }
+
+    char fullPath[MAX_PATH_LENGTH];
+    entry->hashed = formatPath(fullPath, sizeof(fullPath), "%s/%s", rootDir, entry->path) &&
+                    hashFileContents(fullPath, &entry->hash, &entry->size);
+    return entry->hashed;
+}
+
+static bool writeManifest(const char* manifestPath, const Manifest* manifest) {
+    FILE* file = repoFopen(manifestPath, "w");
+    if (!file) {
+        perror("Failed to write manifest");
+        return false;
+    }
+
+    zengitTraceBegin("manifest write");
+    for (int i = 0; i < manifest->count; i++) {
+        const ManifestEntry* entry = &manifest->entries[i];
+        fprintf(file, "%016" PRIx64 " %lld %s\n", entry->hash, entry->size, entry->path);
+    }
+    traceCount(TRACE_BYTES_WRITTEN, (uint64_t)ftell(file));
+
+    fclose(file);
+    zengitTraceEnd();
+    return true;
+}
+
+static bool readManifest(const char* manifestPath, Manifest* manifest) {
+    memset(manifest, 0, sizeof(*manifest));
+    FILE* file = repoFopen(manifestPath, "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[MAX_PATH_LENGTH + 64];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+
+        uint64_t hash;
+        long long size;
+        int pathOffset = 0;
+        if (sscanf(line, "%" SCNx64 " %lld %n", &hash, &size, &pathOffset) == 2 && pathOffset > 0) {
+            addManifestEntry(manifest, line + pathOffset, hash, size, true);
+        }
+    }
+
+    fclose(file);
+    sortManifest(manifest);
+    return true;
+}
+
+// Commits written before manifests existed get one built from their snapshot directory
+// the first time they are needed.
+static bool loadCommitManifest(const char* commitId, Manifest* manifest) {
+    char manifestPath[MAX_PATH_LENGTH];
+    snprintf(manifestPath, sizeof(manifestPath), "%s/%s%s", COMMIT_DIR, commitId, MANIFEST_SUFFIX);
+    zengitTraceBegin("manifest load");
+    bool loaded = readManifest(manifestPath, manifest);
+    zengitTraceEnd();
+    if (loaded) {
+        return true;
+    }
+
+    char commitDirPath[MAX_PATH_LENGTH];
+    snprintf(commitDirPath, sizeof(commitDirPath), "%s/%s", COMMIT_DIR, commitId);
+    struct stat dirStat;
+    if (repoStat(commitDirPath, &dirStat) != 0 || !S_ISDIR(dirStat.st_mode)) {
+        return false;
+    }
+
+    buildManifestFromDirectory(commitDirPath, manifest, true);
+    writeManifest(manifestPath, manifest);
+    return true;
+}
+
+static char* getLastCommitId(const char* branchName);
+
+static void loadCommitUserName(char* userName, size_t size) {
+    const char* name = configGet("user.name");
+    snprintf(userName, size, "%s", name ? name : "Unknown");
+}
+
+static bool recordCommitAs(const char* userName, const char* commitID, const char* message, int filesCommitted);
+
+static bool recordCommit(const char* commitID, const char* message, int filesCommitted) {
+    char userName[256];
+    loadCommitUserName(userName, sizeof(userName));
+    return recordCommitAs(userName, commitID, message, filesCommitted);
+}
+
+static bool recordCommitAs(const char* userName, const char* commitID, const char* message, int filesCommitted) {
+
+
+    char currentBranch[256] = {0};
+    strncpy(currentBranch, getCurrentBranch(), sizeof(currentBranch) - 1);
+
+
+    char logFilePath[MAX_PATH_LENGTH];
+    snprintf(logFilePath, sizeof(logFilePath), ".zengit/logs");
+    FILE* logFile = repoFopen(logFilePath, "a");
+    if (logFile) {
+        time_t now = time(NULL);
+        fprintf(logFile, "Date: %sUser: %s\nCommit ID: %s\nBranch: %s\nMessage: %s\nFiles Committed: %d\n\n",
+                ctime(&now), userName, commitID, currentBranch, message, filesCommitted);
+        fclose(logFile);
+    } else {
+        perror("Failed to write to log file");
+    }
+
+    char branchHeadFilePath[MAX_PATH_LENGTH];
+    snprintf(branchHeadFilePath, sizeof(branchHeadFilePath), "%s/%s_HEAD", COMMIT_DIR, currentBranch);
+    FILE* branchHeadFile = repoFopen(branchHeadFilePath, "a");
+    if (branchHeadFile) {
+        fprintf(branchHeadFile, "%s\n", commitID);
+        fclose(branchHeadFile);
+    } else {
+        perror("Failed to update branch HEAD");
+        return false;
+    }
+    return true;
+}
+
+// Parents are implied by the order of commits in each <branch>_HEAD file; only merge
+// commits, which have a second parent, need this file.
+static void writeCommitParents(const char* commitID, const char* firstParent, const char* secondParent) {
+    char parentsPath[MAX_PATH_LENGTH];
+    snprintf(parentsPath, sizeof(parentsPath), "%s/%s%s", COMMIT_DIR, commitID, PARENTS_SUFFIX);
+    FILE* file = repoFopen(parentsPath, "w");
+    if (!file) {
+        perror("Failed to record commit parents");
+        return;
+    }
+    if (firstParent && firstParent[0]) fprintf(file, "%s\n", firstParent);
+    if (secondParent && secondParent[0]) fprintf(file, "%s\n", secondParent);
+    fclose(file);
+}
+
+static bool hasStagedChanges(void) {
+    return fileExists(INDEX_FILE) && !isFileEmpty(INDEX_FILE);
+}
+
+static void linkOrCopyFile(const char* srcPath, const char* destPath);
+
+// Under a sparse checkout the excluded files cannot be staged, so a commit takes them from
+// its parent: linked, not copied, with the parent's hashes. manifest holds the staged files,
+// sorted, and gets the carried ones added.
+static void carrySparseExcludedFiles(const char* parentCommitId, const char* commitDirPath, Manifest* manifest) {
+    Manifest parent;
+    if (!parentCommitId[0] || !refreshSparseCheckout() || !loadCommitManifest(parentCommitId, &parent)) {
+        return;
+    }
+    // Decided before anything is added, while manifest is still sorted.
+    bool* carry = malloc(parent.count + 1);
+    for (int i = 0; carry && i < parent.count; i++) {
+        const char* path = parent.entries[i].path;
+        carry[i] = !isPathInSparseCheckout(path, false) && !findManifestEntry(manifest, path);
+    }
+    for (int i = 0; carry && i < parent.count; i++) {
+        const ManifestEntry* entry = &parent.entries[i];
+        if (!carry[i]) continue;
+
+        char srcPath[MAX_PATH_LENGTH], destPath[MAX_PATH_LENGTH];
+        snprintf(srcPath, sizeof(srcPath), "%s/%s/%s", COMMIT_DIR, parentCommitId, entry->path);
+        snprintf(destPath, sizeof(destPath), "%s/%s", commitDirPath, entry->path);
+        linkOrCopyFile(srcPath, destPath);
+        addManifestEntry(manifest, entry->path, entry->hash, entry->size, true);
+    }
+    free(carry);
+    freeManifest(&parent);
+    sortManifest(manifest);
+}
+
+// Snapshots the staged paths as a new commit on the current branch and clears the index.
+// The caller checks hasStagedChanges first; commitID must hold 41 characters.
+static bool createCommit(const char* message, const char* userName, char* commitID, int* filesCommitted) {
+    generateCommitID(commitID, 41);
+
+    char parentCommitId[MAX_PATH_LENGTH] = {0};
+    char* lastCommitId = getLastCommitId(getCurrentBranch());
+    if (lastCommitId) {
+        snprintf(parentCommitId, sizeof(parentCommitId), "%s", lastCommitId);
+    }
+
+    char commitDirPath[MAX_PATH_LENGTH];
+    snprintf(commitDirPath, sizeof(commitDirPath), "%s/%s", COMMIT_DIR, commitID);
+    ensureDirectoryExists(commitDirPath);
+    copyStagedFilesToCommitDir(commitDirPath, INDEX_FILE);
+
+    *filesCommitted = countFilesInCommitDir(commitDirPath);
+
+    Manifest manifest;
+    char manifestPath[MAX_PATH_LENGTH + sizeof(MANIFEST_SUFFIX)];
+    snprintf(manifestPath, sizeof(manifestPath), "%s%s", commitDirPath, MANIFEST_SUFFIX);
+    buildManifestFromDirectory(commitDirPath, &manifest, true);
+    carrySparseExcludedFiles(parentCommitId, commitDirPath, &manifest);
+    writeManifest(manifestPath, &manifest);
+    freeManifest(&manifest);
+
+    if (!recordCommitAs(userName, commitID, message, *filesCommitted)) {
+        return false;
+    }
+
+    if (fileExists(MERGE_HEAD_FILE)) {
+        char mergeHead[MAX_PATH_LENGTH] = {0};
+        FILE* mergeHeadFile = repoFopen(MERGE_HEAD_FILE, "r");
+        if (mergeHeadFile) {
+            if (fgets(mergeHead, sizeof(mergeHead), mergeHeadFile)) {
+                mergeHead[strcspn(mergeHead, "\n")] = 0;
+            }
+            fclose(mergeHeadFile);
+        }
+        if (mergeHead[0]) {
+            writeCommitParents(commitID, parentCommitId, mergeHead);
+        }
+        repoRemove(MERGE_HEAD_FILE);
+    }
+
+    clearIndexFile(INDEX_FILE);
+    return true;
+}
+
+static bool commitChanges(const char* message) {
+    if (!hasStagedChanges()) {
+        printf("No files staged for commit.\n");
+        return false;
+    }
+
+    char commitID[41];
+    char userName[256];
+    int filesCommitted;
+    loadCommitUserName(userName, sizeof(userName));
+    if (!createCommit(message, userName, commitID, &filesCommitted)) {
+        return false;
+    }
+    printf("Commit successful [ID: %s]. Index cleared.\n", commitID);
+    return true;
+}
+
+// Shortcuts. .zengit/shortcuts keeps its "name=message" lines but is only appended to:
+// replacing or removing a shortcut overwrites the first byte of its line with '#' and, for a
+// replacement, appends the new line. .zengit/shortcuts.index is an open-addressing table on
+// disk from name hash to line offset, so a lookup reads a slot or two and one line however
+// many shortcuts there are. The index records the signature of the lines it describes and
+// is rebuilt from them when that no longer matches. Once tombstoned lines outweigh the live
+// ones, a background process rewrites the file without them. Every operation holds an
+// exclusive lock on .zengit/shortcuts.lock.
+typedef struct {
+    char magic[4];
+    uint32_t capacity;             // slots, a power of two
+    uint32_t live;
+    uint32_t used;                 // live and deleted slots
+    uint64_t liveBytes;
+    uint64_t deadBytes;            // tombstoned lines
+    FileSignature data;
+} ShortcutIndexHeader;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;               // line offset + 1; 0 when empty
+} ShortcutSlot;
+
+typedef struct {
+    int lockFd;
+    FILE* data;
+    int indexFd;
+    ShortcutIndexHeader header;
+} ShortcutStore;
+
+static bool isValidShortcut(const char* name, const char* message) {
+    if (name[0] == '\0' || name[0] == SHORTCUT_TOMBSTONE || strpbrk(name, "=\n") ||
+        (message && strchr(message, '\n'))) {
+        fprintf(stderr, "Error: Shortcut names cannot be empty, start with '%c' or contain '=' or newlines, "
+                "and messages cannot contain newlines.\n", SHORTCUT_TOMBSTONE);
+        return false;
+    }
+    return true;
+}
+
+static long long shortcutSlotOffset(uint32_t slot) {
+    return (long long)sizeof(ShortcutIndexHeader) + (long long)slot * (long long)sizeof(ShortcutSlot);
+}
+
+static bool readShortcutSlot(const ShortcutStore* store, uint32_t slot, ShortcutSlot* value) {
+    return readFileAt(store->indexFd, value, sizeof(*value), shortcutSlotOffset(slot)) == (ssize_t)sizeof(*value);
+}
+
+static bool writeShortcutSlot(const ShortcutStore* store, uint32_t slot, const ShortcutSlot* value) {
+    return writeFileAt(store->indexFd, value, sizeof(*value), shortcutSlotOffset(slot)) == (ssize_t)sizeof(*value);
+}
+
+// Records the data file's current signature, which marks the index as describing it.
+static bool writeShortcutHeader(ShortcutStore* store) {
+    fflush(store->data);
+    store->header.data = readFileSignature(SHORTCUTS_FILE);
+    return writeFileAt(store->indexFd, &store->header, sizeof(store->header), 0) == (ssize_t)sizeof(store->header);
+}
+
+// Reads the next line, newline included, however long it is. line->size is its length and
+// the data is NUL-terminated. False at the end of the file or when memory runs out.
+static bool readShortcutRecord(FILE* data, ByteBuffer* line) {
+    char chunk[MAX_LINE_LENGTH];
+    line->size = 0;
+    while (fgets(chunk, sizeof(chunk), data)) {
+        size_t length = strlen(chunk);
+        if (!appendBytes(line, chunk, length + 1)) {
+            return false;
+        }
+        line->size--;
+        if (length > 0 && chunk[length - 1] == '\n') {
+            break;
+        }
+    }
+    return line->size > 0;
+}
+
+// Reads the line at offset without its newline; false for a tombstone or a bad offset.
+static bool readShortcutLine(ShortcutStore* store, uint64_t offset, ByteBuffer* line) {
+    if (fseek(store->data, (long)offset, SEEK_SET) != 0 || !readShortcutRecord(store->data, line)) {
+        return false;
+    }
+    traceCount(TRACE_BYTES_READ, line->size);
+    if (line->data[line->size - 1] == '\n') {
+        line->data[--line->size] = '\0';
+    }
+    return line->data[0] != SHORTCUT_TOMBSTONE && strchr(line->data, '=') != NULL;
+}
+
+static bool shortcutLineHasName(const char* line, const char* name) {
+    size_t length = strlen(name);
+    return strncmp(line, name, length) == 0 && line[length] == '=';
+}
+
+// Returns the slot holding name, or with *found false the slot to insert it into.
+static bool findShortcutSlot(ShortcutStore* store, const char* name, uint64_t hash, uint32_t* slot, bool* found,
+                      ByteBuffer* line) {
+    uint32_t mask = store->header.capacity - 1;
+    uint32_t insertAt = UINT32_MAX;
+    *found = false;
+    for (uint32_t i = (uint32_t)hash & mask, probes = 0; probes < store->header.capacity; i = (i + 1) & mask, probes++) {
+        ShortcutSlot value;
+        if (!readShortcutSlot(store, i, &value)) {
+            return false;
+        }
+        if (value.offset == 0) {
+            *slot = insertAt != UINT32_MAX ? insertAt : i;
+            return true;
+        }
+        if (value.offset == SHORTCUT_SLOT_DELETED) {
+            if (insertAt == UINT32_MAX) insertAt = i;
+        } else if (value.hash == hash && readShortcutLine(store, value.offset - 1, line) &&
+                   shortcutLineHasName(line->data, name)) {
+            *slot = i;
+            *found = true;
+            return true;
+        }
+    }
+    *slot = insertAt;
+    return insertAt != UINT32_MAX;
+}
+
+// Builds the index from the data file. Of several live lines with the same name the first
+// one counts, as it did when lookups scanned the file, and the others are tombstoned.
+static bool rebuildShortcutIndex(ShortcutStore* store) {
+    StringTable names;
+    if (!stringTableInit(&names, 0)) {
+        return false;
+    }
+    ShortcutIndexHeader header = {0};
+    memcpy(header.magic, SHORTCUTS_INDEX_MAGIC, 4);
+
+    ByteBuffer record = {0};
+    rewind(store->data);
+    uint64_t offset = 0;
+    bool ok = true;
+    while (ok && readShortcutRecord(store->data, &record)) {
+        char* line = record.data;
+        size_t length = record.size;
+        char* equals = strchr(line, '=');
+        if (line[0] != SHORTCUT_TOMBSTONE && equals) {
+            *equals = '\0';
+            if (stringTableFind(&names, line)) {
+                header.deadBytes += length;
+            } else {
+                ok = stringTablePut(&names, line, 0);
+                header.liveBytes += length;
+            }
+        } else {
+            header.deadBytes += length;
+        }
+        offset += length;
+    }
+    ok = ok && feof(store->data);
+
+    header.capacity = 16;
+    while (header.capacity < (uint32_t)names.count * 2 + 2) header.capacity <<= 1;
+    ShortcutSlot* slots = calloc(header.capacity, sizeof(ShortcutSlot));
+    ok = ok && slots;
+
+    // Second pass for the offsets of the lines that count.
+    rewind(store->data);
+    offset = 0;
+    while (ok && readShortcutRecord(store->data, &record)) {
+        char* line = record.data;
+        size_t length = record.size;
+        char* equals = strchr(line, '=');
+        if (line[0] != SHORTCUT_TOMBSTONE && equals) {
+            *equals = '\0';
+            int* seen = stringTableFind(&names, line);
+            if (seen && *seen == 0) {
+                *seen = 1;
+                uint64_t hash = hashString(line);
+                uint32_t slot = (uint32_t)hash & (header.capacity - 1);
+                while (slots[slot].offset != 0) slot = (slot + 1) & (header.capacity - 1);
+                slots[slot].hash = hash;
+                slots[slot].offset = offset + 1;
+                header.live++;
+            } else if (seen) {
+                long resume = ftell(store->data);
+                ok = fseek(store->data, (long)offset, SEEK_SET) == 0 && fputc(SHORTCUT_TOMBSTONE, store->data) != EOF &&
+                     fseek(store->data, resume, SEEK_SET) == 0;
+            }
+        }
+        offset += length;
+    }
+    ok = ok && feof(store->data);
+    header.used = header.live;
+    stringTableFree(&names);
+    freeByteBuffer(&record);
+
+    size_t slotBytes = header.capacity * sizeof(ShortcutSlot);
+    ok = ok && ftruncate(store->indexFd, 0) == 0 &&
+         writeFileAt(store->indexFd, slots, slotBytes, sizeof(header)) == (ssize_t)slotBytes;
+    free(slots);
+    store->header = header;
+    return ok && writeShortcutHeader(store);
+}
+
+static void closeShortcutStore(ShortcutStore* store) {
+    if (store->data) fclose(store->data);
+    if (store->indexFd >= 0) close(store->indexFd);
+    if (store->lockFd >= 0) close(store->lockFd);
+}
+
+// With create false a missing shortcuts file makes this fail quietly.
+static bool openShortcutStore(ShortcutStore* store, bool create) {
+    store->data = NULL;
+    store->indexFd = -1;
+    store->lockFd = repoOpen(SHORTCUTS_LOCK_FILE, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (store->lockFd < 0 || !lockFileExclusive(store->lockFd)) {
+        perror("Error locking shortcuts");
+        closeShortcutStore(store);
+        return false;
+    }
+    store->data = repoFopen(SHORTCUTS_FILE, "r+b");
+    if (!store->data && create) {
+        store->data = repoFopen(SHORTCUTS_FILE, "w+b");
+    }
+    if (!store->data) {
+        if (create) perror("Error opening shortcuts file");
+        closeShortcutStore(store);
+        return false;
+    }
+    store->indexFd = repoOpen(SHORTCUTS_INDEX_FILE, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (store->indexFd < 0) {
+        perror("Error opening shortcuts index");
+        closeShortcutStore(store);
+        return false;
+    }
+
+    FileSignature signature = readFileSignature(SHORTCUTS_FILE);
+    if (readFileAt(store->indexFd, &store->header, sizeof(store->header), 0) != (ssize_t)sizeof(store->header) ||
+        memcmp(store->header.magic, SHORTCUTS_INDEX_MAGIC, 4) != 0 ||
+        !sameFileSignature(&store->header.data, &signature)) {
+        traceCount(TRACE_CACHE_MISSES, 1);
+        if (!rebuildShortcutIndex(store)) {
+            fprintf(stderr, "Error: Failed to index the shortcuts file.\n");
+            closeShortcutStore(store);
+            return false;
+        }
+    } else {
+        traceCount(TRACE_CACHE_HITS, 1);
+    }
+    return true;
+}
+
+static bool tombstoneShortcutLine(ShortcutStore* store, uint64_t offset, size_t length) {
+    if (fseek(store->data, (long)offset, SEEK_SET) != 0 || fputc(SHORTCUT_TOMBSTONE, store->data) == EOF) {
+        return false;
+    }
+    store->header.liveBytes -= length + 1;
+    store->header.deadBytes += length + 1;
+    traceCount(TRACE_BYTES_WRITTEN, 1);
+    return true;
+}
+
+// Appends the line and points slot at it, growing the index when it gets half full.
+static bool appendShortcutLine(ShortcutStore* store, uint32_t slot, bool reuse, const char* name, uint64_t hash,
+                        const char* message) {
+    if (fseek(store->data, 0, SEEK_END) != 0) {
+        return false;
+    }
+    long offset = ftell(store->data);
+    int written = fprintf(store->data, "%s=%s\n", name, message);
+    if (offset < 0 || written < 0) {
+        return false;
+    }
+    traceCount(TRACE_BYTES_WRITTEN, (uint64_t)written);
+    store->header.liveBytes += (uint64_t)written;
+
+    if (!reuse && (store->header.used + 1) * 2 > store->header.capacity) {
+        fflush(store->data);
+        return rebuildShortcutIndex(store);
+    }
+    ShortcutSlot value;
+    if (!reuse && readShortcutSlot(store, slot, &value) && value.offset == 0) {
+        store->header.used++;
+    }
+    if (!reuse) {
+        store->header.live++;
+    }
+    value.hash = hash;
+    value.offset = (uint64_t)offset + 1;
+    return writeShortcutSlot(store, slot, &value) && writeShortcutHeader(store);
+}
+
+// Rewrites the data file with only the lines the index points at.
+static bool compactShortcuts(ShortcutStore* store) {
+    char tempPath[MAX_PATH_LENGTH];
+    snprintf(tempPath, sizeof(tempPath), "%s.%ld", SHORTCUTS_FILE, (long)getpid());
+    FILE* out = repoFopen(tempPath, "wb");
+    if (!out) {
+        return false;
+    }
+    ByteBuffer record = {0}, current = {0};
+    rewind(store->data);
+    uint64_t offset = 0;
+    bool ok = true;
+    while (ok && readShortcutRecord(store->data, &record)) {
+        char* line = record.data;
+        size_t length = record.size;
+        char* equals = strchr(line, '=');
+        if (line[0] != SHORTCUT_TOMBSTONE && equals) {
+            long resume = ftell(store->data);
+            *equals = '\0';
+            uint32_t slot;
+            bool found;
+            ok = findShortcutSlot(store, line, hashString(line), &slot, &found, &current);
+            ShortcutSlot value;
+            if (ok && found && readShortcutSlot(store, slot, &value) && value.offset == offset + 1) {
+                *equals = '=';
+                ok = fwrite(line, 1, length, out) == length;
+            }
+            ok = ok && fseek(store->data, resume, SEEK_SET) == 0;
+        }
+        offset += length;
+    }
+    ok = ok && feof(store->data);
+    freeByteBuffer(&record);
+    freeByteBuffer(&current);
+    if (fclose(out) != 0 || !ok || repoRename(tempPath, SHORTCUTS_FILE) != 0) {
+        repoRemove(tempPath);
+        return false;
+    }
+    fclose(store->data);
+    store->data = repoFopen(SHORTCUTS_FILE, "r+b");
+    return store->data && rebuildShortcutIndex(store);
+}
+
+// Compaction runs in a child that inherits the lock, so the command does not wait for it
+// and the next shortcut operation waits until it is done.
+static void maybeCompactShortcuts(ShortcutStore* store) {
+    if (store->header.deadBytes < SHORTCUTS_COMPACT_MIN_BYTES || store->header.deadBytes <= store->header.liveBytes) {
+        return;
+    }
+#ifdef __linux__
+    fflush(stdout);
+    fflush(stderr);
+    fflush(store->data);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setsid();
+        stopTracing();
+        pid_t grandchild = fork();
+        if (grandchild == 0) {
+            // The inherited stream shares its file offset with the parent, which goes on
+            // to close it; it is left alone and the files are opened afresh.
+            store->data = repoFopen(SHORTCUTS_FILE, "r+b");
+            close(store->indexFd);
+            store->indexFd = repoOpen(SHORTCUTS_INDEX_FILE, O_RDWR | O_BINARY, 0);
+            if (store->data && store->indexFd >= 0) {
+                compactShortcuts(store);
+            }
+            closeShortcutStore(store);
+        }
+        _exit(0);
+    } else if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+#endif
+    compactShortcuts(store);
+}
+
+static bool lookupShortcut(const char* shortcutName, char* message, size_t size) {
+    ShortcutStore store;
+    if (!openShortcutStore(&store, false)) {
+        return false;
+    }
+    ByteBuffer line = {0};
+    uint32_t slot;
+    bool found = false;
+    bool ok = findShortcutSlot(&store, shortcutName, hashString(shortcutName), &slot, &found, &line);
+    if (ok && found) {
+        snprintf(message, size, "%s", strchr(line.data, '=') + 1);
+    }
+    freeByteBuffer(&line);
+    closeShortcutStore(&store);
+    return ok && found;
+}
+
+// Sets or, with mustExist, replaces a shortcut. A previous line for the name is tombstoned.
+static bool storeShortcut(const char* shortcutName, const char* message, bool mustExist) {
+    ShortcutStore store;
+    if (!openShortcutStore(&store, !mustExist)) {
+        if (mustExist) fprintf(stderr, "Error: Shortcut '%s' not found.\n", shortcutName);
+        return false;
+    }
+    ByteBuffer line = {0};
+    uint64_t hash = hashString(shortcutName);
+    uint32_t slot;
+    bool found = false;
+    bool ok = findShortcutSlot(&store, shortcutName, hash, &slot, &found, &line);
+    if (ok && !found && mustExist) {
+        fprintf(stderr, "Error: Shortcut '%s' not found.\n", shortcutName);
+        freeByteBuffer(&line);
+        closeShortcutStore(&store);
+        return false;
+    }
+    if (ok && found) {
+        ShortcutSlot value;
+        ok = readShortcutSlot(&store, slot, &value) && tombstoneShortcutLine(&store, value.offset - 1, line.size);
+    }
+    freeByteBuffer(&line);
+    ok = ok && appendShortcutLine(&store, slot, found, shortcutName, hash, message);
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to update the shortcuts file.\n");
+    } else {
+        maybeCompactShortcuts(&store);
+    }
+    closeShortcutStore(&store);
+    return ok;
+}
+
+static void setShortcut(const char* shortcutName, const char* message) {
+    if (!isValidShortcut(shortcutName, message)) {
+        return;
+    }
+    printf("Setting shortcut: %s with message: %s\n", shortcutName, message);
+    if (!storeShortcut(shortcutName, message, false)) {
+        return;
+    }
+    printf("Shortcut '%s' set for message '%s'\n", shortcutName, message);
+}
+
+static void createCommitWithShortcut(const char* shortcutName) {
+    char message[MAX_LINE_LENGTH];
+    if (!lookupShortcut(shortcutName, message, sizeof(message))) {
+        fprintf(stderr, "Error: Shortcut '%s' not found.\n", shortcutName);
+        return;
+    }
+
+    commitChanges(message);
+}
+
+static void replaceShortcutMessage(const char* shortcutName, const char* newMessage) {
+    if (!isValidShortcut(shortcutName, newMessage) || !storeShortcut(shortcutName, newMessage, true)) {
+        return;
+    }
+    printf("Shortcut '%s' message replaced successfully.\n", shortcutName);
+}
+
+static void removeShortcut(const char* shortcutName) {
+    ShortcutStore store;
+    if (!openShortcutStore(&store, false)) {
+        fprintf(stderr, "Error: Shortcut '%s' not found.\n", shortcutName);
+        return;
+    }
+    ByteBuffer line = {0};
+    uint32_t slot;
+    bool found = false;
+    bool ok = findShortcutSlot(&store, shortcutName, hashString(shortcutName), &slot, &found, &line);
+    if (ok && !found) {
+        fprintf(stderr, "Error: Shortcut '%s' not found.\n", shortcutName);
+        freeByteBuffer(&line);
+        closeShortcutStore(&store);
+        return;
+    }
+    ShortcutSlot value;
+    ok = ok && readShortcutSlot(&store, slot, &value) && tombstoneShortcutLine(&store, value.offset - 1, line.size);
+    freeByteBuffer(&line);
+    if (ok) {
+        value.offset = SHORTCUT_SLOT_DELETED;
+        store.header.live--;
+        ok = writeShortcutSlot(&store, slot, &value) && writeShortcutHeader(&store);
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to update the shortcuts file.\n");
+    } else {
+        maybeCompactShortcuts(&store);
+    }
+    closeShortcutStore(&store);
+    if (ok) {
+        printf("Shortcut '%s' removed successfully.\n", shortcutName);
+    }
+}
+
+
+static char* getLastCommitId(const char* branchName) {
+    static char lastCommitId[MAX_PATH_LENGTH];
+    char headFilePath[MAX_PATH_LENGTH];
+    char tempLine[MAX_PATH_LENGTH];
+    snprintf(headFilePath, sizeof(headFilePath), "%s/%s_HEAD", COMMIT_DIR, branchName);
+
+    FILE *file = repoFopen(headFilePath, "r");
+    if (file) {
+        while (fgets(tempLine, sizeof(tempLine), file) != NULL) {
+            strncpy(lastCommitId, tempLine, sizeof(lastCommitId));
+            lastCommitId[sizeof(lastCommitId) - 1] = '\0';
+        }
+        fclose(file);
+
+        lastCommitId[strcspn(lastCommitId, "\n")] = 0;
+        return lastCommitId;
+    }
+    return NULL;
+}
+
+
+static void updateCurrentBranch(const char* branchName) {
+    FILE *file = repoFopen(CURRENT_BRANCH_FILE, "w");
+    if (file) {
+        fprintf(file, "%s", branchName);
+        fclose(file);
+    } else {
+        perror("Failed to update current branch");
+    }
+}
+
+static void createBranch(const char* branchName) {
+    char branchHeadFilePath[MAX_PATH_LENGTH];
+    snprintf(branchHeadFilePath, sizeof(branchHeadFilePath), "%s/%s_HEAD", COMMIT_DIR, branchName);
+
+    if (fileExists(branchHeadFilePath)) {
+        printf("Error: Branch '%s' already exists.\n", branchName);
+        return;
+    }
+
+    char* currentCommitId = getLastCommitId(getCurrentBranch());
+    if (!currentCommitId) {
+        printf("Error: Could not retrieve current commit ID.\n");
+        return;
+    }
+
+    FILE* branchHeadFile = repoFopen(branchHeadFilePath, "w");
+    if (branchHeadFile) {
+        fprintf(branchHeadFile, "%s\n", currentCommitId);
+        fclose(branchHeadFile);
+
+        char headFilePath[MAX_PATH_LENGTH];
+        snprintf(headFilePath, sizeof(headFilePath), ".zengit/HEAD");
+        FILE* headFile = repoFopen(headFilePath, "a");
+        if (headFile) {
+            fprintf(headFile, "%s\n", branchName);
+            fclose(headFile);
+        } else {
+            perror("Failed to record branch name in .zengit/HEAD file");
+        }
+
+        printf("Branch '%s' created from the latest commit and recorded in .zengit/HEAD.\n", branchName);
+        updateCurrentBranch(branchName);
+    } else {
+        perror("Failed to create branch HEAD file");
+    }
+}
+
+static void listBranches() {
+    DIR* dir = repoOpendir(COMMIT_DIR);
+    if (!dir) {
+        perror("Failed to open commits directory");
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strstr(entry->d_name, "_HEAD") != NULL) {
+            char branchName[MAX_PATH_LENGTH];
+            strncpy(branchName, entry->d_name, strlen(entry->d_name) - 5);
+            branchName[strlen(entry->d_name) - 5] = '\0';
+            printf("%s\n", branchName);
+        }
+    }
+
+    closedir(dir);
+}
+
+static void normalizePath(char* path) {
+
+
+    char* p = path;
+    while (*p) {
+        if (*p == '\\') *p = '/';
+        ++p;
+    }
+
+    if (strncmp(path, "./", 2) == 0) {
+        memmove(path, path + 2, strlen(path) - 1);
+    }
+}
+
+static bool areFileAttributesDifferent(const char *file1, const char *file2) {
+    char buffer1[ROOTED_PATH_SIZE], buffer2[ROOTED_PATH_SIZE];
+    const char* rooted1 = rootedPath(file1, buffer1, sizeof(buffer1));
+    const char* rooted2 = rootedPath(file2, buffer2, sizeof(buffer2));
+    DWORD attributesFile1 = rooted1 ? GetFileAttributesA(rooted1) : INVALID_FILE_ATTRIBUTES;
+    DWORD attributesFile2 = rooted2 ? GetFileAttributesA(rooted2) : INVALID_FILE_ATTRIBUTES;
+
+
+    if (attributesFile1 == INVALID_FILE_ATTRIBUTES || attributesFile2 == INVALID_FILE_ATTRIBUTES) {
+        fprintf(stderr, "Error retrieving file attributes.\n");
+        return false;
+    }
+
+
+    bool readOnlyFile1 = attributesFile1 & FILE_ATTRIBUTE_READONLY;
+    bool readOnlyFile2 = attributesFile2 & FILE_ATTRIBUTE_READONLY;
+
+    return readOnlyFile1 != readOnlyFile2;
+}
+
+// Inexact rename detection compares MinHash sketches of each file's set of lines: the
+// fraction of equal slots estimates the Jaccard similarity of the two line sets. Sketches
+// are split into bands and only files sharing a band bucket are ever compared.
+typedef struct {
+    uint32_t minHashes[SIMILARITY_SKETCH_SIZE];
+    bool valid;
+} SimilaritySketch;
+
+typedef struct {
+    ManifestEntry* entry;
+    bool isCopySource;
+    bool used;
+} RenameSource;
+
+typedef struct {
+    int source;
+    int target;
+    int similarity;
+    bool isCopy;
+} RenamePair;
+
+typedef struct {
+    uint64_t key;
+    int source;
+} SketchBucket;
+
+static uint64_t mixHash(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+static void addLineToSketch(SimilaritySketch* sketch, uint64_t lineHash) {
+    for (int i = 0; i < SIMILARITY_SKETCH_SIZE; i++) {
+        uint32_t value = (uint32_t)(mixHash(lineHash ^ (0x9e3779b97f4a7c15ULL * (i + 1))) >> 32);
+        if (value < sketch->minHashes[i]) sketch->minHashes[i] = value;
+    }
+}
+
+static bool computeSimilaritySketch(const char* path, SimilaritySketch* sketch) {
+    sketch->valid = false;
+    for (int i = 0; i < SIMILARITY_SKETCH_SIZE; i++) sketch->minHashes[i] = UINT32_MAX;
+
+    FILE* file = repoFopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    unsigned char buffer[65536];
+    size_t bytesRead;
+    size_t totalRead = 0;
+    uint64_t lineHash = FNV_OFFSET_BASIS;
+    bool lineOpen = false;
+    bool binary = false;
+    while (!binary && (bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        if (totalRead < 8000 && memchr(buffer, '\0', bytesRead < 8000 - totalRead ? bytesRead : 8000 - totalRead)) {
+            binary = true;
+            break;
+        }
+        totalRead += bytesRead;
+        for (size_t i = 0; i < bytesRead; i++) {
+            lineHash = (lineHash ^ buffer[i]) * FNV_PRIME;
+            lineOpen = true;
+            if (buffer[i] == '\n') {
+                addLineToSketch(sketch, lineHash);
+                lineHash = FNV_OFFSET_BASIS;
+                lineOpen = false;
+            }
+        }
+    }
+    if (lineOpen) addLineToSketch(sketch, lineHash);
+    fclose(file);
+
+    sketch->valid = !binary && totalRead > 0;
+    return sketch->valid;
+}
+
+static int sketchSimilarity(const SimilaritySketch* a, const SimilaritySketch* b) {
+    int equal = 0;
+    for (int i = 0; i < SIMILARITY_SKETCH_SIZE; i++) {
+        if (a->minHashes[i] == b->minHashes[i]) equal++;
+    }
+    return equal * 100 / SIMILARITY_SKETCH_SIZE;
+}
+
+static uint64_t sketchBandKey(const SimilaritySketch* sketch, int band) {
+    const int rows = SIMILARITY_SKETCH_SIZE / SIMILARITY_BANDS;
+    uint64_t key = FNV_OFFSET_BASIS ^ (uint64_t)band;
+    key = hashBytes(key, (const unsigned char*)&sketch->minHashes[band * rows], rows * sizeof(uint32_t));
+    return key;
+}
+
+static int compareSketchBuckets(const void* a, const void* b) {
+    uint64_t keyA = ((const SketchBucket*)a)->key, keyB = ((const SketchBucket*)b)->key;
+    return keyA < keyB ? -1 : keyA > keyB;
+}
+
+static int compareRenamePairs(const void* a, const void* b) {
+    const RenamePair* pairA = a;
+    const RenamePair* pairB = b;
+    if (pairA->similarity != pairB->similarity) return pairB->similarity - pairA->similarity;
+    if (pairA->target != pairB->target) return pairA->target - pairB->target;
+    return pairA->source - pairB->source;
+}
+
+static bool appendRenamePair(RenamePair** pairs, int* count, int* capacity, RenamePair pair) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        RenamePair* resized = realloc(*pairs, *capacity * sizeof(RenamePair));
+        if (!resized) return false;
+        *pairs = resized;
+    }
+    (*pairs)[(*count)++] = pair;
+    return true;
+}
+
+// Pairs added files (targets) with deleted files, or with copy sources that still exist.
+// Exact matches are found through a hash table keyed on content hash; deleted files are
+// also matched inexactly through the sketch buckets. Returns one pair per matched target.
+static int detectRenames(RenameSource* sources, int numSources, const char* sourceRoot,
+                  ManifestEntry** targets, int numTargets, const char* targetRoot, RenamePair** result) {
+    RenamePair* matches = NULL;
+    int numMatches = 0, matchCapacity = 0;
+    char* targetMatched = calloc(numTargets + 1, 1);
+    if (!targetMatched) {
+        *result = NULL;
+        return 0;
+    }
+    zengitTraceBegin("rename detection");
+
+    StringTable byHash;
+    stringTableInit(&byHash, numSources);
+    char key[17];
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < numSources; i++) {
+            if (sources[i].isCopySource != (pass == 1)) continue;
+            snprintf(key, sizeof(key), "%016" PRIx64, sources[i].entry->hash);
+            if (!stringTableFind(&byHash, key)) stringTablePut(&byHash, key, i);
+        }
+    }
+    for (int t = 0; t < numTargets; t++) {
+        if (!ensureManifestEntryHashed(targets[t], targetRoot)) continue;
+        snprintf(key, sizeof(key), "%016" PRIx64, targets[t]->hash);
+        int* source = stringTableFind(&byHash, key);
+        if (source && (sources[*source].isCopySource || !sources[*source].used)) {
+            RenamePair pair = { *source, t, 100, sources[*source].isCopySource };
+            sources[*source].used = !sources[*source].isCopySource;
+            targetMatched[t] = 1;
+            appendRenamePair(&matches, &numMatches, &matchCapacity, pair);
+        }
+    }
+    stringTableFree(&byHash);
+
+    SimilaritySketch* sourceSketches = calloc(numSources + 1, sizeof(SimilaritySketch));
+    SketchBucket* buckets = malloc(((size_t)numSources * SIMILARITY_BANDS + 1) * sizeof(SketchBucket));
+    RenamePair* candidates = NULL;
+    int numCandidates = 0, candidateCapacity = 0;
+    int numBuckets = 0;
+    if (sourceSketches && buckets) {
+        char path[MAX_PATH_LENGTH];
+        for (int i = 0; i < numSources; i++) {
+            if (sources[i].used || sources[i].isCopySource) continue;
+            snprintf(path, sizeof(path), "%s/%s", sourceRoot, sources[i].entry->path);
+            if (!computeSimilaritySketch(path, &sourceSketches[i])) continue;
+            for (int band = 0; band < SIMILARITY_BANDS; band++) {
+                buckets[numBuckets].key = sketchBandKey(&sourceSketches[i], band);
+                buckets[numBuckets].source = i;
+                numBuckets++;
+            }
+        }
+        qsort(buckets, numBuckets, sizeof(SketchBucket), compareSketchBuckets);
+
+        for (int t = 0; t < numTargets && numBuckets > 0; t++) {
+            if (targetMatched[t]) continue;
+            SimilaritySketch targetSketch;
+            snprintf(path, sizeof(path), "%s/%s", targetRoot, targets[t]->path);
+            if (!computeSimilaritySketch(path, &targetSketch)) continue;
+
+            for (int band = 0; band < SIMILARITY_BANDS; band++) {
+                SketchBucket probe = { sketchBandKey(&targetSketch, band), 0 };
+                SketchBucket* hit = bsearch(&probe, buckets, numBuckets, sizeof(SketchBucket), compareSketchBuckets);
+                if (!hit) continue;
+                while (hit > buckets && (hit - 1)->key == probe.key) hit--;
+                for (; hit < buckets + numBuckets && hit->key == probe.key; hit++) {
+                    int similarity = sketchSimilarity(&sourceSketches[hit->source], &targetSketch);
+                    if (similarity >= RENAME_SIMILARITY_THRESHOLD) {
+                        RenamePair pair = { hit->source, t, similarity, sources[hit->source].isCopySource };
+                        appendRenamePair(&candidates, &numCandidates, &candidateCapacity, pair);
+                    }
+                }
+            }
+        }
+    }
+
+    qsort(candidates, numCandidates, sizeof(RenamePair), compareRenamePairs);
+    for (int i = 0; i < numCandidates; i++) {
+        RenamePair* pair = &candidates[i];
+        if (targetMatched[pair->target]) continue;
+        if (!sources[pair->source].isCopySource) {
+            if (sources[pair->source].used) continue;
+            sources[pair->source].used = true;
+        }
+        targetMatched[pair->target] = 1;
+        appendRenamePair(&matches, &numMatches, &matchCapacity, *pair);
+    }
+
+    free(candidates);
+    free(buckets);
+    free(sourceSketches);
+    free(targetMatched);
+    *result = matches;
+    zengitTraceEnd();
+    return numMatches;
+}
+
+// Returns 'M' or 'T' for a tracked file that changed, or 0 when it is unchanged. The
+// work tree file is only read when its size matches the committed one.
+static char processFileStatus(const ManifestEntry* headEntry, ManifestEntry* workEntry, const char* commitDir) {
+    if (headEntry->size != workEntry->size) {
+        return 'M';
+    }
+    if (!ensureManifestEntryHashed(workEntry, ".") || workEntry->hash != headEntry->hash) {
+        return 'M';
+    }
+
+    char commitFilePath[MAX_PATH_LENGTH];
+    bool fits = formatPath(commitFilePath, sizeof(commitFilePath), "%s/%s", commitDir, headEntry->path);
+    return fits && areFileAttributesDifferent(workEntry->path, commitFilePath) ? 'T' : 0;
+}
+
+typedef struct {
+    const char* path;
+    const char* fromPath;
+    char code;
+    int similarity;
+} StatusLine;
+
+static int compareStatusLines(const void* a, const void* b) {
+    return strcmp(((const StatusLine*)a)->path, ((const StatusLine*)b)->path);
+}
+
+// Compares the work tree with commitId and returns the changes sorted by path, or NULL if
+// the commit cannot be read. Paths in the lines point into *head and *work, which the
+// caller frees once it is done with the lines.
+static StatusLine* computeWorkTreeStatus(const char* commitId, Manifest* head, Manifest* work, int* count) {
+    char commitDir[MAX_PATH_LENGTH];
+    snprintf(commitDir, sizeof(commitDir), "%s/%s", COMMIT_DIR, commitId);
+
+    if (!loadCommitManifest(commitId, head)) {
+        return NULL;
+    }
+    buildWorkTreeManifest(work);
+    // Files outside the sparse checkout are not in the work tree but are not deleted either.
+    filterSparseManifest(head);
+    zengitTraceBegin("compare");
+
+    int capacity = head->count + work->count + 1;
+    StatusLine* lines = malloc(capacity * sizeof(StatusLine));
+    RenameSource* sources = malloc(capacity * sizeof(RenameSource));
+    ManifestEntry** added = malloc(capacity * sizeof(ManifestEntry*));
+    int numLines = 0, numSources = 0, numAdded = 0, numDeleted = 0;
+    if (!lines || !sources || !added) {
+        free(lines);
+        free(sources);
+        free(added);
+        freeManifest(head);
+        freeManifest(work);
+        zengitTraceEnd();
+        return NULL;
+    }
+
+    // Deleted files come first in sources so they win exact-hash ties over copy sources.
+    for (int i = 0, j = 0; i < head->count || j < work->count;) {
+        int order = i >= head->count ? 1 : j >= work->count ? -1 : strcmp(head->entries[i].path, work->entries[j].path);
+        if (order < 0) {
+            sources[numSources++] = (RenameSource){ &head->entries[i], false, false };
+            numDeleted++;
+            i++;
+        } else if (order > 0) {
+            added[numAdded++] = &work->entries[j];
+            j++;
+        } else {
+            char code = processFileStatus(&head->entries[i], &work->entries[j], commitDir);
+            if (code) {
+                lines[numLines++] = (StatusLine){ work->entries[j].path, NULL, code, 0 };
+            }
+            i++;
+            j++;
+        }
+    }
+    for (int i = 0, j = 0; i < head->count; i++) {
+        while (j < work->count && strcmp(work->entries[j].path, head->entries[i].path) < 0) j++;
+        if (j < work->count && strcmp(work->entries[j].path, head->entries[i].path) == 0) {
+            sources[numSources++] = (RenameSource){ &head->entries[i], true, false };
+        }
+    }
+
+    RenamePair* pairs = NULL;
+    int numPairs = numAdded > 0 ? detectRenames(sources, numSources, commitDir, added, numAdded, ".", &pairs) : 0;
+    char* addedMatched = calloc(numAdded + 1, 1);
+    for (int p = 0; p < numPairs; p++) {
+        const RenamePair* pair = &pairs[p];
+        lines[numLines++] = (StatusLine){ added[pair->target]->path, sources[pair->source].entry->path,
+                                          pair->isCopy ? 'C' : 'R', pair->similarity };
+        if (addedMatched) addedMatched[pair->target] = 1;
+    }
+    for (int i = 0; i < numAdded; i++) {
+        if (!addedMatched || !addedMatched[i]) lines[numLines++] = (StatusLine){ added[i]->path, NULL, 'A', 0 };
+    }
+    for (int i = 0; i < numDeleted; i++) {
+        if (!sources[i].used) lines[numLines++] = (StatusLine){ sources[i].entry->path, NULL, 'D', 0 };
+    }
+
+    qsort(lines, numLines, sizeof(StatusLine), compareStatusLines);
+
+    free(addedMatched);
+    free(pairs);
+    free(sources);
+    free(added);
+    zengitTraceEnd();
+    saveFsMonitorState(work);
+    *count = numLines;
+    return lines;
+}
+
+static time_t logDateStringToTimeT(const char* logDateString) {
+    struct tm tm = {0};
+    char monthStr[4];
+    int month, day, hour, minute, second, year;
+    const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    sscanf(logDateString, "%*s %3s %d %d:%d:%d %d", monthStr, &day, &hour, &minute, &second, &year);
+
+    month = (strstr(months, monthStr) - months) / 3;
+
+    tm.tm_mon = month;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    tm.tm_year = year - 1900;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+}
+
+static time_t cutoffDateToTimeT(const char* dateString) {
+    struct tm tm = {0};
+    sscanf(dateString, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday);
+
+    tm.tm_year -= 1900; // Adjust for tm structure's year (years since 1900)
+    tm.tm_mon -= 1; // Adjust month from 1-12 to 0-11
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1; // Not considering DST
+
+    return mktime(&tm);
+}
+
+static int match(const char *pattern, const char *str) {
+    const char *p = pattern, *s = str;
+    const char *star = NULL, *ss = s;
+
+    while (*s) {
+        if (*p == '?' || *p == *s) { ++s; ++p; continue; }
+        if (*p == '*') { star = p++; ss = s; continue; }
+        if (star) { p = star + 1; s = ++ss; continue; }
+        return 0;
+    }
+    while (*p == '*') { ++p; }
+    return !*p;
+}
+
+// Aho-Corasick automaton over a compressed alphabet: every byte that occurs in some
+// pattern gets its own class, all other bytes share class 0. The goto/failure function
+// is resolved into one dense numStates x numClasses table so a scan is a single lookup
+// per input byte.
+typedef struct {
+    int numPatterns;
+    int numStates;
+    int numClasses;
+    unsigned char byteClass[256];
+    int* transitions;
+    int* statePattern;
+    int* patternNext;
+    int* dictLink;
+    size_t* patternLengths;
+} AhoCorasick;
+
+typedef void (*AcMatchCallback)(int patternIndex, size_t endOffset, void* context);
+
+static void acFree(AhoCorasick* ac) {
+    free(ac->transitions);
+    free(ac->statePattern);
+    free(ac->patternNext);
+    free(ac->dictLink);
+    free(ac->patternLengths);
+    memset(ac, 0, sizeof(*ac));
+}
+
+static bool acCompile(AhoCorasick* ac, const char* patterns[], int numPatterns) {
+    memset(ac, 0, sizeof(*ac));
+    ac->numPatterns = numPatterns;
+    ac->numClasses = 1;
+
+    size_t totalLength = 0;
+    for (int i = 0; i < numPatterns; i++) {
+        for (const unsigned char* c = (const unsigned char*)patterns[i]; *c; c++) {
+            if (ac->byteClass[*c] == 0) {
+                ac->byteClass[*c] = (unsigned char)ac->numClasses++;
+            }
+            totalLength++;
+        }
+    }
+
+    int maxStates = (int)totalLength + 1;
+    ac->transitions = calloc((size_t)maxStates * ac->numClasses, sizeof(int));
+    ac->statePattern = malloc(maxStates * sizeof(int));
+    ac->dictLink = calloc(maxStates, sizeof(int));
+    ac->patternNext = malloc((numPatterns > 0 ? numPatterns : 1) * sizeof(int));
+    ac->patternLengths = malloc((numPatterns > 0 ? numPatterns : 1) * sizeof(size_t));
+    int* failure = calloc(maxStates, sizeof(int));
+    int* queue = malloc(maxStates * sizeof(int));
+    if (!ac->transitions || !ac->statePattern || !ac->dictLink || !ac->patternNext ||
+        !ac->patternLengths || !failure || !queue) {
+        free(failure);
+        free(queue);
+        acFree(ac);
+        return false;
+    }
+    for (int s = 0; s < maxStates; s++) ac->statePattern[s] = -1;
+
+    ac->numStates = 1;
+    for (int i = 0; i < numPatterns; i++) {
+        ac->patternLengths[i] = strlen(patterns[i]);
+        ac->patternNext[i] = -1;
+        if (ac->patternLengths[i] == 0) continue;
+
+        int state = 0;
+        for (const unsigned char* c = (const unsigned char*)patterns[i]; *c; c++) {
+            int* edge = &ac->transitions[state * ac->numClasses + ac->byteClass[*c]];
+            if (*edge == 0) {
+                *edge = ac->numStates++;
+            }
+            state = *edge;
+        }
+        ac->patternNext[i] = ac->statePattern[state];
+        ac->statePattern[state] = i;
+    }
+
+    // Breadth-first pass: children of a state are visited after the state itself, so the
+    // failure state's row is always complete when a missing edge is copied from it.
+    int head = 0, tail = 0;
+    for (int c = 1; c < ac->numClasses; c++) {
+        int child = ac->transitions[c];
+        if (child) queue[tail++] = child;
+    }
+    while (head < tail) {
+        int state = queue[head++];
+        int* row = &ac->transitions[state * ac->numClasses];
+        const int* failRow = &ac->transitions[failure[state] * ac->numClasses];
+        for (int c = 1; c < ac->numClasses; c++) {
+            int child = row[c];
+            if (child) {
+                failure[child] = failRow[c];
+                ac->dictLink[child] = ac->statePattern[failure[child]] >= 0 ? failure[child] : ac->dictLink[failure[child]];
+                queue[tail++] = child;
+            } else {
+                row[c] = failRow[c];
+            }
+        }
+    }
+
+    free(failure);
+    free(queue);
+    return true;
+}
+
+// Runs the automaton over text once, reporting every (possibly overlapping) occurrence.
+// Returns the number of occurrences seen; with stopAtFirst it returns as soon as one is found.
+static int acScan(const AhoCorasick* ac, const char* text, size_t length, int* hitCounts, bool stopAtFirst,
+           AcMatchCallback onMatch, void* context) {
+    int matches = 0;
+    int state = 0;
+    for (size_t i = 0; i < length; i++) {
+        state = ac->transitions[state * ac->numClasses + ac->byteClass[(unsigned char)text[i]]];
+        int terminal = ac->statePattern[state] >= 0 ? state : ac->dictLink[state];
+        while (terminal) {
+            for (int p = ac->statePattern[terminal]; p >= 0; p = ac->patternNext[p]) {
+                matches++;
+                if (hitCounts) hitCounts[p]++;
+                if (onMatch) onMatch(p, i + 1, context);
+                if (stopAtFirst) return matches;
+            }
+            terminal = ac->dictLink[terminal];
+        }
+    }
+    return matches;
+}
+
+static int messageContainsTerms(const char* message, const AhoCorasick* terms) {
+    return acScan(terms, message, strlen(message), NULL, true, NULL, NULL) > 0;
+}
+
+static int readLogEntry(FILE* file, LogEntry* entry) {
+    if (fscanf(file, "Date: %[^\n]\nUser: %[^\n]\nCommit ID: %[^\n]\nBranch: %[^\n]\nMessage: %[^\n]\nFiles Committed: %d\n\n",
+               entry->date, entry->user, entry->commitID, entry->branch, entry->message, &entry->filesCommitted) == 6) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+static bool isSymbolicLink(const char* path) {
+#ifdef _WIN32
+    (void)path;
+    return false;
+#else
+    char buffer[ROOTED_PATH_SIZE];
+    const char* rooted = rootedPath(path, buffer, sizeof(buffer));
+    struct stat linkStat;
+    return rooted && lstat(rooted, &linkStat) == 0 && S_ISLNK(linkStat.st_mode);
+#endif
+}
+
+// Files go on the way down and directories once their children are gone. A link to a
+// directory is removed itself, never followed.
+static WalkAction visitForDelete(WalkEntry* entry, void* context) {
+    bool keepZengit = *(bool*)context;
+    if (keepZengit && entry->depth == 1 && strcmp(entry->name, ".zengit") == 0) {
+        return WALK_SKIP;
+    }
+    if (entry->type == WALK_DIRECTORY && !isSymbolicLink(entry->path)) {
+        return WALK_CONTINUE;
+    }
+    repoRemove(entry->path);
+    return WALK_SKIP;
+}
+
+static void leaveDeletedDirectory(WalkEntry* directory, void* context) {
+    (void)context;
+    repoRmdir(directory->path);
+}
+
+// Empties path; the directory itself is left for the caller to remove.
+static void deleteDirectoryRecursively(const char* path) {
+    bool keepZengit = false;
+    DirectoryWalker walker = { visitForDelete, leaveDeletedDirectory, &keepZengit, false };
+    walkDirectoryTree(path, "", &walker);
+}
+
+static void clearWorkingDirectoryExceptZengit(const char* dirPath) {
+    bool keepZengit = true;
+    DirectoryWalker walker = { visitForDelete, leaveDeletedDirectory, &keepZengit, false };
+    if (!walkDirectoryTree(dirPath, "", &walker)) {
+        printf("Unable to open directory for clearing: %s\n", dirPath);
+    }
+}
+
+// Replaces everything in the work tree except .zengit with the snapshot of commitId, or
+// with the part of it the sparse checkout includes.
+static void restoreCommitSnapshot(const char* commitId) {
+    bool sparse = refreshSparseCheckout();
+    zengitTraceBegin("clear work tree");
+    clearWorkingDirectoryExceptZengit(".");
+    zengitTraceEnd();
+
+    char commitDirPath[MAX_PATH_LENGTH];
+    snprintf(commitDirPath, sizeof(commitDirPath), "%s/%s", COMMIT_DIR, commitId);
+    copyDirectoryRecursively(commitDirPath, ".", NULL, sparse);
+}
+
+static void zengitCheckout(const char* branchName) {
+    char* lastCommitId = getLastCommitId(branchName);
+    if (lastCommitId == NULL) {
+        printf("Error: Could not find the last commit for branch '%s'.\n", branchName);
+        return;
+    }
+
+    restoreCommitSnapshot(lastCommitId);
+    printf("Switched to branch '%s'.\n", branchName);
+}
+
+static int commitIdExists(const char* commitId) {
+    char dirPath[MAX_PATH_LENGTH];
+    if (!formatPath(dirPath, sizeof(dirPath), ".zengit/commits/%s", commitId)) {
+        return 0;
+    }
+
+    struct stat dirStat;
+    return repoStat(dirPath, &dirStat) == 0 && S_ISDIR(dirStat.st_mode);
+}
+
+static void zengitCheckoutCommitId(const char* commitId) {
+    if (!commitIdExists(commitId)) {
+        printf("Error: Commit ID '%s' does not exist.\n", commitId);
+        return;
+    }
+
+    restoreCommitSnapshot(commitId);
+    printf("Checked out commit '%s'.\n", commitId);
+}
+
+static void zengitCheckoutHead() {
+    char* currentBranch = getCurrentBranch();
+    zengitCheckout(currentBranch);
+}
+
+static int compareCommitEntries(const void* a, const void* b) {
+    int64_t timeA = ((const CommitEntry*)a)->creationTime;
+    int64_t timeB = ((const CommitEntry*)b)->creationTime;
+
+    return timeA < timeB ? 1 : timeA > timeB ? -1 : 0;
+}
+
+// Windows reports when a directory was created as st_ctime; elsewhere the modification
+// time stands in, since a snapshot is not written to after its commit.
+static int64_t directoryCreationTime(const struct stat* dirStat) {
+#ifdef _WIN32
+    return (int64_t)dirStat->st_ctime * 1000000000;
+#elif defined(__linux__)
+    return (int64_t)dirStat->st_mtim.tv_sec * 1000000000 + dirStat->st_mtim.tv_nsec;
+#else
+    return (int64_t)dirStat->st_mtime * 1000000000;
+#endif
+}
+
+typedef struct {
+    CommitEntry* commits;
+    int count;
+    int capacity;
+} CommitEntryList;
+
+static WalkAction visitForCommitEntry(WalkEntry* entry, void* context) {
+    CommitEntryList* list = context;
+    struct stat dirStat;
+    if (entry->type != WALK_DIRECTORY || repoStat(entry->path, &dirStat) != 0) {
+        return WALK_SKIP;
+    }
+
+    if (list->count >= list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        CommitEntry* resized = realloc(list->commits, capacity * sizeof(CommitEntry));
+        if (!resized) {
+            return WALK_STOP;
+        }
+        list->commits = resized;
+        list->capacity = capacity;
+    }
+
+    snprintf(list->commits[list->count].commitId, MAX_PATH, "%s", entry->name);
+    list->commits[list->count].creationTime = directoryCreationTime(&dirStat);
+    list->count++;
+    return WALK_SKIP;
+}
+
+static CommitEntry* getSortedCommits(const char* commitDirPath, int* count) {
+    CommitEntryList list = { NULL, 0, 0 };
+    DirectoryWalker walker = { visitForCommitEntry, NULL, &list, false };
+    *count = 0;
+    if (!walkDirectoryTree(commitDirPath, "", &walker) || !list.commits) {
+        free(list.commits);
+        return NULL;
+    }
+
+    qsort(list.commits, list.count, sizeof(CommitEntry), compareCommitEntries);
+
+    *count = list.count;
+    return list.commits;
+}
+
+// Finds the n-th newest entry (0 is the newest) among the snapshots in commitsDir.
+static bool findNthNewestCommit(const char* commitsDir, int n, char* commitId, size_t size, int* available) {
+    int count = 0;
+    CommitEntry* commits = getSortedCommits(commitsDir, &count);
+    *available = count;
+    bool found = commits && n >= 0 && n < count;
+    if (found) {
+        snprintf(commitId, size, "%.40s", commits[n].commitId);
+    }
+    free(commits);
+    return found;
+}
+
+static int isBranchName(const char* branchName) {
+    char branchHeadFilePath[MAX_PATH_LENGTH];
+    snprintf(branchHeadFilePath, sizeof(branchHeadFilePath), "%s/%s_HEAD", COMMIT_DIR, branchName);
+
+    FILE* file = repoFopen(branchHeadFilePath, "r");
+    if (file) {
+        fclose(file);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int isCommitId(const char* commitId) {
+    char commitDirPath[MAX_PATH_LENGTH];
+    struct stat statbuf;
+    snprintf(commitDirPath, sizeof(commitDirPath), "%s/%s", COMMIT_DIR, commitId);
+
+    if (repoStat(commitDirPath, &statbuf) == 0) {
+        if (S_ISDIR(statbuf.st_mode)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static bool workTreeMatchesHead(const char* path, const Manifest* ours);
+static void removeEmptyParentDirectories(const char* path);
+
+// A revert is a new commit on the current branch whose tree is targetId's. Its snapshot
+// hard-links targetId's files and takes its manifest as is, so no file is read or hashed.
+// The work tree only gets the paths that differ from HEAD (within the sparse checkout), and
+// the index, which must be empty, stays empty.
+static bool revertToSnapshot(const char* targetId, const char* message) {
+    if (fileExists(INDEX_FILE) && !isFileEmpty(INDEX_FILE)) {
+        printf("Error: You have staged changes. Commit or reset them before reverting.\n");
+        return false;
+    }
+    Manifest target, head = { 0 };
+    if (!isCommitId(targetId) || !loadCommitManifest(targetId, &target)) {
+        printf("Error: Commit ID '%s' does not exist.\n", targetId);
+        return false;
+    }
+    char* lastCommitId = getLastCommitId(getCurrentBranch());
+    if (lastCommitId && lastCommitId[0]) {
+        loadCommitManifest(lastCommitId, &head);
+    }
+
+    refreshSparseCheckout();
+    bool ok = true;
+    for (int i = 0; ok && i < target.count; i++) {
+        const ManifestEntry* entry = &target.entries[i];
+        const ManifestEntry* current = findManifestEntry(&head, entry->path);
+        bool changes = !current || current->hash != entry->hash;
+        if (changes && isPathInSparseCheckout(entry->path, false) && !workTreeMatchesHead(entry->path, &head)) {
+            fprintf(stderr, "Error: Your local changes to '%s' would be overwritten by revert.\n", entry->path);
+            ok = false;
+        }
+    }
+    for (int i = 0; ok && i < head.count; i++) {
+        const char* path = head.entries[i].path;
+        if (!findManifestEntry(&target, path) && isPathInSparseCheckout(path, false) && !workTreeMatchesHead(path, &head)) {
+            fprintf(stderr, "Error: Your local changes to '%s' would be overwritten by revert.\n", path);
+            ok = false;
+        }
+    }
+    if (!ok) {
+        freeManifest(&target);
+        freeManifest(&head);
+        return false;
+    }
+
+    char commitID[41];
+    generateCommitID(commitID, sizeof(commitID));
+    char commitDirPath[MAX_PATH_LENGTH], targetDirPath[MAX_PATH_LENGTH];
+    snprintf(commitDirPath, sizeof(commitDirPath), "%s/%s", COMMIT_DIR, commitID);
+    snprintf(targetDirPath, sizeof(targetDirPath), "%s/%s", COMMIT_DIR, targetId);
+    ensureDirectoryExists(commitDirPath);
+
+    zengitTraceBegin("snapshot");
+    for (int i = 0; i < target.count; i++) {
+        char srcPath[MAX_PATH_LENGTH], destPath[MAX_PATH_LENGTH];
+        if (formatPath(srcPath, sizeof(srcPath), "%s/%s", targetDirPath, target.entries[i].path) &&
+            formatPath(destPath, sizeof(destPath), "%s/%s", commitDirPath, target.entries[i].path)) {
+            linkOrCopyFile(srcPath, destPath);
+        }
+    }
+    char manifestPath[MAX_PATH_LENGTH + sizeof(MANIFEST_SUFFIX)];
+    snprintf(manifestPath, sizeof(manifestPath), "%s%s", commitDirPath, MANIFEST_SUFFIX);
+    writeManifest(manifestPath, &target);
+    zengitTraceEnd();
+
+    zengitTraceBegin("update work tree");
+    for (int i = 0; i < head.count; i++) {
+        const char* path = head.entries[i].path;
+        if (!findManifestEntry(&target, path) && isPathInSparseCheckout(path, false)) {
+            repoRemove(path);
+            removeEmptyParentDirectories(path);
+        }
+    }
+    CopyQueue queue;
+    memset(&queue, 0, sizeof(queue));
+    for (int i = 0; i < target.count; i++) {
+        const ManifestEntry* entry = &target.entries[i];
+        const ManifestEntry* current = findManifestEntry(&head, entry->path);
+        if ((current && current->hash == entry->hash) || !isPathInSparseCheckout(entry->path, false)) continue;
+
+        char srcPath[MAX_PATH_LENGTH], parent[MAX_PATH_LENGTH];
+        if (!formatPath(srcPath, sizeof(srcPath), "%s/%s", targetDirPath, entry->path)) {
+            continue;
+        }
+        snprintf(parent, sizeof(parent), "%s", entry->path);
+        char* lastSlash = strrchr(parent, '/');
+        if (lastSlash) {
+            *lastSlash = '\0';
+            ensureDirectoryStructureExists(parent);
+        }
+        queueFileCopy(&queue, srcPath, entry->path);
+    }
+    flushFileCopies(&queue);
+    zengitTraceEnd();
+
+    ok = recordCommit(commitID, message, target.count);
+    freeManifest(&target);
+    freeManifest(&head);
+    return ok;
+}
+
+static void zengitRevert(const char* message, const char* commitId) {
+    if (!revertToSnapshot(commitId, message)) {
+        printf("Failed to create a new commit with the revert message.\n");
+    } else {
+        printf("Reverted to commit %s and created a new commit with message: %s\n", commitId, message);
+    }
+}
+static char* findCommitMessage(const char* commitId) {
+    static char message[256];
+    FILE* file = repoFopen(".zengit/logs", "r");
+    if (!file) {
+        perror("Failed to open log file");
+        return NULL;
+    }
+
+    char line[1024];
+    bool isTargetCommit = false;
+
+    while (fgets(line, sizeof(line), file)) {
+        if (strstr(line, "Commit ID: ") && strstr(line, commitId)) {
+            isTargetCommit = true;
+        } else if (isTargetCommit && strstr(line, "Message: ")) {
+            sscanf(line, "Message: %[^\n]", message);
+            fclose(file);
+            return message;
+        } else if (line[0] == '\n') {
+            isTargetCommit = false;
+        }
+    }
+
+    fclose(file);
+    return NULL;
+}
+
+static void zengitRevertWithoutMessage(const char* commitId) {
+    char* commitMessage = findCommitMessage(commitId);
+    if (!commitMessage) {
+        printf("Error: Could not find commit message for commit ID '%s'.\n", commitId);
+        return;
+    }
+
+    if (!revertToSnapshot(commitId, commitMessage)) {
+        printf("Failed to create a new commit with the revert message.\n");
+    } else {
+        printf("Reverted to commit %s and created a new commit with message: %s\n", commitId, commitMessage);
+    }
+}
+
+static void zengitRevertToCommit(const char* commitId) {
+    zengitCheckoutCommitId(commitId);
+}
+
+static void zengitRevertToHead() {
+    zengitCheckoutHead();
+}
+
+static void createTag(const char* tagName, const char* message, const char* commitId, bool force) {
+    char tagFilePath[256];
+    snprintf(tagFilePath, sizeof(tagFilePath), "%s/%s", TAGS_DIR, tagName);
+
+    struct stat buffer;
+    if (repoStat(tagFilePath, &buffer) == 0) { // File exists
+        if (!force) {
+            printf("Error: Tag '%s' already exists. Use -f to overwrite.\n", tagName);
+            return;
+        }
+    }
+
+    char lastCommitId[256];
+    if (!commitId) {
+        commitId = getLastCommitId(getCurrentBranch());
+        if (!commitId) {
+            printf("Error: Unable to determine the last commit ID.\n");
+            return;
+        }
+    }
+
+    FILE* file = repoFopen(tagFilePath, "w");
+    if (!file) {
+        perror("Failed to create or overwrite tag file");
+        return;
+    }
+
+    char userName[256];
+    loadCommitUserName(userName, sizeof(userName));
+
+    time_t now = time(NULL);
+    char formattedTime[64];
+    strftime(formattedTime, sizeof(formattedTime), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+    fprintf(file, "Tag Name: %s\nCommit ID: %s\nUser: %s\nDate: %s\nMessage: %s\n",
+            tagName, commitId, userName, formattedTime, message ? message : "");
+
+    fclose(file);
+    printf("Tag '%s' created successfully.\n", tagName);
+}
+
+static int compareStrings(const void* a, const void* b) {
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+static WalkAction visitForTagName(WalkEntry* entry, void* context) {
+    if (entry->type != WALK_DIRECTORY && !appendPathList(context, entry->name)) {
+        return WALK_STOP;
+    }
+    return WALK_SKIP;
+}
+
+static void listTags() {
+    PathList tags = {0};
+    DirectoryWalker walker = { visitForTagName, NULL, &tags, false };
+    if (!walkDirectoryTree(TAGS_DIR, "", &walker)) {
+        if (tags.count == 0) {
+            printf("No tags found.\n");
+        } else {
+            printf("Memory allocation error.\n");
+        }
+        freePathList(&tags);
+        return;
+    }
+
+    qsort(tags.paths, tags.count, sizeof(char*), compareStrings);
+
+    for (int i = 0; i < tags.count; i++) {
+        printf("%s\n", tags.paths[i]);
+    }
+
+    freePathList(&tags);
+}
+
+static void showTagInfo(const char* tagName) {
+    char tagFilePath[256];
+    snprintf(tagFilePath, sizeof(tagFilePath), "%s/%s", TAGS_DIR, tagName);
+
+    FILE* file = repoFopen(tagFilePath, "r");
+    if (!file) {
+        printf("Error: Could not find tag '%s'.\n", tagName);
+        return;
+    }
+
+    printf("Information for tag '%s':\n", tagName);
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        printf("%s", line);
+    }
+
+    fclose(file);
+}
+
+static bool resolveRevision(const char* revision, char* commitId, size_t size) {
+    const char* resolved = NULL;
+    if (strcmp(revision, "HEAD") == 0) {
+        resolved = getLastCommitId(getCurrentBranch());
+    } else if (isBranchName(revision)) {
+        resolved = getLastCommitId(revision);
+    } else if (isCommitId(revision)) {
+        resolved = revision;
+    } else {
+        char tagFilePath[MAX_PATH_LENGTH];
+        snprintf(tagFilePath, sizeof(tagFilePath), "%s/%s", TAGS_DIR, revision);
+        FILE* file = repoFopen(tagFilePath, "r");
+        if (file) {
+            char line[MAX_TAG_INFO_SIZE];
+            while (fgets(line, sizeof(line), file)) {
+                if (strncmp(line, "Commit ID: ", 11) == 0) {
+                    line[strcspn(line, "\n")] = 0;
+                    snprintf(commitId, size, "%s", line + 11);
+                    fclose(file);
+                    return isCommitId(commitId);
+                }
+            }
+            fclose(file);
+        }
+    }
+
+    if (!resolved || !resolved[0]) {
+        return false;
+    }
+    snprintf(commitId, size, "%s", resolved);
+    return true;
+}
+
+static bool isContainedRelativePath(const char* path);
+
+// Copies size bytes from in to out, both at their current offsets. On Linux the kernel
+// moves the data: copy_file_range when out is a regular file (which may share extents),
+// sendfile otherwise. Whatever neither can take, on older kernels or other platforms, goes
+// through one fixed buffer. Returns false on an error or when in ends early.
+static bool streamFileData(int in, int out, long long size) {
+    long long remaining = size;
+#ifdef __linux__
+    while (remaining > 0) {
+        ssize_t copied = syscall(SYS_copy_file_range, in, NULL, out, NULL, (size_t)remaining, 0);
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied <= 0) break;
+        remaining -= copied;
+        traceCount(TRACE_BYTES_READ, (uint64_t)copied);
+    }
+    while (remaining > 0) {
+        ssize_t sent = sendfile(out, in, NULL, (size_t)remaining);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) break;
+        remaining -= sent;
+        traceCount(TRACE_BYTES_READ, (uint64_t)sent);
+    }
+#endif
+    char buffer[STREAM_BUFFER_SIZE];
+    while (remaining > 0) {
+        ssize_t bytesRead = read(in, buffer, remaining < (long long)sizeof(buffer) ? (size_t)remaining : sizeof(buffer));
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) return false;
+        traceCount(TRACE_BYTES_READ, (uint64_t)bytesRead);
+        for (ssize_t written = 0; written < bytesRead;) {
+            ssize_t count = write(out, buffer + written, (size_t)(bytesRead - written));
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return false;
+            written += count;
+        }
+        remaining -= bytesRead;
+    }
+    return true;
+}
+
+static bool streamFileToStdout(const char* path) {
+    int fd = repoOpen(path, O_RDONLY | O_BINARY, 0);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return false;
+    }
+    fflush(stdout);
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    struct stat fileStat;
+    bool ok = fstat(fd, &fileStat) == 0 && streamFileData(fd, STDOUT_FILENO, (long long)fileStat.st_size);
+    if (!ok) {
+        perror("Failed to write file contents");
+    }
+    close(fd);
+    return ok;
+}
+
+// show <rev>:<path> prints a file as it was in a commit, without touching the work tree.
+static bool showFileAtRevision(const char* spec) {
+    const char* colon = strchr(spec, ':');
+    if (!colon || colon == spec || !colon[1]) {
+        fprintf(stderr, "Usage: zengit show <revision>:<path>\n");
+        return false;
+    }
+    char revision[MAX_PATH_LENGTH];
+    snprintf(revision, sizeof(revision), "%.*s", (int)(colon - spec), spec);
+    const char* path = relativeWorkTreePath(colon + 1);
+
+    char commitId[64];
+    if (!resolveRevision(revision, commitId, sizeof(commitId))) {
+        fprintf(stderr, "Error: Unknown revision '%s'.\n", revision);
+        return false;
+    }
+    if (!isContainedRelativePath(path)) {
+        fprintf(stderr, "Error: Invalid path '%s'.\n", path);
+        return false;
+    }
+
+    char filePath[MAX_PATH_LENGTH];
+    snprintf(filePath, sizeof(filePath), "%s/%s/%s", COMMIT_DIR, commitId, path);
+    if (!isFile(filePath)) {
+        fprintf(stderr, "Error: Path '%s' does not exist in commit '%s'.\n", path, commitId);
+        return false;
+    }
+    return streamFileToStdout(filePath);
+}
+
+// One ustar header. Paths longer than the 100-byte name field are split at a '/' into the
+// 155-byte prefix; longer ones get a GNU long name record first.
+static bool writeTarHeader(int out, const char* path, long long size, long long mtime, char type) {
+    char header[TAR_BLOCK_SIZE];
+    memset(header, 0, sizeof(header));
+    size_t length = strlen(path);
+    const char* name = path;
+    size_t prefixLength = 0;
+    if (length > 100) {
+        // The first '/' that leaves at most 100 bytes of name.
+        const char* split = strchr(path + length - 101, '/');
+        if (split && (size_t)(split - path) <= 155 && split[1]) {
+            prefixLength = (size_t)(split - path);
+            name = split + 1;
+        } else if (type != 'L') {
+            // The record's data is the full name, NUL-terminated and padded to a block.
+            if (!writeTarHeader(out, "././@LongLink", (long long)length + 1, 0, 'L')) return false;
+            char padded[TAR_BLOCK_SIZE];
+            for (size_t offset = 0; offset <= length; offset += TAR_BLOCK_SIZE) {
+                memset(padded, 0, sizeof(padded));
+                size_t chunk = length + 1 - offset < TAR_BLOCK_SIZE ? length + 1 - offset : TAR_BLOCK_SIZE;
+                memcpy(padded, path + offset, chunk);
+                if (write(out, padded, sizeof(padded)) != (ssize_t)sizeof(padded)) return false;
+            }
+            name = path + length - 100;
+        }
+    }
+    memcpy(header, name, strlen(name) < 100 ? strlen(name) : 100);
+    snprintf(header + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+    snprintf(header + 108, 8, "%07o", 0);
+    snprintf(header + 116, 8, "%07o", 0);
+    snprintf(header + 124, 12, "%011llo", (unsigned long long)size);
+    snprintf(header + 136, 12, "%011llo", (unsigned long long)mtime);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memcpy(header + 345, path, prefixLength);
+
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) checksum += (unsigned char)header[i];
+    snprintf(header + 148, 8, "%06o", checksum);
+    return write(out, header, sizeof(header)) == (ssize_t)sizeof(header);
+}
+
+// archive <rev> [-o <file>] writes the commit's snapshot as a tar to file or stdout, in
+// manifest order, without touching the work tree. Sizes come from the manifest, every entry
+// gets the commit's time, and file data is streamed with streamFileData, so memory does
+// not grow with the size of the files.
+static bool archiveRevision(const char* revision, const char* outputPath) {
+    char commitId[64];
+    if (!resolveRevision(revision, commitId, sizeof(commitId))) {
+        fprintf(stderr, "Error: Unknown revision '%s'.\n", revision);
+        return false;
+    }
+    Manifest manifest;
+    if (!loadCommitManifest(commitId, &manifest)) {
+        fprintf(stderr, "Error: Commit ID '%s' does not exist.\n", commitId);
+        return false;
+    }
+    char commitDirPath[MAX_PATH_LENGTH];
+    snprintf(commitDirPath, sizeof(commitDirPath), "%s/%s", COMMIT_DIR, commitId);
+    struct stat dirStat;
+    long long mtime = repoStat(commitDirPath, &dirStat) == 0 ? (long long)dirStat.st_mtime : 0;
+
+    int out = STDOUT_FILENO;
+    if (outputPath) {
+        out = repoOpen(outputPath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+        if (out < 0) {
+            fprintf(stderr, "Error: Cannot write '%s': %s\n", outputPath, strerror(errno));
+            freeManifest(&manifest);
+            return false;
+        }
+    } else {
+        fflush(stdout);
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    }
+
+    zengitTraceBegin("archive");
+    bool ok = true;
+    static const char zeros[TAR_BLOCK_SIZE * 2];
+    for (int i = 0; ok && i < manifest.count; i++) {
+        const ManifestEntry* entry = &manifest.entries[i];
+        char filePath[MAX_PATH_LENGTH];
+        if (!formatPath(filePath, sizeof(filePath), "%s/%s", commitDirPath, entry->path)) {
+            ok = false;
+            break;
+        }
+        int in = repoOpen(filePath, O_RDONLY | O_BINARY, 0);
+        if (in < 0) {
+            fprintf(stderr, "Error: Cannot read '%s' from commit '%s'.\n", entry->path, commitId);
+            ok = false;
+            break;
+        }
+        ok = writeTarHeader(out, entry->path, entry->size, mtime, '0') && streamFileData(in, out, entry->size);
+        close(in);
+        size_t padding = (size_t)((TAR_BLOCK_SIZE - entry->size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+        ok = ok && (padding == 0 || write(out, zeros, padding) == (ssize_t)padding);
+        if (!ok) {
+            fprintf(stderr, "Error: Failed to archive '%s'.\n", entry->path);
+        }
+    }
+    ok = ok && write(out, zeros, sizeof(zeros)) == (ssize_t)sizeof(zeros);
+    zengitTraceEnd();
+
+    if (outputPath && close(out) != 0) {
+        ok = false;
+    }
+    if (!ok && outputPath) {
+        repoRemove(outputPath);
+    }
+    freeManifest(&manifest);
+    return ok;
+}
+
+typedef struct {
+    char* data;
+    size_t size;
+    bool mapped;
+    int numLines;
+    size_t* lineOffsets;
+    int* lineIds;
+} DiffFile;
+
+static void freeDiffFile(DiffFile* file) {
+    if (file->mapped) {
+#ifndef _WIN32
+        munmap(file->data, file->size);
+#endif
+    } else {
+        free(file->data);
+    }
+    free(file->lineOffsets);
+    free(file->lineIds);
+    memset(file, 0, sizeof(*file));
+}
+
+// A missing file (added or deleted side of a diff) is loaded as empty. Outside Windows the
+// file is mapped instead of read, so it is never copied onto the heap and only the pages
+// the line scan touches are brought in.
+static bool loadDiffFile(const char* path, DiffFile* file) {
+    memset(file, 0, sizeof(*file));
+    if (path) {
+        FILE* fp = repoFopen(path, "rb");
+        if (!fp) {
+            return false;
+        }
+        fseek(fp, 0, SEEK_END);
+        long length = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        size_t size = length > 0 ? (size_t)length : 0;
+#ifndef _WIN32
+        if (size > 0) {
+            void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+            if (mapped != MAP_FAILED) {
+                file->data = mapped;
+                file->size = size;
+                file->mapped = true;
+            }
+        }
+#endif
+        if (!file->mapped) {
+            file->data = malloc(size > 0 ? size : 1);
+            if (!file->data) {
+                fclose(fp);
+                return false;
+            }
+            file->size = fread(file->data, 1, size, fp);
+        }
+        fclose(fp);
+        traceCount(TRACE_BYTES_READ, file->size);
+    }
+
+    int lines = 0;
+    for (size_t i = 0; i < file->size; i++) {
+        if (file->data[i] == '\n') lines++;
+    }
+    if (file->size > 0 && file->data[file->size - 1] != '\n') lines++;
+
+    file->lineOffsets = malloc((lines + 1) * sizeof(size_t));
+    file->lineIds = malloc((lines > 0 ? lines : 1) * sizeof(int));
+    if (!file->lineOffsets || !file->lineIds) {
+        freeDiffFile(file);
+        return false;
+    }
+
+    file->lineOffsets[0] = 0;
+    int line = 0;
+    for (size_t i = 0; i < file->size; i++) {
+        if (file->data[i] == '\n') {
+            file->lineOffsets[++line] = i + 1;
+        }
+    }
+    file->lineOffsets[lines] = file->size;
+    file->numLines = lines;
+    return true;
+}
+
+static bool isBinaryDiffFile(const DiffFile* file) {
+    size_t limit = file->size < 8000 ? file->size : 8000;
+    return limit > 0 && memchr(file->data, '\0', limit) != NULL;
+}
+
+static const char* diffLine(const DiffFile* file, int line, size_t* length) {
+    *length = file->lineOffsets[line + 1] - file->lineOffsets[line];
+    return file->data + file->lineOffsets[line];
+}
+
+// Maps every distinct line of both files to a small integer so the diff itself only ever
+// compares ints. Identical lines in a and b share an ID.
+static bool internDiffLines(DiffFile* a, DiffFile* b) {
+    size_t totalLines = (size_t)a->numLines + b->numLines;
+    size_t capacity = 16;
+    while (capacity < totalLines * 2) capacity <<= 1;
+
+    int* slots = malloc(capacity * sizeof(int));
+    uint64_t* slotHashes = malloc(capacity * sizeof(uint64_t));
+    const char** idLines = malloc((totalLines + 1) * sizeof(char*));
+    size_t* idLengths = malloc((totalLines + 1) * sizeof(size_t));
+    if (!slots || !slotHashes || !idLines || !idLengths) {
+        free(slots);
+        free(slotHashes);
+        free(idLines);
+        free(idLengths);
+        return false;
+    }
+    for (size_t i = 0; i < capacity; i++) slots[i] = -1;
+
+    int nextId = 0;
+    DiffFile* files[2] = { a, b };
+    for (int f = 0; f < 2; f++) {
+        for (int line = 0; line < files[f]->numLines; line++) {
+            size_t length;
+            const char* text = diffLine(files[f], line, &length);
+            uint64_t hash = hashBytes(FNV_OFFSET_BASIS, (const unsigned char*)text, length);
+            size_t slot = (size_t)hash & (capacity - 1);
+            while (slots[slot] >= 0) {
+                int id = slots[slot];
+                if (slotHashes[slot] == hash && idLengths[id] == length && memcmp(idLines[id], text, length) == 0) {
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+            if (slots[slot] < 0) {
+                slots[slot] = nextId;
+                slotHashes[slot] = hash;
+                idLines[nextId] = text;
+                idLengths[nextId] = length;
+                nextId++;
+            }
+            files[f]->lineIds[line] = slots[slot];
+        }
+    }
+
+    free(slots);
+    free(slotHashes);
+    free(idLines);
+    free(idLengths);
+    return true;
+}
+
+typedef struct {
+    const int* a;
+    const int* b;
+    const int* aLines;             // line numbers in the files of a's and b's entries
+    const int* bLines;
+    char* deleted;
+    char* inserted;
+    int* forward;
+    int* backward;
+    int maxCost;
+} DiffContext;
+
+// Myers' middle snake: runs the greedy forward and backward searches for an optimal edit
+// path at the same time and stops where they overlap. forward/backward are indexed by
+// diagonal (x - y) and only need O(N + M) space. Once the searches have taken maxCost
+// steps without meeting, the split is made at whichever end reached furthest instead, as
+// GNU diff and xdiff do: the result stops being minimal, but the time stops growing with
+// the square of the size of a change.
+static void findMiddleSnake(DiffContext* ctx, int xoff, int xlim, int yoff, int ylim, int* xmid, int* ymid) {
+    int* fd = ctx->forward;
+    int* bd = ctx->backward;
+    const int dmin = xoff - ylim;
+    const int dmax = xlim - yoff;
+    const int fmid = xoff - yoff;
+    const int bmid = xlim - ylim;
+    int fmin = fmid, fmax = fmid;
+    int bmin = bmid, bmax = bmid;
+    const bool odd = ((fmid - bmid) & 1) != 0;
+
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+
+    for (int cost = 1;; cost++) {
+        if (fmin > dmin) fd[--fmin - 1] = -1; else ++fmin;
+        if (fmax < dmax) fd[++fmax + 1] = -1; else --fmax;
+        for (int d = fmax; d >= fmin; d -= 2) {
+            int tlo = fd[d - 1], thi = fd[d + 1];
+            int x = tlo >= thi ? tlo + 1 : thi;
+            int y = x - d;
+            while (x < xlim && y < ylim && ctx->a[x] == ctx->b[y]) {
+                x++;
+                y++;
+            }
+            fd[d] = x;
+            if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+
+        if (bmin > dmin) bd[--bmin - 1] = INT32_MAX; else ++bmin;
+        if (bmax < dmax) bd[++bmax + 1] = INT32_MAX; else --bmax;
+        for (int d = bmax; d >= bmin; d -= 2) {
+            int tlo = bd[d - 1], thi = bd[d + 1];
+            int x = tlo < thi ? tlo : thi - 1;
+            int y = x - d;
+            while (x > xoff && y > yoff && ctx->a[x - 1] == ctx->b[y - 1]) {
+                x--;
+                y--;
+            }
+            bd[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+                *xmid = x;
+                *ymid = y;
+                return;
+            }
+        }
+
+        if (cost >= ctx->maxCost) {
+            int forwardBest = -1, forwardX = xoff;
+            for (int d = fmax; d >= fmin; d -= 2) {
+                int x = fd[d] < xlim ? fd[d] : xlim;
+                int y = x - d;
+                if (y > ylim) {
+                    x = ylim + d;
+                    y = ylim;
+                }
+                if (x + y > forwardBest) {
+                    forwardBest = x + y;
+                    forwardX = x;
+                }
+            }
+            int backwardBest = INT32_MAX, backwardX = xlim;
+            for (int d = bmax; d >= bmin; d -= 2) {
+                int x = bd[d] > xoff ? bd[d] : xoff;
+                int y = x - d;
+                if (y < yoff) {
+                    x = yoff + d;
+                    y = yoff;
+                }
+                if (x + y < backwardBest) {
+                    backwardBest = x + y;
+                    backwardX = x;
+                }
+            }
+            if ((xlim + ylim) - backwardBest < forwardBest - (xoff + yoff)) {
+                *xmid = forwardX;
+                *ymid = forwardBest - forwardX;
+            } else {
+                *xmid = backwardX;
+                *ymid = backwardBest - backwardX;
+            }
+            return;
+        }
+    }
+}
+
+static void compareSequences(DiffContext* ctx, int xoff, int xlim, int yoff, int ylim) {
+    while (xoff < xlim && yoff < ylim && ctx->a[xoff] == ctx->b[yoff]) {
+        xoff++;
+        yoff++;
+    }
+    while (xlim > xoff && ylim > yoff && ctx->a[xlim - 1] == ctx->b[ylim - 1]) {
+        xlim--;
+        ylim--;
+    }
+
+    if (xoff == xlim) {
+        while (yoff < ylim) ctx->inserted[ctx->bLines[yoff++]] = 1;
+    } else if (yoff == ylim) {
+        while (xoff < xlim) ctx->deleted[ctx->aLines[xoff++]] = 1;
+    } else {
+        int xmid, ymid;
+        findMiddleSnake(ctx, xoff, xlim, yoff, ylim, &xmid, &ymid);
+        compareSequences(ctx, xoff, xmid, yoff, ymid);
+        compareSequences(ctx, xmid, xlim, ymid, ylim);
+    }
+}
+
+// Keeps the lines of one file whose ID also occurs in the other and marks the rest as
+// changed, since no common subsequence can use them. Returns the number kept.
+static int keepSharedLines(const DiffFile* file, const unsigned char* occurs, unsigned char other, int* ids, int* lines,
+                    char* changed) {
+    int kept = 0;
+    for (int line = 0; line < file->numLines; line++) {
+        int id = file->lineIds[line];
+        if (occurs[id] & other) {
+            ids[kept] = id;
+            lines[kept++] = line;
+        } else {
+            changed[line] = 1;
+        }
+    }
+    return kept;
+}
+
+// Marks deleted lines of a and inserted lines of b. Both flag arrays are allocated here
+// and owned by the caller. Lines found in only one file are marked first and left out of
+// the search, which on a rewrite is most of them.
+static bool diffLineSequences(const DiffFile* a, const DiffFile* b, char** deleted, char** inserted) {
+    size_t totalLines = (size_t)a->numLines + b->numLines;
+    *deleted = calloc(a->numLines + 1, 1);
+    *inserted = calloc(b->numLines + 1, 1);
+    unsigned char* occurs = calloc(totalLines + 1, 1);
+    int* ids = malloc((totalLines + 1) * sizeof(int));
+    int* lines = malloc((totalLines + 1) * sizeof(int));
+    int* forward = malloc((totalLines + 3) * sizeof(int));
+    int* backward = malloc((totalLines + 3) * sizeof(int));
+    bool ok = *deleted && *inserted && occurs && ids && lines && forward && backward;
+    if (ok) {
+        for (int line = 0; line < a->numLines; line++) occurs[a->lineIds[line]] |= 1;
+        for (int line = 0; line < b->numLines; line++) occurs[b->lineIds[line]] |= 2;
+        int aCount = keepSharedLines(a, occurs, 2, ids, lines, *deleted);
+        int bCount = keepSharedLines(b, occurs, 1, ids + aCount, lines + aCount, *inserted);
+
+        int maxCost = 1;
+        for (size_t diagonals = (size_t)aCount + bCount + 3; diagonals != 0; diagonals >>= 2) maxCost <<= 1;
+        DiffContext ctx = { ids, ids + aCount, lines, lines + aCount, *deleted, *inserted,
+                            forward + bCount + 1, backward + bCount + 1,
+                            maxCost > DIFF_MIN_COST ? maxCost : DIFF_MIN_COST };
+        compareSequences(&ctx, 0, aCount, 0, bCount);
+    } else {
+        free(*deleted);
+        free(*inserted);
+        *deleted = *inserted = NULL;
+    }
+    free(occurs);
+    free(ids);
+    free(lines);
+    free(forward);
+    free(backward);
+    return ok;
+}
+
+static void printDiffLine(char prefix, const DiffFile* file, int line) {
+    size_t length;
+    const char* text = diffLine(file, line, &length);
+    putchar(prefix);
+    fwrite(text, 1, length, stdout);
+    if (length == 0 || text[length - 1] != '\n') {
+        printf("\n\\ No newline at end of file\n");
+    }
+}
+
+typedef struct {
+    int aStart, aEnd;
+    int bStart, bEnd;
+} DiffBlock;
+
+// Turns the per-line flags into runs of changed lines; the caller frees the result.
+static DiffBlock* collectDiffBlocks(const DiffFile* a, const DiffFile* b, const char* deleted, const char* inserted,
+                             int* count) {
+    DiffBlock* blocks = NULL;
+    int numBlocks = 0, capacity = 0;
+
+    int i = 0, j = 0;
+    while (i < a->numLines || j < b->numLines) {
+        if ((i < a->numLines && deleted[i]) || (j < b->numLines && inserted[j])) {
+            DiffBlock block = { i, i, j, j };
+            while (i < a->numLines && deleted[i]) i++;
+            while (j < b->numLines && inserted[j]) j++;
+            block.aEnd = i;
+            block.bEnd = j;
+            if (numBlocks == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                DiffBlock* resized = realloc(blocks, capacity * sizeof(DiffBlock));
+                if (!resized) {
+                    free(blocks);
+                    *count = 0;
+                    return NULL;
+                }
+                blocks = resized;
+            }
+            blocks[numBlocks++] = block;
+        } else {
+            i++;
+            j++;
+        }
+    }
+
+    *count = numBlocks;
+    return blocks;
+}
+
+static void printUnifiedHunks(const DiffFile* a, const DiffFile* b, const char* deleted, const char* inserted) {
+    int numBlocks;
+    DiffBlock* blocks = collectDiffBlocks(a, b, deleted, inserted, &numBlocks);
+
+    int first = 0;
+    while (first < numBlocks) {
+        int last = first;
+        while (last + 1 < numBlocks && blocks[last + 1].aStart - blocks[last].aEnd <= 2 * DIFF_CONTEXT_LINES) {
+            last++;
+        }
+
+        int aStart = blocks[first].aStart - DIFF_CONTEXT_LINES;
+        if (aStart < 0) aStart = 0;
+        int bStart = blocks[first].bStart - (blocks[first].aStart - aStart);
+        int aEnd = blocks[last].aEnd + DIFF_CONTEXT_LINES;
+        if (aEnd > a->numLines) aEnd = a->numLines;
+        int bEnd = blocks[last].bEnd + (aEnd - blocks[last].aEnd);
+
+        printf("@@ -%d,%d +%d,%d @@\n",
+               aEnd > aStart ? aStart + 1 : aStart, aEnd - aStart,
+               bEnd > bStart ? bStart + 1 : bStart, bEnd - bStart);
+
+        int line = aStart;
+        for (int k = first; k <= last; k++) {
+            for (; line < blocks[k].aStart; line++) printDiffLine(' ', a, line);
+            for (int d = blocks[k].aStart; d < blocks[k].aEnd; d++) printDiffLine('-', a, d);
+            for (int n = blocks[k].bStart; n < blocks[k].bEnd; n++) printDiffLine('+', b, n);
+            line = blocks[k].aEnd;
+        }
+        for (; line < aEnd; line++) printDiffLine(' ', a, line);
+
+        first = last + 1;
+    }
+
+    free(blocks);
+}
+
+// Either path may be NULL for a file that only exists on one side. A non-negative
+// similarity marks a detected rename or copy from oldName to newName.
+static void diffFiles(const char* oldPath, const char* newPath, const char* oldName, const char* newName,
+               int similarity, bool isCopy) {
+    DiffFile a, b;
+    if (!loadDiffFile(oldPath, &a)) {
+        fprintf(stderr, "Failed to read %s\n", oldPath);
+        return;
+    }
+    if (!loadDiffFile(newPath, &b)) {
+        fprintf(stderr, "Failed to read %s\n", newPath);
+        freeDiffFile(&a);
+        return;
+    }
+
+    printf("diff --zengit a/%s b/%s\n", oldName, newName);
+    if (similarity >= 0) {
+        printf("similarity index %d%%\n", similarity);
+        printf("%s from %s\n%s to %s\n", isCopy ? "copy" : "rename", oldName, isCopy ? "copy" : "rename", newName);
+    }
+    if (similarity == 100) {
+        // Content is identical; the header says everything.
+    } else if (isBinaryDiffFile(&a) || isBinaryDiffFile(&b)) {
+        printf("Binary files differ\n");
+    } else {
+        printf("--- %s%s\n", oldPath ? "a/" : "/dev/null", oldPath ? oldName : "");
+        printf("+++ %s%s\n", newPath ? "b/" : "/dev/null", newPath ? newName : "");
+
+        char* deleted = NULL;
+        char* inserted = NULL;
+        if (internDiffLines(&a, &b) && diffLineSequences(&a, &b, &deleted, &inserted)) {
+            printUnifiedHunks(&a, &b, deleted, inserted);
+        } else {
+            fprintf(stderr, "Not enough memory to diff %s\n", newName);
+        }
+        free(deleted);
+        free(inserted);
+    }
+
+    freeDiffFile(&a);
+    freeDiffFile(&b);
+}
+
+typedef struct {
+    char root[MAX_PATH_LENGTH];
+    Manifest manifest;
+} DiffSide;
+
+static bool loadDiffSideFromRevision(const char* revision, DiffSide* side) {
+    char commitId[64];
+    if (!resolveRevision(revision, commitId, sizeof(commitId))) {
+        fprintf(stderr, "Error: Unknown revision '%s'.\n", revision);
+        return false;
+    }
+    snprintf(side->root, sizeof(side->root), "%s/%s", COMMIT_DIR, commitId);
+    return loadCommitManifest(commitId, &side->manifest);
+}
+
+static void loadDiffSideFromHead(DiffSide* side) {
+    char* lastCommitId = getLastCommitId(getCurrentBranch());
+    memset(&side->manifest, 0, sizeof(side->manifest));
+    snprintf(side->root, sizeof(side->root), "%s/%s", COMMIT_DIR, lastCommitId ? lastCommitId : "");
+    if (lastCommitId && lastCommitId[0]) {
+        loadCommitManifest(lastCommitId, &side->manifest);
+        refreshSparseCheckout();
+        filterSparseManifest(&side->manifest);
+    }
+}
+
+static void loadDiffSideFromWorkTree(DiffSide* side) {
+    snprintf(side->root, sizeof(side->root), ".");
+    buildWorkTreeManifest(&side->manifest);
+}
+
+static bool isPathUnderStagedEntry(const char* path, char** stagedPaths, int numStaged) {
+    for (int i = 0; i < numStaged; i++) {
+        size_t length = strlen(stagedPaths[i]);
+        if (strncmp(path, stagedPaths[i], length) == 0 && (path[length] == '\0' || path[length] == '/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drops every entry that is not covered by a path listed in the index.
+static void restrictManifestToIndex(Manifest* manifest) {
+    char** stagedPaths = NULL;
+    int numStaged = 0, capacity = 0;
+
+    FILE* index = repoFopen(INDEX_FILE, "r");
+    if (index) {
+        char line[MAX_PATH_LENGTH];
+        while (fgets(line, sizeof(line), index)) {
+            line[strcspn(line, "\n")] = 0;
+            normalizePath(line);
+            size_t length = strlen(line);
+            while (length > 0 && line[length - 1] == '/') line[--length] = '\0';
+            if (length == 0) continue;
+            if (numStaged == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                stagedPaths = realloc(stagedPaths, capacity * sizeof(char*));
+            }
+            stagedPaths[numStaged++] = strdup(line);
+        }
+        fclose(index);
+    }
+
+    int kept = 0;
+    for (int i = 0; i < manifest->count; i++) {
+        if (isPathUnderStagedEntry(manifest->entries[i].path, stagedPaths, numStaged)) {
+            manifest->entries[kept++] = manifest->entries[i];
+        }
+    }
+    manifest->count = kept;
+
+    for (int i = 0; i < numStaged; i++) free(stagedPaths[i]);
+    free(stagedPaths);
+}
+
+// Walks both sorted manifests together. Entries whose content hashes match are skipped
+// without opening either file; work tree entries are only hashed when sizes are equal.
+// Files that only exist on one side are paired up as renames before anything is printed.
+static void diffTrees(DiffSide* oldSide, DiffSide* newSide) {
+    int capacity = oldSide->manifest.count + newSide->manifest.count + 1;
+    RenameSource* deleted = malloc(capacity * sizeof(RenameSource));
+    ManifestEntry** added = malloc(capacity * sizeof(ManifestEntry*));
+    int* renameOf = malloc(capacity * sizeof(int));
+    if (!deleted || !added || !renameOf) {
+        free(deleted);
+        free(added);
+        free(renameOf);
+        return;
+    }
+
+    int numDeleted = 0, numAdded = 0;
+    for (int i = 0, j = 0; i < oldSide->manifest.count || j < newSide->manifest.count;) {
+        int order = i >= oldSide->manifest.count ? 1 : j >= newSide->manifest.count ? -1 :
+                    strcmp(oldSide->manifest.entries[i].path, newSide->manifest.entries[j].path);
+        if (order < 0) {
+            deleted[numDeleted++] = (RenameSource){ &oldSide->manifest.entries[i++], false, false };
+        } else if (order > 0) {
+            added[numAdded++] = &newSide->manifest.entries[j++];
+        } else {
+            i++;
+            j++;
+        }
+    }
+
+    RenamePair* pairs = NULL;
+    int numPairs = numAdded > 0 && numDeleted > 0 ?
+                   detectRenames(deleted, numDeleted, oldSide->root, added, numAdded, newSide->root, &pairs) : 0;
+    for (int i = 0; i < numAdded; i++) renameOf[i] = -1;
+    for (int p = 0; p < numPairs; p++) renameOf[pairs[p].target] = p;
+
+    char oldPath[MAX_PATH_LENGTH];
+    char newPath[MAX_PATH_LENGTH];
+    int deletedIndex = 0, addedIndex = 0;
+    int i = 0, j = 0;
+    while (i < oldSide->manifest.count || j < newSide->manifest.count) {
+        ManifestEntry* oldEntry = i < oldSide->manifest.count ? &oldSide->manifest.entries[i] : NULL;
+        ManifestEntry* newEntry = j < newSide->manifest.count ? &newSide->manifest.entries[j] : NULL;
+        int order = !oldEntry ? 1 : !newEntry ? -1 : strcmp(oldEntry->path, newEntry->path);
+
+        if (order < 0) {
+            if (!deleted[deletedIndex++].used &&
+                formatPath(oldPath, sizeof(oldPath), "%s/%s", oldSide->root, oldEntry->path)) {
+                diffFiles(oldPath, NULL, oldEntry->path, oldEntry->path, -1, false);
+            }
+            i++;
+        } else if (order > 0) {
+            int pair = renameOf[addedIndex++];
+            bool newPathFits = formatPath(newPath, sizeof(newPath), "%s/%s", newSide->root, newEntry->path);
+            if (newPathFits && pair >= 0) {
+                const ManifestEntry* source = deleted[pairs[pair].source].entry;
+                if (formatPath(oldPath, sizeof(oldPath), "%s/%s", oldSide->root, source->path)) {
+                    diffFiles(oldPath, newPath, source->path, newEntry->path, pairs[pair].similarity, pairs[pair].isCopy);
+                }
+            } else if (newPathFits) {
+                diffFiles(NULL, newPath, newEntry->path, newEntry->path, -1, false);
+            }
+            j++;
+        } else {
+            bool same = oldEntry->size == newEntry->size &&
+                        ensureManifestEntryHashed(oldEntry, oldSide->root) &&
+                        ensureManifestEntryHashed(newEntry, newSide->root) &&
+                        oldEntry->hash == newEntry->hash;
+            if (!same && formatPath(oldPath, sizeof(oldPath), "%s/%s", oldSide->root, oldEntry->path) &&
+                formatPath(newPath, sizeof(newPath), "%s/%s", newSide->root, newEntry->path)) {
+                diffFiles(oldPath, newPath, newEntry->path, newEntry->path, -1, false);
+            }
+            i++;
+            j++;
+        }
+    }
+
+    free(pairs);
+    free(deleted);
+    free(added);
+    free(renameOf);
+}
+
+static bool handleDiffCommand(int argc, char* argv[]) {
+    DiffSide oldSide, newSide;
+    memset(&oldSide, 0, sizeof(oldSide));
+    memset(&newSide, 0, sizeof(newSide));
+
+    if (argc == 2) {
+        loadDiffSideFromHead(&oldSide);
+        loadDiffSideFromWorkTree(&newSide);
+    } else if (argc == 3 && strcmp(argv[2], "-staged") == 0) {
+        loadDiffSideFromHead(&oldSide);
+        loadDiffSideFromWorkTree(&newSide);
+        zengitTraceBegin("index load");
+        restrictManifestToIndex(&oldSide.manifest);
+        restrictManifestToIndex(&newSide.manifest);
+        zengitTraceEnd();
+    } else if (argc == 3) {
+        if (!loadDiffSideFromRevision(argv[2], &oldSide)) {
+            return false;
+        }
+        loadDiffSideFromWorkTree(&newSide);
+    } else if (argc == 4) {
+        if (!loadDiffSideFromRevision(argv[2], &oldSide)) {
+            return false;
+        }
+        if (!loadDiffSideFromRevision(argv[3], &newSide)) {
+            freeManifest(&oldSide.manifest);
+            return false;
+        }
+    } else {
+        fprintf(stderr, "Usage: %s diff [-staged | <commit> | <commit> <commit>]\n", argv[0]);
+        return false;
+    }
+
+    zengitTraceBegin("compare");
+    diffTrees(&oldSide, &newSide);
+    zengitTraceEnd();
+
+    if (argc == 2 || (argc == 3 && strcmp(argv[2], "-staged") != 0)) {
+        saveFsMonitorState(&newSide.manifest);
+    }
+    freeManifest(&oldSide.manifest);
+    freeManifest(&newSide.manifest);
+    return true;
+}
+
+typedef struct {
+    StringTable nodes;
+    char** ids;
+    int (*parents)[2];
+    int count;
+    int capacity;
+} CommitGraph;
+
+static int commitGraphNode(CommitGraph* graph, const char* commitId) {
+    int* existing = stringTableFind(&graph->nodes, commitId);
+    if (existing) {
+        return *existing;
+    }
+
+    if (graph->count == graph->capacity) {
+        int capacity = graph->capacity ? graph->capacity * 2 : 64;
+        char** ids = realloc(graph->ids, capacity * sizeof(char*));
+        if (!ids) return -1;
+        graph->ids = ids;
+        int (*parents)[2] = realloc(graph->parents, capacity * sizeof(*parents));
+        if (!parents) return -1;
+        graph->parents = parents;
+        graph->capacity = capacity;
+    }
+
+    int node = graph->count++;
+    graph->ids[node] = strdup(commitId);
+    graph->parents[node][0] = graph->parents[node][1] = -1;
+    stringTablePut(&graph->nodes, commitId, node);
+    return node;
+}
+
+static void commitGraphAddParent(CommitGraph* graph, int child, int parent) {
+    if (child < 0 || parent < 0 || child == parent) return;
+    for (int i = 0; i < 2; i++) {
+        if (graph->parents[child][i] == parent) return;
+        if (graph->parents[child][i] < 0) {
+            graph->parents[child][i] = parent;
+            return;
+        }
+    }
+}
+
+static void freeCommitGraph(CommitGraph* graph) {
+    for (int i = 0; i < graph->count; i++) free(graph->ids[i]);
+    free(graph->ids);
+    free(graph->parents);
+    stringTableFree(&graph->nodes);
+    memset(graph, 0, sizeof(*graph));
+}
+
+static bool hasSuffix(const char* text, const char* suffix) {
+    size_t textLength = strlen(text), suffixLength = strlen(suffix);
+    return textLength >= suffixLength && strcmp(text + textLength - suffixLength, suffix) == 0;
+}
+
+// Each <branch>_HEAD file lists that branch's commits in order, so consecutive lines
+// are child/parent pairs. Merge commits add their second parent via a .parents file.
+static bool loadCommitGraph(CommitGraph* graph) {
+    memset(graph, 0, sizeof(*graph));
+    if (!stringTableInit(&graph->nodes, 64)) {
+        return false;
+    }
+
+    DIR* dir = repoOpendir(COMMIT_DIR);
+    if (!dir) {
+        return false;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        bool isHeadFile = hasSuffix(entry->d_name, "_HEAD");
+        bool isParentsFile = hasSuffix(entry->d_name, PARENTS_SUFFIX);
+        if (!isHeadFile && !isParentsFile) continue;
+
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/%s", COMMIT_DIR, entry->d_name);
+        FILE* file = repoFopen(path, "r");
+        if (!file) continue;
+
+        int child = -1;
+        if (isParentsFile) {
+            char commitId[MAX_PATH_LENGTH];
+            snprintf(commitId, sizeof(commitId), "%.*s", (int)(strlen(entry->d_name) - strlen(PARENTS_SUFFIX)), entry->d_name);
+            child = commitGraphNode(graph, commitId);
+        }
+
+        char line[MAX_PATH_LENGTH];
+        int previous = -1;
+        while (fgets(line, sizeof(line), file)) {
+            line[strcspn(line, "\n")] = 0;
+            if (!line[0]) continue;
+            int node = commitGraphNode(graph, line);
+            if (isParentsFile) {
+                commitGraphAddParent(graph, child, node);
+            } else {
+                commitGraphAddParent(graph, node, previous);
+                previous = node;
+            }
+        }
+        fclose(file);
+    }
+
+    closedir(dir);
+    return true;
+}
+
+// Breadth-first from both tips: everything reachable from ours is marked, then the
+// first marked commit reached from theirs is the closest common ancestor.
+static bool findMergeBase(CommitGraph* graph, const char* ours, const char* theirs, char* mergeBase, size_t size) {
+    int* oursNode = stringTableFind(&graph->nodes, ours);
+    int* theirsNode = stringTableFind(&graph->nodes, theirs);
+    if (!oursNode || !theirsNode) {
+        return false;
+    }
+
+    char* reachable = calloc(graph->count, 1);
+    char* visited = calloc(graph->count, 1);
+    int* queue = malloc(graph->count * sizeof(int));
+    if (!reachable || !visited || !queue) {
+        free(reachable);
+        free(visited);
+        free(queue);
+        return false;
+    }
+
+    int head = 0, tail = 0;
+    queue[tail++] = *oursNode;
+    reachable[*oursNode] = 1;
+    while (head < tail) {
+        int node = queue[head++];
+        for (int i = 0; i < 2; i++) {
+            int parent = graph->parents[node][i];
+            if (parent >= 0 && !reachable[parent]) {
+                reachable[parent] = 1;
+                queue[tail++] = parent;
+            }
+        }
+    }
+
+    bool found = false;
+    head = tail = 0;
+    queue[tail++] = *theirsNode;
+    visited[*theirsNode] = 1;
+    while (head < tail) {
+        int node = queue[head++];
+        if (reachable[node]) {
+            snprintf(mergeBase, size, "%s", graph->ids[node]);
+            found = true;
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            int parent = graph->parents[node][i];
+            if (parent >= 0 && !visited[parent]) {
+                visited[parent] = 1;
+                queue[tail++] = parent;
+            }
+        }
+    }
+
+    free(reachable);
+    free(visited);
+    free(queue);
+    return found;
+}
+
+static bool isAncestorCommit(const CommitGraph* graph, int ancestor, int node) {
+    char* visited = calloc(graph->count, 1);
+    int* stack = malloc(graph->count * sizeof(int));
+    bool found = false;
+    int depth = 0;
+    if (visited && stack) {
+        stack[depth++] = node;
+        visited[node] = 1;
+    }
+    while (depth > 0 && !found) {
+        int current = stack[--depth];
+        found = current == ancestor;
+        for (int i = 0; i < 2; i++) {
+            int parent = graph->parents[current][i];
+            if (parent >= 0 && !visited[parent]) {
+                visited[parent] = 1;
+                stack[depth++] = parent;
+            }
+        }
+    }
+    free(visited);
+    free(stack);
+    return found;
+}
+
+// A commit's snapshot directory only holds the paths staged for it, so the tree a commit
+// stands for is the newest version of every path on its first-parent line. The walk stops
+// at a merge commit, whose snapshot is the whole merged tree. origins maps each path to
+// the index in snapshotIds of the snapshot that holds it.
+typedef struct {
+    Manifest manifest;
+    StringTable origins;
+    char** snapshotIds;
+    int snapshotCount;
+} CommitTree;
+
+static void freeCommitTree(CommitTree* tree) {
+    freeManifest(&tree->manifest);
+    stringTableFree(&tree->origins);
+    for (int i = 0; i < tree->snapshotCount; i++) free(tree->snapshotIds[i]);
+    free(tree->snapshotIds);
+    memset(tree, 0, sizeof(*tree));
+}
+
+static bool loadCommitTree(const CommitGraph* graph, const char* commitId, CommitTree* tree) {
+    memset(tree, 0, sizeof(*tree));
+    if (!stringTableInit(&tree->origins, 256)) {
+        return false;
+    }
+
+    const int* start = stringTableFind(&graph->nodes, commitId);
+    int node = start ? *start : -1;
+    const char* snapshotId = commitId;
+    bool ok = true;
+    while (ok && snapshotId) {
+        char** ids = realloc(tree->snapshotIds, (tree->snapshotCount + 1) * sizeof(char*));
+        ok = ids != NULL;
+        if (!ok) break;
+        tree->snapshotIds = ids;
+        ok = (ids[tree->snapshotCount] = strdup(snapshotId)) != NULL;
+        if (!ok) break;
+        int origin = tree->snapshotCount++;
+
+        Manifest snapshot;
+        if (loadCommitManifest(snapshotId, &snapshot)) {
+            for (int i = 0; ok && i < snapshot.count; i++) {
+                const ManifestEntry* entry = &snapshot.entries[i];
+                if (!stringTableFind(&tree->origins, entry->path)) {
+                    ok = stringTablePut(&tree->origins, entry->path, origin) &&
+                         addManifestEntry(&tree->manifest, entry->path, entry->hash, entry->size, true);
+                }
+            }
+            freeManifest(&snapshot);
+        }
+
+        char parentsPath[MAX_PATH_LENGTH];
+        snprintf(parentsPath, sizeof(parentsPath), "%s/%s%s", COMMIT_DIR, snapshotId, PARENTS_SUFFIX);
+        if (node < 0 || fileExists(parentsPath)) {
+            break;
+        }
+        // A fast-forward appends the commit to a second branch file, which gives it that
+        // branch's older tip as another parent; the parent it was made on is the newer one.
+        int parent = graph->parents[node][0];
+        int other = graph->parents[node][1];
+        if (parent >= 0 && other >= 0 && isAncestorCommit(graph, parent, other)) {
+            parent = other;
+        }
+        node = parent;
+        snapshotId = node >= 0 ? graph->ids[node] : NULL;
+    }
+    sortManifest(&tree->manifest);
+    if (!ok) {
+        freeCommitTree(tree);
+    }
+    return ok;
+}
+
+// Where the file for entry, a path of the tree, is stored.
+static bool commitTreeFilePath(const CommitTree* tree, const char* path, char* buffer, size_t size) {
+    const int* origin = stringTableFind(&tree->origins, path);
+    if (!origin) {
+        fprintf(stderr, "Error: '%s' is not in the tree.\n", path);
+        return false;
+    }
+    return formatPath(buffer, size, "%s/%s/%s", COMMIT_DIR, tree->snapshotIds[*origin], path);
+}
+
+static void appendDiffLines(ByteBuffer* out, const DiffFile* file, int start, int end) {
+    if (end > start) {
+        appendBytes(out, file->data + file->lineOffsets[start], file->lineOffsets[end] - file->lineOffsets[start]);
+    }
+}
+
+static void appendConflictMarker(ByteBuffer* out, const char* marker) {
+    if (out->size > 0 && out->data[out->size - 1] != '\n') {
+        appendBytes(out, "\n", 1);
+    }
+    appendBytes(out, marker, strlen(marker));
+}
+
+static bool diffLineRangesEqual(const DiffFile* a, int aStart, int aEnd, const DiffFile* b, int bStart, int bEnd) {
+    size_t aLength = a->lineOffsets[aEnd] - a->lineOffsets[aStart];
+    size_t bLength = b->lineOffsets[bEnd] - b->lineOffsets[bStart];
+    return aLength == bLength && memcmp(a->data + a->lineOffsets[aStart], b->data + b->lineOffsets[bStart], aLength) == 0;
+}
+
+// Line-level three-way merge in the style of diff3: changes from base to each side are
+// computed separately, non-overlapping changes are applied together and overlapping
+// ones become conflict hunks. Returns the number of conflicts, or -1 for binary input.
+static int mergeFileContents(const char* basePath, const char* oursPath, const char* theirsPath,
+                      const char* theirsLabel, ByteBuffer* out) {
+    DiffFile base, ours, theirs;
+    if (!loadDiffFile(basePath, &base)) return -1;
+    if (!loadDiffFile(oursPath, &ours)) {
+        freeDiffFile(&base);
+        return -1;
+    }
+    if (!loadDiffFile(theirsPath, &theirs)) {
+        freeDiffFile(&base);
+        freeDiffFile(&ours);
+        return -1;
+    }
+
+    int conflicts = -1;
+    char *oursDeleted = NULL, *oursInserted = NULL, *theirsDeleted = NULL, *theirsInserted = NULL;
+    DiffBlock *oursBlocks = NULL, *theirsBlocks = NULL;
+    int numOurs = 0, numTheirs = 0;
+
+    if (isBinaryDiffFile(&base) || isBinaryDiffFile(&ours) || isBinaryDiffFile(&theirs) ||
+        !internDiffLines(&base, &ours) || !diffLineSequences(&base, &ours, &oursDeleted, &oursInserted) ||
+        !internDiffLines(&base, &theirs) || !diffLineSequences(&base, &theirs, &theirsDeleted, &theirsInserted)) {
+        goto cleanup;
+    }
+
+    oursBlocks = collectDiffBlocks(&base, &ours, oursDeleted, oursInserted, &numOurs);
+    theirsBlocks = collectDiffBlocks(&base, &theirs, theirsDeleted, theirsInserted, &numTheirs);
+
+    conflicts = 0;
+    int basePosition = 0;
+    int oi = 0, ti = 0;
+    while (oi < numOurs || ti < numTheirs) {
+        bool startWithOurs = ti >= numTheirs || (oi < numOurs && oursBlocks[oi].aStart <= theirsBlocks[ti].aStart);
+        const DiffBlock* first = startWithOurs ? &oursBlocks[oi++] : &theirsBlocks[ti++];
+        int regionStart = first->aStart;
+        int regionEnd = first->aEnd;
+        int oursFirst = startWithOurs ? oi - 1 : oi;
+        int theirsFirst = startWithOurs ? ti : ti - 1;
+
+        for (;;) {
+            if (oi < numOurs && oursBlocks[oi].aStart <= regionEnd) {
+                if (oursBlocks[oi].aEnd > regionEnd) regionEnd = oursBlocks[oi].aEnd;
+                oi++;
+            } else if (ti < numTheirs && theirsBlocks[ti].aStart <= regionEnd) {
+                if (theirsBlocks[ti].aEnd > regionEnd) regionEnd = theirsBlocks[ti].aEnd;
+                ti++;
+            } else {
+                break;
+            }
+        }
+
+        appendDiffLines(out, &base, basePosition, regionStart);
+
+        bool oursChanged = oi > oursFirst;
+        bool theirsChanged = ti > theirsFirst;
+        int oursStart = 0, oursEnd = 0, theirsStart = 0, theirsEnd = 0;
+        if (oursChanged) {
+            oursStart = regionStart + (oursBlocks[oursFirst].bStart - oursBlocks[oursFirst].aStart);
+            oursEnd = regionEnd + (oursBlocks[oi - 1].bEnd - oursBlocks[oi - 1].aEnd);
+        }
+        if (theirsChanged) {
+            theirsStart = regionStart + (theirsBlocks[theirsFirst].bStart - theirsBlocks[theirsFirst].aStart);
+            theirsEnd = regionEnd + (theirsBlocks[ti - 1].bEnd - theirsBlocks[ti - 1].aEnd);
+        }
+
+        if (!theirsChanged) {
+            appendDiffLines(out, &ours, oursStart, oursEnd);
+        } else if (!oursChanged || diffLineRangesEqual(&ours, oursStart, oursEnd, &theirs, theirsStart, theirsEnd)) {
+            appendDiffLines(out, &theirs, theirsStart, theirsEnd);
+        } else {
+            char closingMarker[MAX_PATH_LENGTH];
+            snprintf(closingMarker, sizeof(closingMarker), ">>>>>>> %s\n", theirsLabel);
+            appendConflictMarker(out, "<<<<<<< HEAD\n");
+            appendDiffLines(out, &ours, oursStart, oursEnd);
+            appendConflictMarker(out, "=======\n");
+            appendDiffLines(out, &theirs, theirsStart, theirsEnd);
+            appendConflictMarker(out, closingMarker);
+            conflicts++;
+        }
+
+        basePosition = regionEnd;
+    }
+    appendDiffLines(out, &base, basePosition, base.numLines);
+
+cleanup:
+    free(oursBlocks);
+    free(theirsBlocks);
+    free(oursDeleted);
+    free(oursInserted);
+    free(theirsDeleted);
+    free(theirsInserted);
+    freeDiffFile(&base);
+    freeDiffFile(&ours);
+    freeDiffFile(&theirs);
+    return conflicts;
+}
+
+enum {
+    MERGE_FROM_OURS,
+    MERGE_FROM_THEIRS,
+    MERGE_FROM_CONTENT
+};
+
+typedef struct {
+    const char* path;             // borrowed from the base, ours or theirs manifest
+    uint64_t hash;
+    long long size;
+    int source;
+    bool conflicted;
+    ByteBuffer content;
+} MergeResultEntry;
+
+typedef struct {
+    const Manifest* base;
+    const Manifest* ours;
+    const Manifest* theirs;
+    const CommitTree* baseTree;
+    const CommitTree* oursTree;
+    const CommitTree* theirsTree;
+    const char* theirsLabel;
+    MergeResultEntry* entries;
+    int count;
+    int capacity;
+    int conflicts;
+    bool failed;
+} MergeState;
+
+typedef struct {
+    int start;
+    int end;
+} ManifestRange;
+
+static MergeResultEntry* addMergeResult(MergeState* state, const ManifestEntry* entry, int source) {
+    if (state->count == state->capacity) {
+        int capacity = state->capacity ? state->capacity * 2 : 64;
+        MergeResultEntry* resized = realloc(state->entries, capacity * sizeof(MergeResultEntry));
+        if (!resized) return NULL;
+        state->entries = resized;
+        state->capacity = capacity;
+    }
+
+    MergeResultEntry* result = &state->entries[state->count++];
+    memset(result, 0, sizeof(*result));
+    result->path = entry->path;
+    result->hash = entry->hash;
+    result->size = entry->size;
+    result->source = source;
+    return result;
+}
+
+static void takeManifestRange(MergeState* state, const Manifest* manifest, ManifestRange range, int source) {
+    for (int i = range.start; i < range.end; i++) {
+        addMergeResult(state, &manifest->entries[i], source);
+    }
+}
+
+static uint64_t hashManifestRange(const Manifest* manifest, ManifestRange range, size_t prefixLength) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (int i = range.start; i < range.end; i++) {
+        const ManifestEntry* entry = &manifest->entries[i];
+        hash = hashBytes(hash, (const unsigned char*)entry->path + prefixLength, strlen(entry->path) - prefixLength + 1);
+        hash = hashBytes(hash, (const unsigned char*)&entry->hash, sizeof(entry->hash));
+    }
+    return hash;
+}
+
+static bool manifestRangesEqual(const Manifest* a, ManifestRange aRange, const Manifest* b, ManifestRange bRange, size_t prefixLength) {
+    if (aRange.end - aRange.start != bRange.end - bRange.start) return false;
+    return hashManifestRange(a, aRange, prefixLength) == hashManifestRange(b, bRange, prefixLength);
+}
+
+// Reads the next child of the directory at prefixLength: a file name, or a directory name
+// with a trailing '/', together with the range of entries it covers.
+static bool nextManifestGroup(const Manifest* manifest, int position, int end, size_t prefixLength,
+                       char* key, size_t keySize, ManifestRange* group) {
+    if (position >= end) return false;
+
+    const char* name = manifest->entries[position].path + prefixLength;
+    const char* slash = strchr(name, '/');
+    size_t keyLength = slash ? (size_t)(slash - name) + 1 : strlen(name);
+    snprintf(key, keySize, "%.*s", (int)keyLength, name);
+
+    group->start = position;
+    group->end = position + 1;
+    if (slash) {
+        while (group->end < end && strncmp(manifest->entries[group->end].path + prefixLength, key, keyLength) == 0) {
+            group->end++;
+        }
+    }
+    return true;
+}
+
+static void mergeFileEntry(MergeState* state, const ManifestEntry* base, const ManifestEntry* ours, const ManifestEntry* theirs) {
+    bool oursSameAsTheirs = (!ours && !theirs) || (ours && theirs && ours->hash == theirs->hash);
+    bool baseSameAsOurs = (!base && !ours) || (base && ours && base->hash == ours->hash);
+    bool baseSameAsTheirs = (!base && !theirs) || (base && theirs && base->hash == theirs->hash);
+
+    if (oursSameAsTheirs || baseSameAsTheirs) {
+        if (ours) addMergeResult(state, ours, MERGE_FROM_OURS);
+        return;
+    }
+    if (baseSameAsOurs) {
+        if (theirs) addMergeResult(state, theirs, MERGE_FROM_THEIRS);
+        return;
+    }
+
+    if (!ours || !theirs) {
+        const ManifestEntry* kept = ours ? ours : theirs;
+        MergeResultEntry* result = addMergeResult(state, kept, ours ? MERGE_FROM_OURS : MERGE_FROM_THEIRS);
+        if (result) result->conflicted = true;
+        state->conflicts++;
+        printf("CONFLICT (modify/delete): %s deleted in %s and modified in the other side.\n",
+               kept->path, ours ? state->theirsLabel : "HEAD");
+        return;
+    }
+
+    char basePath[MAX_PATH_LENGTH], oursPath[MAX_PATH_LENGTH], theirsPath[MAX_PATH_LENGTH];
+    if ((base && !commitTreeFilePath(state->baseTree, base->path, basePath, sizeof(basePath))) ||
+        !commitTreeFilePath(state->oursTree, ours->path, oursPath, sizeof(oursPath)) ||
+        !commitTreeFilePath(state->theirsTree, theirs->path, theirsPath, sizeof(theirsPath))) {
+        state->failed = true;
+        return;
+    }
+
+    MergeResultEntry* result = addMergeResult(state, ours, MERGE_FROM_CONTENT);
+    if (!result) return;
+
+    int conflicts = mergeFileContents(base ? basePath : NULL, oursPath, theirsPath, state->theirsLabel, &result->content);
+    if (conflicts < 0) {
+        result->source = MERGE_FROM_OURS;
+        result->conflicted = true;
+        state->conflicts++;
+        printf("CONFLICT (binary): Merge conflict in %s; keeping the HEAD version.\n", ours->path);
+        return;
+    }
+
+    result->hash = hashBytes(FNV_OFFSET_BASIS, (const unsigned char*)result->content.data, result->content.size);
+    traceCount(TRACE_OBJECTS_HASHED, 1);
+    result->size = (long long)result->content.size;
+    if (conflicts > 0) {
+        result->conflicted = true;
+        state->conflicts++;
+        printf("CONFLICT (content): Merge conflict in %s\n", ours->path);
+    }
+}
+
+// Merges one directory level. Subtrees are compared as a whole first, so a directory
+// that only one side touched (or that both sides left alone) is taken without looking
+// at the individual files below it.
+static void mergeDirectory(MergeState* state, size_t prefixLength, ManifestRange base, ManifestRange ours, ManifestRange theirs) {
+    int bi = base.start, oi = ours.start, ti = theirs.start;
+    char baseKey[MAX_PATH_LENGTH], oursKey[MAX_PATH_LENGTH], theirsKey[MAX_PATH_LENGTH];
+    ManifestRange baseGroup, oursGroup, theirsGroup;
+
+    for (;;) {
+        bool hasBase = nextManifestGroup(state->base, bi, base.end, prefixLength, baseKey, sizeof(baseKey), &baseGroup);
+        bool hasOurs = nextManifestGroup(state->ours, oi, ours.end, prefixLength, oursKey, sizeof(oursKey), &oursGroup);
+        bool hasTheirs = nextManifestGroup(state->theirs, ti, theirs.end, prefixLength, theirsKey, sizeof(theirsKey), &theirsGroup);
+        if (!hasBase && !hasOurs && !hasTheirs) break;
+
+        const char* key = NULL;
+        if (hasBase) key = baseKey;
+        if (hasOurs && (!key || strcmp(oursKey, key) < 0)) key = oursKey;
+        if (hasTheirs && (!key || strcmp(theirsKey, key) < 0)) key = theirsKey;
+
+        char currentKey[MAX_PATH_LENGTH];
+        snprintf(currentKey, sizeof(currentKey), "%s", key);
+        ManifestRange empty = { 0, 0 };
+        ManifestRange b = hasBase && strcmp(baseKey, currentKey) == 0 ? baseGroup : empty;
+        ManifestRange o = hasOurs && strcmp(oursKey, currentKey) == 0 ? oursGroup : empty;
+        ManifestRange t = hasTheirs && strcmp(theirsKey, currentKey) == 0 ? theirsGroup : empty;
+        if (b.end > b.start) bi = b.end;
+        if (o.end > o.start) oi = o.end;
+        if (t.end > t.start) ti = t.end;
+
+        size_t keyLength = strlen(currentKey);
+        if (currentKey[keyLength - 1] == '/') {
+            size_t childPrefix = prefixLength + keyLength;
+            if (manifestRangesEqual(state->ours, o, state->theirs, t, childPrefix) ||
+                manifestRangesEqual(state->base, b, state->theirs, t, childPrefix)) {
+                takeManifestRange(state, state->ours, o, MERGE_FROM_OURS);
+            } else if (manifestRangesEqual(state->base, b, state->ours, o, childPrefix)) {
+                takeManifestRange(state, state->theirs, t, MERGE_FROM_THEIRS);
+            } else {
+                mergeDirectory(state, childPrefix, b, o, t);
+            }
+        } else {
+            mergeFileEntry(state,
+                           b.end > b.start ? &state->base->entries[b.start] : NULL,
+                           o.end > o.start ? &state->ours->entries[o.start] : NULL,
+                           t.end > t.start ? &state->theirs->entries[t.start] : NULL);
+        }
+    }
+}
+
+static void freeMergeState(MergeState* state) {
+    for (int i = 0; i < state->count; i++) {
+        freeByteBuffer(&state->entries[i].content);
+    }
+    free(state->entries);
+    state->entries = NULL;
+    state->count = state->capacity = 0;
+}
+
+static bool writeBufferToFile(const char* path, const char* data, size_t size) {
+    char parent[MAX_PATH_LENGTH];
+    snprintf(parent, sizeof(parent), "%s", path);
+    char* lastSlash = strrchr(parent, '/');
+    if (lastSlash) {
+        *lastSlash = '\0';
+        ensureDirectoryStructureExists(parent);
+    }
+
+    FILE* file = repoFopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return false;
+    }
+    if (size > 0) fwrite(data, 1, size, file);
+    fclose(file);
+    traceCount(TRACE_BYTES_WRITTEN, size);
+    return true;
+}
+
+// Snapshot files never change once written, so a new commit can share them with the
+// commit it was built from instead of copying the data.
+static void linkOrCopyFile(const char* srcPath, const char* destPath) {
+    char parent[MAX_PATH_LENGTH];
+    snprintf(parent, sizeof(parent), "%s", destPath);
+    char* lastSlash = strrchr(parent, '/');
+    if (lastSlash) {
+        *lastSlash = '\0';
+        ensureDirectoryStructureExists(parent);
+    }
+
+    char srcBuffer[ROOTED_PATH_SIZE], destBuffer[ROOTED_PATH_SIZE];
+    const char* rootedSrc = rootedPath(srcPath, srcBuffer, sizeof(srcBuffer));
+    const char* rootedDest = rootedPath(destPath, destBuffer, sizeof(destBuffer));
+#ifdef _WIN32
+    if (rootedSrc && rootedDest && CreateHardLinkA(rootedDest, rootedSrc, NULL)) return;
+#else
+    if (rootedSrc && rootedDest && link(rootedSrc, rootedDest) == 0) return;
+#endif
+    char destCopy[MAX_PATH_LENGTH];
+    snprintf(destCopy, sizeof(destCopy), "%s", destPath);
+    copyFile(srcPath, destCopy);
+}
+
+static void removeEmptyParentDirectories(const char* path) {
+    char parent[MAX_PATH_LENGTH];
+    snprintf(parent, sizeof(parent), "%s", path);
+    char* lastSlash;
+    while ((lastSlash = strrchr(parent, '/')) != NULL) {
+        *lastSlash = '\0';
+        if (repoRmdir(parent) != 0) break;
+    }
+}
+
+// A work tree path is safe to overwrite if it still matches HEAD (or is absent when HEAD
+// does not have it).
+static bool workTreeMatchesHead(const char* path, const Manifest* ours) {
+    const ManifestEntry* head = findManifestEntry(ours, path);
+    uint64_t hash;
+    long long size;
+    if (!hashFileContents(path, &hash, &size)) {
+        return head == NULL;
+    }
+    return head && head->hash == hash;
+}
+
+static bool mergeSourcePath(const MergeState* state, const MergeResultEntry* result, char* buffer, size_t size) {
+    const CommitTree* tree = result->source == MERGE_FROM_THEIRS ? state->theirsTree : state->oursTree;
+    return commitTreeFilePath(tree, result->path, buffer, size);
+}
+
+static bool mergeResultNeedsWrite(const MergeState* state, const MergeResultEntry* result) {
+    const ManifestEntry* head = findManifestEntry(state->ours, result->path);
+    return result->conflicted || !head || head->hash != result->hash;
+}
+
+// Refuses to touch any path that has uncommitted changes, then writes only the paths whose
+// merged content differs from HEAD and removes the ones the merge deleted.
+static bool updateWorkTreeFromMerge(const MergeState* state) {
+    for (int i = 0; i < state->count; i++) {
+        if (mergeResultNeedsWrite(state, &state->entries[i]) && !workTreeMatchesHead(state->entries[i].path, state->ours)) {
+            fprintf(stderr, "Error: Your local changes to '%s' would be overwritten by merge.\n", state->entries[i].path);
+            return false;
+        }
+    }
+
+    Manifest result = { 0 };
+    for (int i = 0; i < state->count; i++) {
+        addManifestEntry(&result, state->entries[i].path, state->entries[i].hash, state->entries[i].size, true);
+    }
+    sortManifest(&result);
+
+    for (int i = 0; i < state->ours->count; i++) {
+        const char* path = state->ours->entries[i].path;
+        if (!findManifestEntry(&result, path)) {
+            if (!workTreeMatchesHead(path, state->ours)) {
+                fprintf(stderr, "Error: Your local changes to '%s' would be overwritten by merge.\n", path);
+                freeManifest(&result);
+                return false;
+            }
+        }
+    }
+
+    for (int i = 0; i < state->ours->count; i++) {
+        const char* path = state->ours->entries[i].path;
+        if (!findManifestEntry(&result, path)) {
+            repoRemove(path);
+            removeEmptyParentDirectories(path);
+        }
+    }
+    freeManifest(&result);
+
+    for (int i = 0; i < state->count; i++) {
+        const MergeResultEntry* entry = &state->entries[i];
+        if (!mergeResultNeedsWrite(state, entry)) continue;
+
+        if (entry->source == MERGE_FROM_CONTENT) {
+            writeBufferToFile(entry->path, entry->content.data, entry->content.size);
+        } else if (entry->source == MERGE_FROM_THEIRS) {
+            char srcPath[MAX_PATH_LENGTH], destPath[MAX_PATH_LENGTH];
+            if (!mergeSourcePath(state, entry, srcPath, sizeof(srcPath))) return false;
+            snprintf(destPath, sizeof(destPath), "%s", entry->path);
+            copyFile(srcPath, destPath);
+        }
+    }
+    return true;
+}
+
+static bool writeMergeCommit(const MergeState* state, const char* oursId, const char* theirsId, const char* message) {
+    char commitID[41];
+    generateCommitID(commitID, sizeof(commitID));
+
+    char commitDirPath[MAX_PATH_LENGTH];
+    snprintf(commitDirPath, sizeof(commitDirPath), "%s/%s", COMMIT_DIR, commitID);
+    ensureDirectoryExists(commitDirPath);
+
+    Manifest manifest = { 0 };
+    for (int i = 0; i < state->count; i++) {
+        const MergeResultEntry* entry = &state->entries[i];
+        char destPath[MAX_PATH_LENGTH], srcPath[MAX_PATH_LENGTH];
+        if (!formatPath(destPath, sizeof(destPath), "%s/%s", commitDirPath, entry->path) ||
+            (entry->source != MERGE_FROM_CONTENT && !mergeSourcePath(state, entry, srcPath, sizeof(srcPath)))) {
+            freeManifest(&manifest);
+            return false;
+        }
+        if (entry->source == MERGE_FROM_CONTENT) {
+            writeBufferToFile(destPath, entry->content.data, entry->content.size);
+        } else {
+            linkOrCopyFile(srcPath, destPath);
+        }
+        addManifestEntry(&manifest, entry->path, entry->hash, entry->size, true);
+    }
+
+    char manifestPath[MAX_PATH_LENGTH + sizeof(MANIFEST_SUFFIX)];
+    snprintf(manifestPath, sizeof(manifestPath), "%s%s", commitDirPath, MANIFEST_SUFFIX);
+    sortManifest(&manifest);
+    writeManifest(manifestPath, &manifest);
+    freeManifest(&manifest);
+
+    writeCommitParents(commitID, oursId, theirsId);
+    if (!recordCommit(commitID, message, state->count)) {
+        return false;
+    }
+    printf("Merge commit created [ID: %s].\n", commitID);
+    return true;
+}
+
+// Returns false when the merge failed or stopped on conflicts.
+static bool zengitMerge(const char* branchName) {
+    char currentBranch[256];
+    snprintf(currentBranch, sizeof(currentBranch), "%s", getCurrentBranch());
+    if (strcmp(branchName, currentBranch) == 0) {
+        printf("Error: Cannot merge branch '%s' into itself.\n", branchName);
+        return false;
+    }
+    if (!isBranchName(branchName)) {
+        printf("Error: Branch '%s' does not exist.\n", branchName);
+        return false;
+    }
+    if (fileExists(MERGE_HEAD_FILE)) {
+        printf("Error: A merge is already in progress. Resolve the conflicts and commit first.\n");
+        return false;
+    }
+    if (fileExists(INDEX_FILE) && !isFileEmpty(INDEX_FILE)) {
+        printf("Error: You have staged changes. Commit or reset them before merging.\n");
+        return false;
+    }
+
+    char oursId[64], theirsId[64], baseId[64] = {0};
+    char* lastCommitId = getLastCommitId(currentBranch);
+    if (!lastCommitId || !lastCommitId[0]) {
+        printf("Error: Branch '%s' has no commits.\n", currentBranch);
+        return false;
+    }
+    snprintf(oursId, sizeof(oursId), "%s", lastCommitId);
+    lastCommitId = getLastCommitId(branchName);
+    if (!lastCommitId || !lastCommitId[0]) {
+        printf("Error: Branch '%s' has no commits.\n", branchName);
+        return false;
+    }
+    snprintf(theirsId, sizeof(theirsId), "%s", lastCommitId);
+
+    zengitTraceBegin("merge base");
+    CommitGraph graph;
+    loadCommitGraph(&graph);
+    bool hasBase = findMergeBase(&graph, oursId, theirsId, baseId, sizeof(baseId));
+    zengitTraceEnd();
+
+    if (strcmp(oursId, theirsId) == 0 || (hasBase && strcmp(baseId, theirsId) == 0)) {
+        freeCommitGraph(&graph);
+        printf("Already up to date.\n");
+        return true;
+    }
+
+    zengitTraceBegin("trees");
+    CommitTree baseTree = { 0 }, oursTree, theirsTree;
+    bool loaded = (!hasBase || loadCommitTree(&graph, baseId, &baseTree));
+    loaded = loadCommitTree(&graph, oursId, &oursTree) && loaded;
+    loaded = loadCommitTree(&graph, theirsId, &theirsTree) && loaded;
+    freeCommitGraph(&graph);
+    zengitTraceEnd();
+    if (!loaded) {
+        fprintf(stderr, "Error: Not enough memory to load the trees to merge.\n");
+        freeCommitTree(&baseTree);
+        freeCommitTree(&oursTree);
+        freeCommitTree(&theirsTree);
+        return false;
+    }
+
+    const Manifest* theirs = &theirsTree.manifest;
+    MergeState state = { &baseTree.manifest, &oursTree.manifest, theirs, &baseTree, &oursTree, &theirsTree,
+                         branchName, NULL, 0, 0, 0, false };
+    bool fastForward = hasBase && strcmp(baseId, oursId) == 0;
+    zengitTraceBegin("compare");
+    if (fastForward) {
+        takeManifestRange(&state, theirs, (ManifestRange){ 0, theirs->count }, MERGE_FROM_THEIRS);
+    } else {
+        mergeDirectory(&state, 0, (ManifestRange){ 0, state.base->count }, (ManifestRange){ 0, state.ours->count },
+                       (ManifestRange){ 0, theirs->count });
+    }
+    zengitTraceEnd();
+
+    bool ok = !state.failed;
+    if (ok) {
+        zengitTraceBegin("write work tree");
+        ok = updateWorkTreeFromMerge(&state);
+        zengitTraceEnd();
+    }
+    if (ok) {
+        if (fastForward) {
+            char branchHeadFilePath[MAX_PATH_LENGTH];
+            snprintf(branchHeadFilePath, sizeof(branchHeadFilePath), "%s/%s_HEAD", COMMIT_DIR, currentBranch);
+            FILE* branchHeadFile = repoFopen(branchHeadFilePath, "a");
+            if (branchHeadFile) {
+                fprintf(branchHeadFile, "%s\n", theirsId);
+                fclose(branchHeadFile);
+                printf("Fast-forward to %s.\n", theirsId);
+            } else {
+                perror("Failed to update branch HEAD");
+                ok = false;
+            }
+        } else if (state.conflicts == 0) {
+            char message[MAX_PATH_LENGTH];
+            snprintf(message, sizeof(message), "Merge branch '%s' into %s", branchName, currentBranch);
+            ok = writeMergeCommit(&state, oursId, theirsId, message);
+        } else {
+            FILE* mergeHeadFile = repoFopen(MERGE_HEAD_FILE, "w");
+            if (mergeHeadFile) {
+                fprintf(mergeHeadFile, "%s\n", theirsId);
+                fclose(mergeHeadFile);
+            }
+            FILE* index = repoFopen(INDEX_FILE, "w");
+            if (index) {
+                for (int i = 0; i < state.count; i++) {
+                    if (!state.entries[i].conflicted) fprintf(index, "%s\n", state.entries[i].path);
+                }
+                fclose(index);
+            }
+            printf("Automatic merge failed with %d conflict(s); fix them, add the files and commit the result.\n",
+                   state.conflicts);
+            ok = false;
+        }
+    }
+
+    freeMergeState(&state);
+    freeCommitTree(&baseTree);
+    freeCommitTree(&oursTree);
+    freeCommitTree(&theirsTree);
+    return ok;
+}
+
+// Stash. "stash push" takes the paths status reports as changed, so the work tree scan goes
+// through the untracked cache or the fsmonitor and unchanged files are never read. Changed
+// files are moved, not copied, into .zengit/stash/<id>/ and the HEAD version of each is put
+// back; nothing else in the work tree is touched. <id>.paths lists the saved files as
+// "F <path>" and the deleted ones as "D <path>", <id>.index keeps the staged paths, and
+// .zengit/stash/list holds "<id> <base commit> <message>" per stash, newest last. "stash pop"
+// moves the newest stash back over the work tree; it does not merge, so it refuses to touch a
+// path with local changes.
+
+// Renames from to to, creating to's parent directories; copies when the rename fails.
+static bool moveFile(const char* from, const char* to) {
+    char parent[MAX_PATH_LENGTH];
+    snprintf(parent, sizeof(parent), "%s", to);
+    char* lastSlash = strrchr(parent, '/');
+    if (lastSlash) {
+        *lastSlash = '\0';
+        ensureDirectoryStructureExists(parent);
+    }
+    if (repoRename(from, to) == 0) {
+        return true;
+    }
+    char destCopy[MAX_PATH_LENGTH];
+    snprintf(destCopy, sizeof(destCopy), "%s", to);
+    copyFile(from, destCopy);
+    return isFile(to) && repoRemove(from) == 0;
+}
+
+static void restoreHeadFile(const char* headId, const char* path) {
+    char srcPath[MAX_PATH_LENGTH], destPath[MAX_PATH_LENGTH];
+    snprintf(srcPath, sizeof(srcPath), "%s/%s/%s", COMMIT_DIR, headId, path);
+    snprintf(destPath, sizeof(destPath), "%s", path);
+    char* lastSlash = strrchr(destPath, '/');
+    if (lastSlash) {
+        *lastSlash = '\0';
+        ensureDirectoryStructureExists(destPath);
+        *lastSlash = '/';
+    }
+    copyFile(srcPath, destPath);
+}
+
+// Reads the newest line of the stash list; count gets the number of stashes.
+static bool readNewestStash(char* stashId, char* baseId, char* message, size_t messageSize, int* count) {
+    *count = 0;
+    FILE* list = repoFopen(STASH_LIST_FILE, "r");
+    if (!list) {
+        return false;
+    }
+    char line[MAX_PATH_LENGTH];
+    while (fgets(line, sizeof(line), list)) {
+        int messageOffset = 0;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (sscanf(line, "%40s %40s %n", stashId, baseId, &messageOffset) == 2 && messageOffset > 0) {
+            snprintf(message, messageSize, "%s", line + messageOffset);
+            (*count)++;
+        }
+    }
+    fclose(list);
+    return *count > 0;
+}
+
+static bool stashPush(const char* message) {
+    const char* currentBranch = getCurrentBranch();
+    char* lastCommitId = getLastCommitId(currentBranch);
+    if (!lastCommitId || !lastCommitId[0]) {
+        printf("Error: Branch '%s' has no commits to stash changes against.\n", currentBranch);
+        return false;
+    }
+    char headId[64];
+    snprintf(headId, sizeof(headId), "%.40s", lastCommitId);
+
+    Manifest head, work;
+    int count = 0;
+    StatusLine* lines = computeWorkTreeStatus(headId, &head, &work, &count);
+    if (!lines) {
+        printf("Error: Could not read commit '%s'.\n", headId);
+        return false;
+    }
+    bool staged = hasStagedChanges();
+    if (count == 0 && !staged) {
+        printf("No local changes to save.\n");
+        free(lines);
+        freeManifest(&head);
+        freeManifest(&work);
+        return true;
+    }
+
+    char stashId[41];
+    generateCommitID(stashId, sizeof(stashId));
+    char stashDir[MAX_PATH_LENGTH], pathsFile[MAX_PATH_LENGTH + sizeof(".paths")];
+    snprintf(stashDir, sizeof(stashDir), "%s/%s", STASH_DIR, stashId);
+    snprintf(pathsFile, sizeof(pathsFile), "%s.paths", stashDir);
+    ensureDirectoryExists(STASH_DIR);
+    ensureDirectoryExists(stashDir);
+    FILE* paths = repoFopen(pathsFile, "w");
+    if (!paths) {
+        perror("Failed to write stash");
+        free(lines);
+        freeManifest(&head);
+        freeManifest(&work);
+        return false;
+    }
+
+    zengitTraceBegin("stash");
+    bool ok = true;
+    int stashed = 0;
+    for (int i = 0; ok && i < count; i++) {
+        const StatusLine* line = &lines[i];
+        if (line->code == 'R') {
+            fprintf(paths, "D %s\n", line->fromPath);
+            restoreHeadFile(headId, line->fromPath);
+            stashed++;
+        }
+        if (line->code == 'D') {
+            fprintf(paths, "D %s\n", line->path);
+            restoreHeadFile(headId, line->path);
+            stashed++;
+            continue;
+        }
+
+        char stashPath[MAX_PATH_LENGTH];
+        ok = formatPath(stashPath, sizeof(stashPath), "%s/%s", stashDir, line->path) &&
+             moveFile(line->path, stashPath);
+        if (!ok) {
+            fprintf(stderr, "Error: Failed to stash '%s'.\n", line->path);
+            break;
+        }
+        fprintf(paths, "F %s\n", line->path);
+        stashed++;
+        if (findManifestEntry(&head, line->path)) {
+            restoreHeadFile(headId, line->path);
+        } else {
+            removeEmptyParentDirectories(line->path);
+        }
+    }
+    ok = fclose(paths) == 0 && ok;
+    zengitTraceEnd();
+
+    if (staged) {
+        char indexFile[MAX_PATH_LENGTH + sizeof(".index")];
+        snprintf(indexFile, sizeof(indexFile), "%s.index", stashDir);
+        if (repoRename(INDEX_FILE, indexFile) == 0) {
+            clearIndexFile(INDEX_FILE);
+        }
+    }
+
+    char defaultMessage[MAX_PATH_LENGTH];
+    snprintf(defaultMessage, sizeof(defaultMessage), "WIP on %s: %s", currentBranch, headId);
+    FILE* list = repoFopen(STASH_LIST_FILE, "a");
+    if (list) {
+        fprintf(list, "%s %s %s\n", stashId, headId, message ? message : defaultMessage);
+        fclose(list);
+    } else {
+        perror("Failed to record stash");
+        ok = false;
+    }
+    if (ok) {
+        printf("Saved working directory and index state %s (%d path(s))\n", message ? message : defaultMessage, stashed);
+    }
+
+    free(lines);
+    freeManifest(&head);
+    freeManifest(&work);
+    return ok;
+}
+
+// Rewrites the stash list without its last line.
+static void dropNewestStashLine(void) {
+    FILE* list = repoFopen(STASH_LIST_FILE, "r");
+    if (!list) {
+        return;
+    }
+    ByteBuffer contents;
+    memset(&contents, 0, sizeof(contents));
+    char line[MAX_PATH_LENGTH];
+    size_t lastLineStart = 0;
+    while (fgets(line, sizeof(line), list)) {
+        lastLineStart = contents.size;
+        appendBytes(&contents, line, strlen(line));
+    }
+    fclose(list);
+
+    char tempPath[MAX_PATH_LENGTH];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", STASH_LIST_FILE);
+    FILE* temp = repoFopen(tempPath, "w");
+    if (temp) {
+        if (lastLineStart > 0) fwrite(contents.data, 1, lastLineStart, temp);
+        if (fclose(temp) == 0) {
+            repoRename(tempPath, STASH_LIST_FILE);
+        }
+    }
+    freeByteBuffer(&contents);
+}
+
+static bool stashPop(void) {
+    char stashId[64], baseId[64], message[MAX_PATH_LENGTH];
+    int count;
+    if (!readNewestStash(stashId, baseId, message, sizeof(message), &count)) {
+        printf("No stash entries found.\n");
+        return false;
+    }
+    char stashDir[MAX_PATH_LENGTH], pathsFile[MAX_PATH_LENGTH + sizeof(".paths")], indexFile[MAX_PATH_LENGTH + sizeof(".index")];
+    snprintf(stashDir, sizeof(stashDir), "%s/%s", STASH_DIR, stashId);
+    snprintf(pathsFile, sizeof(pathsFile), "%s.paths", stashDir);
+    snprintf(indexFile, sizeof(indexFile), "%s.index", stashDir);
+
+    PathList saved = {0}, deleted = {0};
+    FILE* paths = repoFopen(pathsFile, "r");
+    if (!paths) {
+        printf("Error: Stash '%s' is missing its path list.\n", stashId);
+        return false;
+    }
+    char line[MAX_PATH_LENGTH];
+    while (fgets(line, sizeof(line), paths)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == 'F' && line[1] == ' ') appendPathList(&saved, line + 2);
+        if (line[0] == 'D' && line[1] == ' ') appendPathList(&deleted, line + 2);
+    }
+    fclose(paths);
+
+    Manifest head = { 0 };
+    char* lastCommitId = getLastCommitId(getCurrentBranch());
+    if (lastCommitId && lastCommitId[0]) {
+        loadCommitManifest(lastCommitId, &head);
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < saved.count + deleted.count; i++) {
+        const char* path = i < saved.count ? saved.paths[i] : deleted.paths[i - saved.count];
+        if (!workTreeMatchesHead(path, &head)) {
+            fprintf(stderr, "Error: Your local changes to '%s' would be overwritten by stash pop.\n", path);
+            ok = false;
+        }
+    }
+    freeManifest(&head);
+
+    for (int i = 0; ok && i < deleted.count; i++) {
+        repoRemove(deleted.paths[i]);
+        removeEmptyParentDirectories(deleted.paths[i]);
+    }
+    for (int i = 0; ok && i < saved.count; i++) {
+        char stashPath[MAX_PATH_LENGTH];
+        if (!formatPath(stashPath, sizeof(stashPath), "%s/%s", stashDir, saved.paths[i]) ||
+            !moveFile(stashPath, saved.paths[i])) {
+            fprintf(stderr, "Error: Failed to restore '%s'; it stays in %s.\n", saved.paths[i], stashDir);
+            ok = false;
+        }
+    }
+
+    if (ok && fileExists(indexFile)) {
+        PathTable index;
+        FILE* stagedFile = repoFopen(indexFile, "r");
+        FILE* indexOut = loadIndexTable(&index) ? repoFopen(INDEX_FILE, "a") : NULL;
+        while (stagedFile && indexOut && fgets(line, sizeof(line), stagedFile)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            int id = pathTableIntern(&index, line, true);
+            if (id > 0 && !index.paths[id].value) {
+                index.paths[id].value = 1;
+                fprintf(indexOut, "%s\n", line);
+            }
+        }
+        if (indexOut) fclose(indexOut);
+        if (stagedFile) fclose(stagedFile);
+        pathTableFree(&index);
+    }
+
+    if (ok) {
+        repoRemove(indexFile);
+        repoRemove(pathsFile);
+        deleteDirectoryRecursively(stashDir);
+        repoRmdir(stashDir);
+        dropNewestStashLine();
+        printf("Restored %d path(s) and dropped stash@{0}: %s\n", saved.count + deleted.count, message);
+    }
+    freePathList(&saved);
+    freePathList(&deleted);
+    return ok;
+}
+
+static void stashList(void) {
+    FILE* list = repoFopen(STASH_LIST_FILE, "r");
+    if (!list) {
+        return;
+    }
+    PathList messages = {0};
+    char line[MAX_PATH_LENGTH];
+    while (fgets(line, sizeof(line), list)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char stashId[64], baseId[64];
+        int messageOffset = 0;
+        if (sscanf(line, "%40s %40s %n", stashId, baseId, &messageOffset) == 2 && messageOffset > 0) {
+            appendPathList(&messages, line + messageOffset);
+        }
+    }
+    fclose(list);
+    for (int i = messages.count - 1; i >= 0; i--) {
+        printf("stash@{%d}: %s\n", messages.count - 1 - i, messages.paths[i]);
+    }
+    freePathList(&messages);
+}
+
+static bool handleStashCommand(int argc, char* argv[]) {
+    const char* action = argc >= 3 ? argv[2] : "push";
+    if (strcmp(action, "push") == 0 && (argc <= 3 || (argc == 5 && strcmp(argv[3], "-m") == 0))) {
+        return stashPush(argc == 5 ? argv[4] : NULL);
+    }
+    if (strcmp(action, "pop") == 0 && argc == 3) {
+        return stashPop();
+    }
+    if (strcmp(action, "list") == 0 && argc == 3) {
+        stashList();
+        return true;
+    }
+    fprintf(stderr, "Usage: %s stash [push [-m <message>] | pop | list]\n", argv[0]);
+    return false;
+}
+
+typedef struct {
+    const AhoCorasick* automaton;
+    char* marks;
+} HighlightContext;
+
+static void markMatch(int patternIndex, size_t endOffset, void* context) {
+    HighlightContext* highlight = context;
+    size_t length = highlight->automaton->patternLengths[patternIndex];
+    memset(highlight->marks + endOffset - length, 1, length);
+}
+
+static void highlightPatterns(const char* line, const AhoCorasick* automaton) {
+    const char* RED = "\x1B[31m";
+    const char* RESET = "\x1B[0m";
+
+    size_t length = strlen(line);
+    char* marks = calloc(length + 1, 1);
+    if (!marks) {
+        printf("%s", line);
+        return;
+    }
+
+    HighlightContext highlight = { automaton, marks };
+    acScan(automaton, line, length, NULL, false, markMatch, &highlight);
+
+    size_t i = 0;
+    while (i < length) {
+        size_t runStart = i;
+        while (i < length && marks[i] == marks[runStart]) i++;
+        if (marks[runStart]) {
+            printf("%s%.*s%s", RED, (int)(i - runStart), line + runStart, RESET);
+        } else {
+            printf("%.*s", (int)(i - runStart), line + runStart);
+        }
+    }
+
+    free(marks);
+}
+
+static void grepInFile(const char* dir, const char* filename, const char* patterns[], int numPatterns,
+                bool showLineNum, bool showCounts) {
+    char fullPath[1024];
+    if (dir) {
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", dir, filename);
+        filename = fullPath;
+    }
+
+    FILE* file = repoFopen(filename, "r");
+    if (!file) {
+        perror("Error opening file");
+        return;
+    }
+
+    AhoCorasick automaton;
+    if (!acCompile(&automaton, patterns, numPatterns)) {
+        fprintf(stderr, "Failed to compile grep patterns.\n");
+        fclose(file);
+        return;
+    }
+
+    int* hitCounts = calloc(numPatterns, sizeof(int));
+    char line[1024];
+    int lineNum = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNum++;
+        if (acScan(&automaton, line, strlen(line), hitCounts, !showCounts, NULL, NULL) > 0) {
+            if (showLineNum) {
+                printf("%d: ", lineNum);
+            }
+            highlightPatterns(line, &automaton);
+        }
+    }
+
+    if (showCounts && hitCounts) {
+        for (int i = 0; i < numPatterns; i++) {
+            printf("%s: %d\n", patterns[i], hitCounts[i]);
+        }
+    }
+
+    free(hitCounts);
+    acFree(&automaton);
+    fclose(file);
+}
+
+
+
+bool zengitExpandAlias(int* argc, char*** argv) {
+    useWorkingDirectory();
+    return processAlias(argc, argv);
+}
+
+// Commands without a library entry point; status, log, checkout, "commit -m" and plain
+// "add" are served through the ZengitRepo functions by the command line front end.
+int zengitRunCommand(int argc, char* argv[]) {
+    useWorkingDirectory();
+    if (strcmp(argv[1], "init") == 0) {
+        return handleInitCommand() ? 0 : 1;
+    } else if (strcmp(argv[1], "config") == 0) {
+        return handleConfigCommand(argc, argv) ? 0 : 1;
+    } else if (strcmp(argv[1], "add") == 0) {
+        return handleAddCommand(argc, argv) ? 0 : 1;
+    } else if (strcmp(argv[1], "reset") == 0) {
+        return handleResetCommand(argc, argv) ? 0 : 1;
+    } else if (strcmp(argv[1], "commit") == 0) {
+
+        if (argc == 4 && strcmp(argv[2], "-s") == 0) {
+            createCommitWithShortcut(argv[3]);
+            return 0;
+        } else {
+            fprintf(stderr, "Usage: %s commit -m \"commit message\"\n", argv[0]);
+            fprintf(stderr, "       %s commit -s shortcut-name\n", argv[0]);
+            return 1;
+        }
+    } else if (strcmp(argv[1], "set") == 0) {
+
+        if (argc != 6 || strcmp(argv[2], "-m") != 0 || strcmp(argv[4], "-s") != 0) {
+            fprintf(stderr, "Usage: %s set -m \"message\" -s shortcut-name\n", argv[0]);
+            return 1;
+        }
+
+        setShortcut(argv[5], argv[3]);
+        return 0;
+    } else if (strcmp(argv[1], "replace") == 0) {
+
+        if (argc != 6 || strcmp(argv[2], "-m") != 0 || strcmp(argv[4], "-s") != 0) {
+            fprintf(stderr, "Usage: %s replace -m \"new message\" -s shortcut-name\n", argv[0]);
+            return 1;
+        }
+
+        replaceShortcutMessage(argv[5], argv[3]);
+        return 0;
+    } else if (strcmp(argv[1], "remove") == 0) {
+        if (argc != 4 || strcmp(argv[2], "-s") != 0) {
+            fprintf(stderr, "Usage: %s remove -s shortcut-name\n", argv[0]);
+            return 1;
+        }
+        removeShortcut(argv[3]);
+        return 0;
+    } else if (strcmp(argv[1], "branch") == 0) {
+        if (argc == 2) {
+
+            listBranches();
+        } else if (argc == 3) {
+
+            createBranch(argv[2]);
+        } else {
+            fprintf(stderr, "Usage: %s branch [branch-name]\n", argv[0]);
+            return 1;
+        }
+        return 0;
+    } else if (strcmp(argv[1], "revert") == 0 && argc == 5 && strcmp(argv[2], "-m") == 0) {
+        const char* message = argv[3];
+        const char* commitId = argv[4];
+        zengitRevert(message, commitId);
+    } else if (strcmp(argv[1], "revert") == 0 && argc == 3 && strcmp(argv[2], "-n") == 0) {
+        zengitRevertToHead();
+    } else if (strcmp(argv[1], "revert") == 0 && argc == 3) {
+        const char* commitId = argv[2];
+        zengitRevertWithoutMessage(commitId);
+    } else if (strcmp(argv[1], "revert") == 0 && argc == 4 && strcmp(argv[2], "-n") == 0) {
+        const char* commitId = argv[3];
+        zengitRevertToCommit(commitId);
+    } else if (argc == 2 && strcmp(argv[1], "tag") == 0) {
+        listTags();
+    } else if (argc == 4 && strcmp(argv[1], "tag") == 0 && strcmp(argv[2], "show") == 0) {
+        showTagInfo(argv[3]);
+    } else if (strcmp(argv[1], "tag") == 0 && strcmp(argv[2], "-a") == 0 && argc >= 4) {
+        const char* tagName = argv[3];
+        const char* message = NULL;
+        const char* commitId = NULL;
+        bool force = false;
+
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+                message = argv[++i];
+            } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+                commitId = argv[++i];
+            } else if (strcmp(argv[i], "-f") == 0) {
+                force = true;
+            }
+        }
+        createTag(tagName, message, commitId, force);
+    } else if (strcmp(argv[1], "stash") == 0) {
+        return handleStashCommand(argc, argv) ? 0 : 1;
+    } else if (strcmp(argv[1], "archive") == 0) {
+        bool usage = argc != 3 && !(argc == 5 && strcmp(argv[3], "-o") == 0);
+        if (usage) {
+            fprintf(stderr, "Usage: %s archive <revision> [-o <file>]\n", argv[0]);
+            return 1;
+        }
+        return archiveRevision(argv[2], argc == 5 ? argv[4] : NULL) ? 0 : 1;
+    } else if (strcmp(argv[1], "show") == 0) {
+        if (argc != 3) {
+            fprintf(stderr, "Usage: %s show <revision>:<path>\n", argv[0]);
+            return 1;
+        }
+        return showFileAtRevision(argv[2]) ? 0 : 1;
+    } else if (strcmp(argv[1], "diff") == 0) {
+        return handleDiffCommand(argc, argv) ? 0 : 1;
+    } else if (strcmp(argv[1], "merge") == 0) {
+        if (argc != 3) {
+            fprintf(stderr, "Usage: %s merge <branch-name>\n", argv[0]);
+            return 1;
+        }
+        return zengitMerge(argv[2]) ? 0 : 1;
+    } else if (strcmp(argv[1], "fsmonitor") == 0) {
+        return handleFsMonitorCommand(argc, argv) ? 0 : 1;
+    } else if (strcmp(argv[1], "sparse") == 0) {
+        return handleSparseCommand(argc, argv) ? 0 : 1;
+    } else if (strcmp(argv[1], "grep") == 0) {
+        char* filename = NULL;
+        const char* patterns[256];
+        int numPatterns = 0;
+        char* commitId = NULL;
+        bool showLineNumbers = false; // Corrected to false as default
+        bool showCounts = false;
+        char basePath[256] = "."; // Default to current directory
+
+        // Parse grep-specific options
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+                filename = argv[++i];
+            } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+                if (numPatterns < 256) {
+                    patterns[numPatterns++] = argv[++i];
+                } else {
+                    ++i;
+                }
+            } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+                commitId = argv[++i];
+                // Update basePath to include the commit ID directory
+                snprintf(basePath, sizeof(basePath), ".zengit/commits/%s", commitId);
+            } else if (strcmp(argv[i], "-n") == 0) {
+                showLineNumbers = true; // Only set to true if -n is present
+            } else if (strcmp(argv[i], "-count") == 0) {
+                showCounts = true;
+            }
+        }
+
+        if (filename && numPatterns > 0) {
+            grepInFile(basePath, filename, patterns, numPatterns, showLineNumbers, showCounts);
+        } else {
+            printf("Usage: zengit grep -f <file> -p <word> [-p <word> ...] [-c <commit-id>] [-n] [-count]\n");
+        }
+    } else {
+        fprintf(stderr, "Unknown command: %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
+
+// Library API. A ZengitRepo keeps parsed copies of the small files every command reads and
+// checks them against the file's signature before reuse, so a long-lived handle re-reads
+// only what changed on disk.
+
+struct ZengitRepo {
+    char root[MAX_PATH_LENGTH];
+    char lastError[512];
+
+    char userName[256];
+
+    bool indexLoaded;
+    FileSignature indexSignature;
+    PathTable index;               // staged paths have value 1
+
+    bool branchLoaded;
+    FileSignature branchSignature;
+    char currentBranch[ZENGIT_BRANCH_NAME_SIZE];
+
+    bool headLoaded;
+    FileSignature headSignature;
+    char headBranch[ZENGIT_BRANCH_NAME_SIZE];
+    char headCommitId[MAX_PATH_LENGTH]; // empty when the branch has no commits
+
+    FileSignature logSignature;
+    LogEntry* log;                 // oldest first, as in the log file
+    int logCount;
+    int logCapacity;
+    long logOffset;                // end of the last complete entry parsed
+    StringTable logIds;            // commit id -> index in log
+};
+
+static void setRepoError(ZengitRepo* repo, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(repo->lastError, sizeof(repo->lastError), format, args);
+    va_end(args);
+}
+
+// Every call resolves its paths against the repository root of the handle. Relative paths
+// are cheaper for the kernel to look up, so when the process already runs in the root, as
+// the command line does, they are left as they are.
+static void enterRepo(ZengitRepo* repo) {
+    repo->lastError[0] = '\0';
+    char workingDirectory[ROOTED_PATH_SIZE];
+    bool inRoot = getcwd(workingDirectory, sizeof(workingDirectory)) && strcmp(workingDirectory, repo->root) == 0;
+    snprintf(repositoryRoot, sizeof(repositoryRoot), "%s", inRoot ? "" : repo->root);
+}
+
+static void invalidateIndexCache(ZengitRepo* repo) {
+    if (repo->indexLoaded) {
+        pathTableFree(&repo->index);
+        repo->indexLoaded = false;
+    }
+}
+
+ZengitRepo* zengitRepoOpen(const char* path) {
+    ZengitRepo* repo = calloc(1, sizeof(ZengitRepo));
+    if (!repo) {
+        return NULL;
+    }
+#ifdef _WIN32
+    bool resolved = _fullpath(repo->root, path, sizeof(repo->root)) != NULL;
+#else
+    char* absolute = realpath(path, NULL);
+    bool resolved = absolute && snprintf(repo->root, sizeof(repo->root), "%s", absolute) < (int)sizeof(repo->root);
+    free(absolute);
+#endif
+    char zengitDir[MAX_PATH_LENGTH + sizeof("/.zengit")];
+    snprintf(zengitDir, sizeof(zengitDir), "%s/.zengit", repo->root);
+    if (!resolved || !isDirectory(zengitDir)) {
+        free(repo);
+        return NULL;
+    }
+    return repo;
+}
+
+void zengitRepoClose(ZengitRepo* repo) {
+    if (!repo) {
+        return;
+    }
+    invalidateIndexCache(repo);
+    stringTableFree(&repo->logIds);
+    free(repo->log);
+    free(repo);
+}
+
+const char* zengitRepoError(const ZengitRepo* repo) {
+    return repo->lastError;
+}
+
+// The handle outlives single commands, so the config files are checked on every call.
+static const char* cachedUserName(ZengitRepo* repo) {
+    refreshConfig();
+    loadCommitUserName(repo->userName, sizeof(repo->userName));
+    return repo->userName;
+}
+
+static bool refreshIndexCache(ZengitRepo* repo) {
+    FileSignature signature = readFileSignature(INDEX_FILE);
+    if (repo->indexLoaded && sameFileSignature(&signature, &repo->indexSignature)) {
+        traceCount(TRACE_CACHE_HITS, 1);
+        return true;
+    }
+    traceCount(TRACE_CACHE_MISSES, 1);
+    invalidateIndexCache(repo);
+    if (!loadIndexTable(&repo->index)) {
+        setRepoError(repo, "Out of memory reading the index.");
+        return false;
+    }
+    repo->indexSignature = signature;
+    repo->indexLoaded = true;
+    return true;
+}
+
+static bool isIndexed(ZengitRepo* repo, const char* path) {
+    int id = pathTableIntern(&repo->index, path, false);
+    return id > 0 && repo->index.paths[id].value;
+}
+
+static const char* cachedCurrentBranch(ZengitRepo* repo) {
+    FileSignature signature = readFileSignature(CURRENT_BRANCH_FILE);
+    if (!repo->branchLoaded || !sameFileSignature(&signature, &repo->branchSignature)) {
+        traceCount(TRACE_CACHE_MISSES, 1);
+        snprintf(repo->currentBranch, sizeof(repo->currentBranch), "%s", getCurrentBranch());
+        repo->branchSignature = signature;
+        repo->branchLoaded = true;
+    } else {
+        traceCount(TRACE_CACHE_HITS, 1);
+    }
+    return repo->currentBranch;
+}
+
+// Returns the newest commit of branchName, or NULL when the branch has none.
+static const char* cachedBranchHead(ZengitRepo* repo, const char* branchName) {
+    char headFilePath[MAX_PATH_LENGTH];
+    snprintf(headFilePath, sizeof(headFilePath), "%s/%s_HEAD", COMMIT_DIR, branchName);
+    FileSignature signature = readFileSignature(headFilePath);
+    if (!repo->headLoaded || strcmp(repo->headBranch, branchName) != 0 ||
+        !sameFileSignature(&signature, &repo->headSignature)) {
+        traceCount(TRACE_CACHE_MISSES, 1);
+        char* lastCommitId = getLastCommitId(branchName);
+        snprintf(repo->headCommitId, sizeof(repo->headCommitId), "%s", lastCommitId ? lastCommitId : "");
+        snprintf(repo->headBranch, sizeof(repo->headBranch), "%s", branchName);
+        repo->headSignature = signature;
+        repo->headLoaded = true;
+    } else {
+        traceCount(TRACE_CACHE_HITS, 1);
+    }
+    return repo->headCommitId[0] ? repo->headCommitId : NULL;
+}
+
+// The log is only ever appended to, so a grown file is parsed from where the previous read
+// stopped; anything else starts over.
+static bool refreshLogCache(ZengitRepo* repo) {
+    FileSignature signature = readFileSignature(LOG_FILE_PATH);
+    if (sameFileSignature(&signature, &repo->logSignature)) {
+        traceCount(TRACE_CACHE_HITS, 1);
+        return true;
+    }
+    traceCount(TRACE_CACHE_MISSES, 1);
+    if (!signature.exists || signature.inode != repo->logSignature.inode ||
+        signature.size < repo->logSignature.size) {
+        repo->logCount = 0;
+        repo->logOffset = 0;
+        stringTableFree(&repo->logIds);
+    }
+    repo->logSignature = signature;
+    if (!signature.exists) {
+        return true;
+    }
+
+    FILE* file = repoFopen(LOG_FILE_PATH, "r");
+    if (!file) {
+        setRepoError(repo, "Failed to open log file: %s", strerror(errno));
+        repo->logSignature.exists = false;
+        return false;
+    }
+    zengitTraceBegin("log parse");
+    fseek(file, repo->logOffset, SEEK_SET);
+    traceCount(TRACE_BYTES_READ, (uint64_t)(signature.size - repo->logOffset));
+    LogEntry entry;
+    while (readLogEntry(file, &entry)) {
+        if (repo->logCount == repo->logCapacity) {
+            int capacity = repo->logCapacity ? repo->logCapacity * 2 : 64;
+            LogEntry* grown = realloc(repo->log, capacity * sizeof(LogEntry));
+            if (!grown) {
+                break;
+            }
+            repo->log = grown;
+            repo->logCapacity = capacity;
+        }
+        stringTablePut(&repo->logIds, entry.commitID, repo->logCount);
+        repo->log[repo->logCount++] = entry;
+        repo->logOffset = ftell(file);
+    }
+    fclose(file);
+    zengitTraceEnd();
+    return true;
+}
+
+bool zengitRepoStatus(ZengitRepo* repo, ZengitStatus* status) {
+    memset(status, 0, sizeof(*status));
+    enterRepo(repo);
+
+    const char* currentBranch = cachedCurrentBranch(repo);
+    const char* lastCommitId = cachedBranchHead(repo, currentBranch);
+    if (!lastCommitId) {
+        setRepoError(repo, "Could not find last commit ID for branch '%s'.", currentBranch);
+        return false;
+    }
+    snprintf(status->headCommitId, sizeof(status->headCommitId), "%s", lastCommitId);
+
+    Manifest head, work;
+    int count = 0;
+    StatusLine* lines = computeWorkTreeStatus(status->headCommitId, &head, &work, &count);
+    if (!lines) {
+        setRepoError(repo, "Error opening commit directory '%s/%s'", COMMIT_DIR, status->headCommitId);
+        return false;
+    }
+
+    // The entries and their paths share one block.
+    size_t bytes = (count + 1) * sizeof(ZengitStatusEntry);
+    for (int i = 0; i < count; i++) {
+        bytes += strlen(lines[i].path) + 1 + (lines[i].fromPath ? strlen(lines[i].fromPath) + 1 : 0);
+    }
+    bool ok = refreshIndexCache(repo);
+    status->entries = calloc(1, bytes);
+    if (ok && !status->entries) {
+        setRepoError(repo, "Out of memory building the status.");
+        ok = false;
+    }
+    char* strings = ok ? (char*)(status->entries + count + 1) : NULL;
+    for (int i = 0; ok && i < count; i++) {
+        ZengitStatusEntry* entry = &status->entries[i];
+        entry->code = lines[i].code;
+        entry->path = strcpy(strings, lines[i].path);
+        strings += strlen(strings) + 1;
+        if (lines[i].fromPath) {
+            entry->fromPath = strcpy(strings, lines[i].fromPath);
+            strings += strlen(strings) + 1;
+        }
+        entry->similarity = lines[i].similarity;
+        entry->staged = isIndexed(repo, lines[i].path);
+        status->count++;
+    }
+
+    free(lines);
+    freeManifest(&head);
+    freeManifest(&work);
+    if (!ok) {
+        zengitFreeStatus(status);
+    }
+    return ok;
+}
+
+void zengitFreeStatus(ZengitStatus* status) {
+    free(status->entries);
+    memset(status, 0, sizeof(*status));
+}
+
+// Appends the new paths to the index and the staging history with one write each.
+static bool appendToIndex(ZengitRepo* repo, const PathList* paths) {
+    FILE* index = repoFopen(INDEX_FILE, "a");
+    if (!index) {
+        setRepoError(repo, "Error opening staging area file: %s", strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < paths->count; i++) {
+        fprintf(index, "%s\n", paths->paths[i]);
+    }
+    fclose(index);
+
+    appendStageRecord(STAGE_ADD, 0, paths->paths, paths->count);
+
+    // The cache already holds the new paths; only the signature is stale.
+    repo->indexSignature = readFileSignature(INDEX_FILE);
+    return true;
+}
+
+// Packs the list into one block, the pointer array followed by the strings, so the caller
+// releases it with a single free.
+static ZengitPathList takePathList(PathList* list) {
+    size_t bytes = 0;
+    for (int i = 0; i < list->count; i++) {
+        bytes += strlen(list->paths[i]) + 1;
+    }
+    ZengitPathList result = { malloc((list->count + 1) * sizeof(char*) + bytes), 0 };
+    if (result.paths) {
+        char* cursor = (char*)(result.paths + list->count + 1);
+        for (int i = 0; i < list->count; i++) {
+            size_t length = strlen(list->paths[i]) + 1;
+            result.paths[i] = memcpy(cursor, list->paths[i], length);
+            cursor += length;
+        }
+        result.paths[list->count] = NULL;
+        result.count = list->count;
+    }
+    freePathList(list);
+    return result;
+}
+
+bool zengitRepoAdd(ZengitRepo* repo, const char* path, bool force, ZengitAddResult* result) {
+    memset(result, 0, sizeof(*result));
+    enterRepo(repo);
+
+    bool exists = isFile(path) || isDirectory(path);
+    if (!force && exists && refreshSparseCheckout() && !isPathInSparseCheckout(relativeWorkTreePath(path), isDirectory(path))) {
+        setRepoError(repo, "The path '%s' is outside the sparse checkout; use -f to add it.", path);
+        return false;
+    }
+
+    if (!force && exists && isWorkTreePathIgnored(path, isDirectory(path))) {
+        setRepoError(repo, "The path '%s' is ignored by %s; use -f to add it.", path, IGNORE_FILE_NAME);
+        return false;
+    }
+
+    PathList candidates = {0};
+    if (isFile(path) || (force && isDirectory(path))) {
+        appendPathList(&candidates, path);
+    } else if (isDirectory(path)) {
+        collectDirectoryForStaging(path, &candidates);
+    } else {
+        setRepoError(repo, "The specified file or directory does not exist: %s", path);
+        return false;
+    }
+
+    if (!refreshIndexCache(repo)) {
+        freePathList(&candidates);
+        return false;
+    }
+
+    PathList staged = {0}, alreadyStaged = {0};
+    for (int i = 0; i < candidates.count; i++) {
+        int id = pathTableIntern(&repo->index, candidates.paths[i], true);
+        if (id > 0 && repo->index.paths[id].value) {
+            appendPathList(&alreadyStaged, candidates.paths[i]);
+        } else {
+            if (id > 0) repo->index.paths[id].value = 1;
+            appendPathList(&staged, candidates.paths[i]);
+        }
+    }
+    freePathList(&candidates);
+
+    bool ok = staged.count == 0 || appendToIndex(repo, &staged);
+    if (!ok) {
+        invalidateIndexCache(repo);
+    }
+    result->staged = takePathList(&staged);
+    result->alreadyStaged = takePathList(&alreadyStaged);
+    return ok;
+}
+
+void zengitFreeAddResult(ZengitAddResult* result) {
+    free(result->staged.paths);
+    free(result->alreadyStaged.paths);
+    memset(result, 0, sizeof(*result));
+}
+
+bool zengitRepoCommit(ZengitRepo* repo, const char* message, ZengitCommitResult* result) {
+    memset(result, 0, sizeof(*result));
+    enterRepo(repo);
+    if (!hasStagedChanges()) {
+        setRepoError(repo, "No files staged for commit.");
+        return false;
+    }
+
+    bool ok = createCommit(message, cachedUserName(repo), result->commitId, &result->filesCommitted);
+    if (!ok) {
+        setRepoError(repo, "Failed to record commit '%s'.", result->commitId);
+    }
+    return ok;
+}
+
+static bool logEntryMatches(const LogEntry* entry, const ZengitLogQuery* query, time_t since, time_t before,
+                     const AhoCorasick* terms) {
+    if (query->branch && strcmp(entry->branch, query->branch) != 0) return false;
+    if (query->author && strcmp(entry->user, query->author) != 0) return false;
+    if (query->since || query->before) {
+        time_t commitDate = logDateStringToTimeT(entry->date);
+        if (query->since && commitDate < since) return false;
+        if (query->before && commitDate >= before) return false;
+    }
+    return !terms || messageContainsTerms(entry->message, terms);
+}
+
+bool zengitRepoLog(ZengitRepo* repo, const ZengitLogQuery* query, ZengitLog* log) {
+    memset(log, 0, sizeof(*log));
+    enterRepo(repo);
+    if (!refreshLogCache(repo)) {
+        return false;
+    }
+
+    ZengitLogQuery noFilter = {0};
+    if (!query) {
+        query = &noFilter;
+    }
+    time_t since = query->since ? cutoffDateToTimeT(query->since) : 0;
+    time_t before = query->before ? cutoffDateToTimeT(query->before) : 0;
+
+    AhoCorasick automaton;
+    char* searchCopy = NULL;
+    if (query->search) {
+        const char* terms[256];
+        int numTerms = 0;
+        searchCopy = strdup(query->search);
+        for (char* token = searchCopy ? strtok(searchCopy, " ") : NULL; token && numTerms < 256; token = strtok(NULL, " ")) {
+            terms[numTerms++] = token;
+        }
+        if (!searchCopy || !acCompile(&automaton, terms, numTerms)) {
+            setRepoError(repo, "Failed to compile search terms.");
+            free(searchCopy);
+            return false;
+        }
+    }
+
+    log->entries = malloc((repo->logCount + 1) * sizeof(ZengitLogEntry));
+    if (!log->entries) {
+        setRepoError(repo, "Out of memory reading the log.");
+    }
+    for (int i = repo->logCount - 1; log->entries && i >= 0; i--) {
+        if (query->maxCount > 0 && log->count >= query->maxCount) break;
+        const LogEntry* entry = &repo->log[i];
+        if (!logEntryMatches(entry, query, since, before, query->search ? &automaton : NULL)) continue;
+        log->entries[log->count++] = (ZengitLogEntry){ entry->date, entry->user, entry->commitID,
+                                                       entry->branch, entry->message, entry->filesCommitted };
+    }
+
+    if (query->search) {
+        acFree(&automaton);
+        free(searchCopy);
+    }
+    return log->entries != NULL;
+}
+
+void zengitFreeLog(ZengitLog* log) {
+    free(log->entries);
+    memset(log, 0, sizeof(*log));
+}
+
+bool zengitRepoCheckout(ZengitRepo* repo, const char* target, ZengitCheckoutResult* result) {
+    memset(result, 0, sizeof(*result));
+    enterRepo(repo);
+
+    const char* branchName = NULL;
+    if (strcmp(target, "HEAD") == 0) {
+        branchName = cachedCurrentBranch(repo);
+    } else if (strncmp(target, "HEAD-", 5) == 0) {
+        int n = atoi(target + 5);
+        int available = 0;
+        if (n <= 0) {
+            setRepoError(repo, "Invalid checkout target '%s'.", target);
+            return false;
+        }
+        if (!findNthNewestCommit(COMMIT_DIR, n, result->commitId, sizeof(result->commitId), &available)) {
+            setRepoError(repo, "Unable to find the specified commit. Only %d commits available.", available);
+            return false;
+        }
+    } else if (isBranchName(target)) {
+        branchName = target;
+    } else if (isCommitId(target)) {
+        snprintf(result->commitId, sizeof(result->commitId), "%s", target);
+    } else {
+        setRepoError(repo, "Unknown branch or commit '%s'.", target);
+        return false;
+    }
+
+    if (branchName) {
+        const char* lastCommitId = cachedBranchHead(repo, branchName);
+        if (!lastCommitId) {
+            setRepoError(repo, "Could not find the last commit for branch '%s'.", branchName);
+            return false;
+        }
+        snprintf(result->commitId, sizeof(result->commitId), "%s", lastCommitId);
+        snprintf(result->branch, sizeof(result->branch), "%s", branchName);
+    }
+
+    restoreCommitSnapshot(result->commitId);
+    return true;
+}
+
+bool zengitRepoResolve(ZengitRepo* repo, const char* revision, char* commitId) {
+    enterRepo(repo);
+    const char* branchName = strcmp(revision, "HEAD") == 0 ? cachedCurrentBranch(repo) :
+                             isBranchName(revision) ? revision : NULL;
+    const char* lastCommitId = branchName ? cachedBranchHead(repo, branchName) : NULL;
+    if (lastCommitId) {
+        snprintf(commitId, ZENGIT_COMMIT_ID_SIZE, "%s", lastCommitId);
+        return true;
+    }
+    if (!branchName && resolveRevision(revision, commitId, ZENGIT_COMMIT_ID_SIZE)) {
+        return true;
+    }
+    setRepoError(repo, "Unknown revision '%s'.", revision);
+    return false;
+}
+
+bool zengitRepoFindCommit(ZengitRepo* repo, const char* commitId, ZengitLogEntry* entry) {
+    enterRepo(repo);
+    if (!refreshLogCache(repo)) {
+        return false;
+    }
+    int* index = stringTableFind(&repo->logIds, commitId);
+    if (!index) {
+        setRepoError(repo, "No log entry for commit '%s'.", commitId);
+        return false;
+    }
+    const LogEntry* found = &repo->log[*index];
+    *entry = (ZengitLogEntry){ found->date, found->user, found->commitID, found->branch, found->message,
+                               found->filesCommitted };
+    return true;
+}
+
+// True for a non-empty relative path without ".." components, so it cannot leave the
+// directory it is resolved against.
+static bool isContainedRelativePath(const char* path) {
+    if (!path[0] || path[0] == '/' || path[0] == '\\' || strchr(path, ':')) {
+        return false;
+    }
+    for (const char* component = path; *component;) {
+        size_t length = strcspn(component, "/\\");
+        if (length == 2 && strncmp(component, "..", 2) == 0) {
+            return false;
+        }
+        component += length;
+        if (*component) component++;
+    }
+    return true;
+}
+
+bool zengitRepoReadFile(ZengitRepo* repo, const char* commitId, const char* path, char** data, size_t* size) {
+    *data = NULL;
+    *size = 0;
+    enterRepo(repo);
+    if (!isContainedRelativePath(path) || strchr(commitId, '/') || strchr(commitId, '\\')) {
+        setRepoError(repo, "Invalid path '%s'.", path);
+        return false;
+    }
+
+    char filePath[MAX_PATH_LENGTH];
+    snprintf(filePath, sizeof(filePath), "%s/%s/%s", COMMIT_DIR, commitId, path);
+    FILE* file = isFile(filePath) ? repoFopen(filePath, "rb") : NULL;
+    if (!file) {
+        setRepoError(repo, "Path '%s' does not exist in commit '%s'.", path, commitId);
+        return false;
+    }
+
+    ByteBuffer contents;
+    memset(&contents, 0, sizeof(contents));
+    char chunk[65536];
+    size_t bytesRead;
+    bool ok = true;
+    while (ok && (bytesRead = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        ok = appendBytes(&contents, chunk, bytesRead);
+        traceCount(TRACE_BYTES_READ, bytesRead);
+    }
+    ok = ok && !ferror(file);
+    fclose(file);
+    if (!ok) {
+        freeByteBuffer(&contents);
+        setRepoError(repo, "Failed to read '%s'.", filePath);
+        return false;
+    }
+    *data = contents.data ? contents.data : calloc(1, 1);
+    *size = contents.size;
+    return *data != NULL;
+}
+
+bool zengitRepoIsStaged(ZengitRepo* repo, const char* path, bool* staged) {
+    enterRepo(repo);
+    if (!refreshIndexCache(repo)) {
+        return false;
+    }
+    *staged = isIndexed(repo, path);
+    return true;
+}
+
+// Brings every cache of the handle up to date.
+static void refreshRepoCaches(ZengitRepo* repo) {
+    enterRepo(repo);
+    cachedUserName(repo);
+    refreshIndexCache(repo);
+    cachedBranchHead(repo, cachedCurrentBranch(repo));
+    refreshLogCache(repo);
+}
+
+// Server mode. One process keeps a warm ZengitRepo and runs each forwarded command in a
+// forked worker, so workers start with the parsed caches and share nothing mutable. The
+// parent schedules workers like a reader/writer lock: read-only commands run side by side,
+// any other command runs alone, and requests start in arrival order so writers are not
+// starved by a stream of readers.
+#ifdef __linux__
+static int connectServer(void) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_un address;
+    if (!setSocketPath(&address, SERVE_SOCKET) || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one message, optionally passing descriptors along with it.
+static bool sendServeMessage(int fd, const char* data, size_t length, const int* fds, int numFds) {
+    union {
+        char buffer[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { (void*)data, length };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if (numFds > 0) {
+        memset(&control, 0, sizeof(control));
+        message.msg_control = control.buffer;
+        message.msg_controllen = CMSG_SPACE(numFds * sizeof(int));
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(numFds * sizeof(int));
+        memcpy(CMSG_DATA(header), fds, numFds * sizeof(int));
+    }
+    return sendmsg(fd, &message, MSG_NOSIGNAL) == (ssize_t)length;
+}
+
+static bool requestServer(const char* request, char* reply, size_t size) {
+    int fd = connectServer();
+    if (fd < 0) {
+        return false;
+    }
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ssize_t bytesRead = -1;
+    if (sendServeMessage(fd, request, strlen(request) + 1, NULL, 0)) {
+        bytesRead = recv(fd, reply, size - 1, 0);
+    }
+    close(fd);
+    if (bytesRead <= 0) {
+        return false;
+    }
+    reply[bytesRead] = '\0';
+    return true;
+}
+
+bool zengitServeControl(const char* request, char* reply, size_t size) {
+    useWorkingDirectory();
+    return requestServer(request, reply, size);
+}
+
+bool zengitServeForward(int argc, char* argv[], int* exitCode) {
+    useWorkingDirectory();
+    // A traced command runs here so the trace covers all of its work.
+    if (argc < 2 || getenv("ZENGIT_NO_SERVER") || getenv("ZENGIT_TRACE") || !fileExists(SERVE_SOCKET) ||
+        strcmp(argv[1], "init") == 0 || strcmp(argv[1], "serve") == 0 || strcmp(argv[1], "fsmonitor") == 0) {
+        return false;
+    }
+
+    ByteBuffer request;
+    memset(&request, 0, sizeof(request));
+    bool ok = appendBytes(&request, "RUN", 4);
+    for (int i = 0; ok && i < argc; i++) {
+        ok = appendBytes(&request, argv[i], strlen(argv[i]) + 1);
+    }
+    int fd = ok && request.size <= SERVE_MAX_REQUEST ? connectServer() : -1;
+    if (fd < 0) {
+        freeByteBuffer(&request);
+        return false;
+    }
+
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    fflush(stdout);
+    fflush(stderr);
+    ok = sendServeMessage(fd, request.data, request.size, fds, 3);
+    freeByteBuffer(&request);
+    if (!ok) {
+        close(fd);
+        return false;
+    }
+
+    // From here on the server owns the command; running it again locally could apply a
+    // change twice.
+    char reply[64];
+    ssize_t bytesRead;
+    do {
+        bytesRead = recv(fd, reply, sizeof(reply) - 1, 0);
+    } while (bytesRead < 0 && errno == EINTR);
+    close(fd);
+    if (bytesRead <= 0 || (reply[bytesRead] = '\0', sscanf(reply, "EXIT %d", exitCode) != 1)) {
+        fprintf(stderr, "Lost connection to the zengit server.\n");
+        *exitCode = 1;
+    }
+    return true;
+}
+
+// Commands that only read repository state may run alongside each other in the server.
+static bool isReadOnlyCommand(int argc, char* argv[]) {
+    const char* command = argv[1];
+    return strcmp(command, "status") == 0 || strcmp(command, "log") == 0 || strcmp(command, "grep") == 0 ||
+           strcmp(command, "batch") == 0 || strcmp(command, "show") == 0 ||
+           strcmp(command, "archive") == 0 ||
+           strcmp(command, "diff") == 0 || (strcmp(command, "branch") == 0 && argc == 2) ||
+           (strcmp(command, "tag") == 0 && (argc == 2 || strcmp(argv[2], "show") == 0)) ||
+           (strcmp(command, "add") == 0 && argc == 4 && strcmp(argv[2], "-n") == 0);
+}
+
+typedef struct {
+    int client;
+    int fds[3];            // the client's stdin, stdout and stderr
+    char* buffer;
+    char** argv;           // points into buffer
+    int argc;
+    bool readOnly;
+    pid_t pid;             // 0 while queued
+} ServeRequest;
+
+typedef struct {
+    ZengitRepo* repo;
+    ZengitCommandRunner run;
+    int listenFd;          // -1 once a STOP request arrived
+    ServeRequest* requests; // running and queued, in arrival order
+    int count;
+    int capacity;
+    int readers;
+    bool writer;
+    long served;
+} Server;
+
+static int serveSignalPipe[2] = { -1, -1 };
+
+static void onServeWorkerExit(int signalNumber) {
+    (void)signalNumber;
+    int savedErrno = errno;
+    if (write(serveSignalPipe[1], "", 1) < 0) {
+        // The pipe is full, so a wakeup is already pending.
+    }
+    errno = savedErrno;
+}
+
+static void closeRequestFds(ServeRequest* request) {
+    for (int i = 0; i < 3; i++) {
+        if (request->fds[i] >= 0) close(request->fds[i]);
+        request->fds[i] = -1;
+    }
+}
+
+static void finishServeRequest(Server* server, int index, int exitCode) {
+    ServeRequest* request = &server->requests[index];
+    char reply[32];
+    int length = snprintf(reply, sizeof(reply), "EXIT %d", exitCode);
+    send(request->client, reply, length, MSG_NOSIGNAL);
+    close(request->client);
+    closeRequestFds(request);
+    free(request->argv);
+    free(request->buffer);
+    memmove(request, request + 1, (server->count - index - 1) * sizeof(ServeRequest));
+    server->count--;
+}
+
+static void stopServerListening(Server* server) {
+    if (server->listenFd >= 0) {
+        close(server->listenFd);
+        repoUnlink(SERVE_SOCKET);
+        server->listenFd = -1;
+    }
+}
+
+static bool parseServeCommand(ServeRequest* request, size_t length) {
+    int argc = 0;
+    for (size_t i = 4; i < length; i++) {
+        if (request->buffer[i] == '\0') argc++;
+    }
+    request->argv = malloc((argc + 1) * sizeof(char*));
+    if (argc < 2 || !request->argv || request->buffer[length - 1] != '\0') {
+        return false;
+    }
+    char* arg = request->buffer + 4;
+    for (int i = 0; i < argc; i++) {
+        request->argv[i] = arg;
+        arg += strlen(arg) + 1;
+    }
+    request->argv[argc] = NULL;
+    request->argc = argc;
+    request->readOnly = isReadOnlyCommand(argc, request->argv);
+    return true;
+}
+
+static bool queueServeRequest(Server* server, const ServeRequest* request) {
+    if (server->count == server->capacity) {
+        int capacity = server->capacity ? server->capacity * 2 : 16;
+        ServeRequest* grown = realloc(server->requests, capacity * sizeof(ServeRequest));
+        if (!grown) {
+            return false;
+        }
+        server->requests = grown;
+        server->capacity = capacity;
+    }
+    server->requests[server->count++] = *request;
+    return true;
+}
+
+// Reads the single message a client sends. RUN requests are queued; STATUS and STOP are
+// answered right away.
+static void handleServeConnection(Server* server, int client) {
+    ServeRequest request;
+    memset(&request, 0, sizeof(request));
+    request.client = client;
+    request.fds[0] = request.fds[1] = request.fds[2] = -1;
+    request.buffer = malloc(SERVE_MAX_REQUEST);
+
+    union {
+        char buffer[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { request.buffer, SERVE_MAX_REQUEST };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    ssize_t length = request.buffer ? recvmsg(client, &message, MSG_CMSG_CLOEXEC) : -1;
+
+    for (struct cmsghdr* header = length > 0 ? CMSG_FIRSTHDR(&message) : NULL; header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS &&
+            header->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+            memcpy(request.fds, CMSG_DATA(header), 3 * sizeof(int));
+        }
+    }
+
+    bool queued = false;
+    if (length >= 4 && memcmp(request.buffer, "RUN", 4) == 0) {
+        queued = request.fds[2] >= 0 && parseServeCommand(&request, (size_t)length) && queueServeRequest(server, &request);
+    } else if (length > 0 && strcmp(request.buffer, "STATUS") == 0) {
+        char reply[256];
+        int replyLength = snprintf(reply, sizeof(reply), "pid %ld, %d readers and %d writer running, %d queued, %ld commands served\n",
+                                   (long)getpid(), server->readers, server->writer ? 1 : 0,
+                                   server->count - server->readers - (server->writer ? 1 : 0), server->served);
+        send(client, reply, replyLength, MSG_NOSIGNAL);
+    } else if (length > 0 && strcmp(request.buffer, "STOP") == 0) {
+        send(client, "Stopped\n", 8, MSG_NOSIGNAL);
+        stopServerListening(server);
+    }
+
+    if (!queued) {
+        if (length >= 4 && memcmp(request.buffer, "RUN", 4) == 0) {
+            send(client, "EXIT 1", 6, MSG_NOSIGNAL);
+        }
+        close(client);
+        closeRequestFds(&request);
+        free(request.argv);
+        free(request.buffer);
+    }
+}
+
+static bool startServeWorker(Server* server, ServeRequest* request) {
+    refreshRepoCaches(server->repo);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        close(serveSignalPipe[0]);
+        close(serveSignalPipe[1]);
+        if (server->listenFd >= 0) close(server->listenFd);
+        for (int i = 0; i < 3; i++) {
+            dup2(request->fds[i], i);
+        }
+        int exitCode = server->run(server->repo, request->argc, request->argv);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(exitCode & 0xff);
+    }
+    if (pid < 0) {
+        dprintf(request->fds[2], "zengit server: failed to start a worker: %s\n", strerror(errno));
+    }
+    // The worker holds the client's descriptors now; the server must not keep pipes open.
+    closeRequestFds(request);
+    request->pid = pid > 0 ? pid : 0;
+    return pid > 0;
+}
+
+static void dispatchServeRequests(Server* server) {
+    for (int i = 0; i < server->count; i++) {
+        ServeRequest* request = &server->requests[i];
+        if (request->pid) continue;
+        bool canStart = !server->writer && (request->readOnly ? server->readers < SERVE_MAX_READERS : server->readers == 0);
+        if (!canStart) {
+            break;
+        }
+        bool readOnly = request->readOnly;
+        if (!startServeWorker(server, request)) {
+            finishServeRequest(server, i--, 1);
+        } else if (readOnly) {
+            server->readers++;
+        } else {
+            server->writer = true;
+        }
+    }
+}
+
+static void reapServeWorkers(Server* server) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (int i = 0; i < server->count; i++) {
+            if (server->requests[i].pid != pid) continue;
+            if (server->requests[i].readOnly) {
+                server->readers--;
+            } else {
+                server->writer = false;
+            }
+            server->served++;
+            finishServeRequest(server, i, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            break;
+        }
+    }
+}
+
+// After STOP the queue is drained before the server exits.
+static void runServer(Server* server) {
+    while (server->listenFd >= 0 || server->count > 0) {
+        struct pollfd fds[2] = { { serveSignalPipe[0], POLLIN, 0 }, { server->listenFd, POLLIN, 0 } };
+        if (poll(fds, server->listenFd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(serveSignalPipe[0], drain, sizeof(drain)) > 0) {
+            }
+            reapServeWorkers(server);
+        }
+        if (server->listenFd >= 0 && (fds[1].revents & POLLIN)) {
+            int client = accept(server->listenFd, NULL, NULL);
+            if (client >= 0) {
+                fcntl(client, F_SETFD, FD_CLOEXEC);
+                handleServeConnection(server, client);
+            }
+        }
+        dispatchServeRequests(server);
+    }
+    stopServerListening(server);
+}
+
+bool zengitServeStart(ZengitRepo* repo, ZengitCommandRunner run, long* pid) {
+    enterRepo(repo);
+    char reply[256];
+    if (requestServer("STATUS", reply, sizeof(reply))) {
+        setRepoError(repo, "A zengit server is already running (%s).", strtok(reply, "\n"));
+        return false;
+    }
+    repoUnlink(SERVE_SOCKET);
+
+    int listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address;
+    if (listenFd < 0 || !setSocketPath(&address, SERVE_SOCKET) ||
+        bind(listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+        setRepoError(repo, "Failed to create server socket: %s", strerror(errno));
+        if (listenFd >= 0) close(listenFd);
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t child = fork();
+    if (child < 0) {
+        setRepoError(repo, "Failed to start server: %s", strerror(errno));
+        close(listenFd);
+        repoUnlink(SERVE_SOCKET);
+        return false;
+    }
+    if (child == 0) {
+        // The server is a process of its own, so it may run in the repository root, where
+        // the commands its workers hand to zengitRunCommand expect to be.
+        if (chdir(repo->root) != 0) {
+            _exit(1);
+        }
+        setsid();
+        stopTracing();
+        signal(SIGPIPE, SIG_IGN);
+        int devNull = open("/dev/null", O_RDWR);
+        if (devNull >= 0) {
+            dup2(devNull, STDIN_FILENO);
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            if (devNull > STDERR_FILENO) close(devNull);
+        }
+
+        Server server;
+        memset(&server, 0, sizeof(server));
+        server.repo = repo;
+        server.run = run;
+        server.listenFd = listenFd;
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onServeWorkerExit;
+        action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        bool ready = pipe(serveSignalPipe) == 0;
+        for (int i = 0; ready && i < 2; i++) {
+            fcntl(serveSignalPipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(serveSignalPipe[i], F_SETFD, FD_CLOEXEC);
+        }
+        if (ready && sigaction(SIGCHLD, &action, NULL) == 0) {
+            refreshRepoCaches(repo);
+            runServer(&server);
+        }
+        stopServerListening(&server);
+        _exit(0);
+    }
+
+    close(listenFd);
+    *pid = (long)child;
+    return true;
+}
+#else
+bool zengitServeStart(ZengitRepo* repo, ZengitCommandRunner run, long* pid) {
+    (void)run;
+    (void)pid;
+    setRepoError(repo, "serve is only supported on Linux.");
+    return false;
+}
+
+bool zengitServeControl(const char* request, char* reply, size_t size) {
+    (void)request;
+    (void)reply;
+    (void)size;
+    return false;
+}
+
+bool zengitServeForward(int argc, char* argv[], int* exitCode) {
+    (void)argc;
+    (void)argv;
+    (void)exitCode;
+    return false;
+}
+#endif
@@ -0,0 +1,141 @@
+#ifndef ZENGIT_H
+#define ZENGIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// libzengit: the repository operations behind the zengit command line tool.
+//
+// A ZengitRepo handle keeps the parsed config, index, branch heads and commit log between
+// calls and only re-reads a file after it changed on disk. All paths are relative to the
+// repository root, which calls taking a handle resolve them against; the process working
+// directory is left alone. Calls without a handle work in the current directory.
+//
+// Functions returning bool report failures through zengitRepoError. Results hold their own
+// memory and are released with the matching zengitFree* function, except where noted.
+
+#define ZENGIT_COMMIT_ID_SIZE 41
+
+typedef struct ZengitRepo ZengitRepo;
+
+// Returns NULL when path is not the root of a zengit repository.
+ZengitRepo* zengitRepoOpen(const char* path);
+void zengitRepoClose(ZengitRepo* repo);
+const char* zengitRepoError(const ZengitRepo* repo);
+
+typedef struct {
+    char code;            // 'A', 'M', 'D', 'T', 'R' (renamed) or 'C' (copied)
+    char* path;
+    char* fromPath;       // source of a rename or copy, NULL otherwise
+    int similarity;       // percentage, for renames and copies
+    bool staged;
+} ZengitStatusEntry;
+
+typedef struct {
+    char headCommitId[ZENGIT_COMMIT_ID_SIZE];
+    ZengitStatusEntry* entries; // sorted by path
+    int count;
+} ZengitStatus;
+
+// Compares the work tree with the last commit of the current branch.
+bool zengitRepoStatus(ZengitRepo* repo, ZengitStatus* status);
+void zengitFreeStatus(ZengitStatus* status);
+
+typedef struct {
+    char** paths;
+    int count;
+} ZengitPathList;
+
+typedef struct {
+    ZengitPathList staged;
+    ZengitPathList alreadyStaged;
+} ZengitAddResult;
+
+// Stages a file, or every file below a directory that .zengitignore does not exclude.
+// With force the path is staged exactly as given, ignored or not.
+bool zengitRepoAdd(ZengitRepo* repo, const char* path, bool force, ZengitAddResult* result);
+void zengitFreeAddResult(ZengitAddResult* result);
+
+typedef struct {
+    char commitId[ZENGIT_COMMIT_ID_SIZE];
+    int filesCommitted;
+} ZengitCommitResult;
+
+bool zengitRepoCommit(ZengitRepo* repo, const char* message, ZengitCommitResult* result);
+
+typedef struct {
+    const char* date;
+    const char* user;
+    const char* commitId;
+    const char* branch;
+    const char* message;
+    int filesCommitted;
+} ZengitLogEntry;
+
+// Unset fields (0 / NULL) do not filter.
+typedef struct {
+    int maxCount;
+    const char* branch;
+    const char* author;
+    const char* since;    // YYYY-MM-DD, inclusive
+    const char* before;   // YYYY-MM-DD, exclusive
+    const char* search;   // space separated words; a message matches if it contains any
+} ZengitLogQuery;
+
+typedef struct {
+    ZengitLogEntry* entries; // newest first
+    int count;
+} ZengitLog;
+
+// The entry strings point into the handle's log cache and stay valid until the next call
+// on repo; zengitFreeLog only releases the array.
+bool zengitRepoLog(ZengitRepo* repo, const ZengitLogQuery* query, ZengitLog* log);
+void zengitFreeLog(ZengitLog* log);
+
+#define ZENGIT_BRANCH_NAME_SIZE 256
+
+typedef struct {
+    char commitId[ZENGIT_COMMIT_ID_SIZE];
+    char branch[ZENGIT_BRANCH_NAME_SIZE]; // empty unless target named a branch (or HEAD)
+} ZengitCheckoutResult;
+
+// target is "HEAD", "HEAD-<n>", a branch name or a commit id. The work tree is replaced by
+// that commit's snapshot.
+bool zengitRepoCheckout(ZengitRepo* repo, const char* target, ZengitCheckoutResult* result);
+
+// Single lookups, cheap enough to call once per item over a long stream of requests.
+// zengitRepoResolve accepts HEAD, a branch, a tag or a commit id and fills
+// ZENGIT_COMMIT_ID_SIZE bytes. zengitRepoFindCommit returns the commit's log entry with
+// the same lifetime as zengitRepoLog entries. zengitRepoReadFile returns a file from a
+// commit's snapshot in a malloc'ed buffer the caller frees.
+bool zengitRepoResolve(ZengitRepo* repo, const char* revision, char* commitId);
+bool zengitRepoFindCommit(ZengitRepo* repo, const char* commitId, ZengitLogEntry* entry);
+bool zengitRepoReadFile(ZengitRepo* repo, const char* commitId, const char* path, char** data, size_t* size);
+bool zengitRepoIsStaged(ZengitRepo* repo, const char* path, bool* staged);
+
+// Server mode (Linux only). zengitServeStart forks a background server that keeps repo's
+// caches warm and runs forwarded commands through run, each in a worker process whose
+// stdin, stdout and stderr are the client's. Read-only commands run concurrently, every
+// other command runs alone. zengitServeControl sends "STATUS" or "STOP" and returns the
+// reply. zengitServeForward hands a command line to a running server; it returns false
+// when none answers, in which case the caller runs the command itself.
+typedef int (*ZengitCommandRunner)(ZengitRepo* repo, int argc, char* argv[]);
+bool zengitServeStart(ZengitRepo* repo, ZengitCommandRunner run, long* pid);
+bool zengitServeControl(const char* request, char* reply, size_t size);
+bool zengitServeForward(int argc, char* argv[], int* exitCode);
+
+// Tracing. With ZENGIT_TRACE=1 a process prints a per-span timing summary with its
+// counters (files stat'ed, bytes read and written, objects hashed, cache hits) to stderr
+// when it exits; any other non-empty value is a file that receives Chrome trace-event JSON
+// instead. Spans nest and name must stay valid until exit, as a string literal does. Both
+// calls cost a branch when tracing is off. Building with -DZENGIT_COUNT_ALLOCATIONS adds
+// heap allocation and free counts to the counters.
+void zengitTraceBegin(const char* name);
+void zengitTraceEnd(void);
+
+// Command line support: expands a configured alias in place, and runs any command the
+// functions above do not cover with the tool's usual output.
+bool zengitExpandAlias(int* argc, char*** argv);
+int zengitRunCommand(int argc, char* argv[]);
+
+#endif